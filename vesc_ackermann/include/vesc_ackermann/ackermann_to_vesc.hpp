@@ -60,7 +60,7 @@ private:
   rclcpp::Subscription<AckermannDriveStamped>::SharedPtr ackermann_sub_;
 
   // ROS callbacks
-  void ackermannCmdCallback(const AckermannDriveStamped::SharedPtr cmd);
+  void ackermannCmdCallback(const AckermannDriveStamped::ConstSharedPtr cmd);
 };
 
 }  // namespace vesc_ackermann
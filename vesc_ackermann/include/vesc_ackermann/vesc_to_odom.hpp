@@ -33,10 +33,12 @@
 
 #include <nav_msgs/msg/odometry.hpp>
 #include <rclcpp/rclcpp.hpp>
+#include <sensor_msgs/msg/imu.hpp>
 #include <std_msgs/msg/float64.hpp>
 #include <tf2_ros/transform_broadcaster.h>
 #include <vesc_msgs/msg/vesc_state_stamped.hpp>
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -44,6 +46,7 @@ namespace vesc_ackermann
 {
 
 using nav_msgs::msg::Odometry;
+using sensor_msgs::msg::Imu;
 using std_msgs::msg::Float64;
 using vesc_msgs::msg::VescStateStamped;
 
@@ -63,21 +66,30 @@ private:
   double steering_to_servo_gain_, steering_to_servo_offset_;
   double wheelbase_;
   bool publish_tf_;
+  /** Integrate the tachometer (displacement) instead of the speed, independent of the poll rate */
+  bool use_tachometer_;
+  double meters_per_tachometer_count_;
+  /** Take the yaw rate from the gyro of the VESC (sensors/imu) instead of the servo command */
+  bool use_imu_yaw_rate_;
 
   // odometry state
   double x_, y_, yaw_;
-  Float64::SharedPtr last_servo_cmd_;  ///< Last servo position commanded value
-  VescStateStamped::SharedPtr last_state_;  ///< Last received state message
+  Float64::ConstSharedPtr last_servo_cmd_;  ///< Last servo position commanded value
+  VescStateStamped::ConstSharedPtr last_state_;  ///< Last received state message
+  Imu::ConstSharedPtr last_imu_;  ///< Last received IMU sample with a yaw rate
+  double imu_delta_yaw_;  ///< yaw integrated from the IMU samples since the last state
 
   // ROS services
   rclcpp::Publisher<Odometry>::SharedPtr odom_pub_;
   rclcpp::Subscription<VescStateStamped>::SharedPtr vesc_state_sub_;
   rclcpp::Subscription<Float64>::SharedPtr servo_sub_;
+  rclcpp::Subscription<Imu>::SharedPtr imu_sub_;
   std::shared_ptr<tf2_ros::TransformBroadcaster> tf_pub_;
 
   // ROS callbacks
-  void vescStateCallback(const VescStateStamped::SharedPtr state);
-  void servoCmdCallback(const Float64::SharedPtr servo);
+  void vescStateCallback(const VescStateStamped::ConstSharedPtr state);
+  void servoCmdCallback(const Float64::ConstSharedPtr servo);
+  void imuCallback(const Imu::ConstSharedPtr imu);
 };
 
 }  // namespace vesc_ackermann
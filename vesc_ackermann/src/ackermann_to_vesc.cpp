@@ -62,7 +62,7 @@ AckermannToVesc::AckermannToVesc(const rclcpp::NodeOptions & options)
     "ackermann_cmd", 10, std::bind(&AckermannToVesc::ackermannCmdCallback, this, _1));
 }
 
-void AckermannToVesc::ackermannCmdCallback(const AckermannDriveStamped::SharedPtr cmd)
+void AckermannToVesc::ackermannCmdCallback(const AckermannDriveStamped::ConstSharedPtr cmd)
 {
   // calc vesc electric RPM (speed)
   Float64 erpm_msg;
@@ -72,7 +72,8 @@ void AckermannToVesc::ackermannCmdCallback(const AckermannDriveStamped::SharedPt
   Float64 servo_msg;
   servo_msg.data = steering_to_servo_gain_ * cmd->drive.steering_angle + steering_to_servo_offset_;
 
-  // publish
+  // publish, the driver takes its commands from the middleware (not intra-process), which
+  // serializes a stack message as well as a heap one
   if (rclcpp::ok()) {
     erpm_pub_->publish(erpm_msg);
     servo_pub_->publish(servo_msg);
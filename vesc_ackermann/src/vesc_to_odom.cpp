@@ -34,6 +34,7 @@
 #include <vesc_msgs/msg/vesc_state_stamped.hpp>
 
 #include <cmath>
+#include <memory>
 #include <string>
 
 namespace vesc_ackermann
@@ -50,9 +51,13 @@ VescToOdom::VescToOdom(const rclcpp::NodeOptions & options)
   base_frame_("base_link"),
   use_servo_cmd_(true),
   publish_tf_(false),
+  use_tachometer_(false),
+  meters_per_tachometer_count_(0.0),
+  use_imu_yaw_rate_(false),
   x_(0.0),
   y_(0.0),
-  yaw_(0.0)
+  yaw_(0.0),
+  imu_delta_yaw_(0.0)
 {
   // get ROS parameters
   declare_parameter("odom_frame", odom_frame_);
@@ -70,6 +75,26 @@ VescToOdom::VescToOdom(const rclcpp::NodeOptions & options)
 
   declare_parameter("publish_tf", publish_tf_);
 
+  // the tachometer counts commutation steps, tachometer_counts_per_erev per electrical revolution
+  use_tachometer_ = declare_parameter("use_tachometer", use_tachometer_);
+  if (use_tachometer_) {
+    double counts_per_erev = declare_parameter("tachometer_counts_per_erev", 6.0);
+    if (counts_per_erev <= 0.0 || speed_to_erpm_gain_ == 0.0) {
+      RCLCPP_ERROR(
+        get_logger(),
+        "Invalid tachometer_counts_per_erev %f or speed_to_erpm_gain %f, "
+        "integrating the speed instead of the tachometer.",
+        counts_per_erev, speed_to_erpm_gain_);
+      use_tachometer_ = false;
+    } else {
+      meters_per_tachometer_count_ = 60.0 / (counts_per_erev * speed_to_erpm_gain_);
+    }
+  }
+
+  // the gyro of the VESC measures the yaw rate instead of estimating it from the steering angle,
+  // the IMU must be rotated to the vehicle axes in the VESC's IMU configuration
+  use_imu_yaw_rate_ = declare_parameter("use_imu_yaw_rate", use_imu_yaw_rate_);
+
   // create odom publisher
   odom_pub_ = create_publisher<Odometry>("odom", 10);
 
@@ -83,15 +108,24 @@ VescToOdom::VescToOdom(const rclcpp::NodeOptions & options)
     "sensors/core", 10, std::bind(&VescToOdom::vescStateCallback, this, _1));
 
   if (use_servo_cmd_) {
-    servo_sub_ = create_subscription<VescStateStamped>(
+    servo_sub_ = create_subscription<Float64>(
       "sensors/servo_position_command", 10, std::bind(&VescToOdom::servoCmdCallback, this, _1));
   }
+
+  if (use_imu_yaw_rate_) {
+    imu_sub_ = create_subscription<Imu>(
+      "sensors/imu", 10, std::bind(&VescToOdom::imuCallback, this, _1));
+  }
 }
 
-void VescToOdom::vescStateCallback(const VescStateStamped::SharedPtr state)
+void VescToOdom::vescStateCallback(const VescStateStamped::ConstSharedPtr state)
 {
-  // check that we have a last servo command if we are depending on it for angular velocity
-  if (use_servo_cmd_ && !last_servo_cmd_) {
+  // check that we have a last servo command (or IMU sample) if we are depending on it for angular
+  // velocity
+  if (use_imu_yaw_rate_ && !last_imu_) {
+    return;
+  }
+  if (!use_imu_yaw_rate_ && use_servo_cmd_ && !last_servo_cmd_) {
     return;
   }
 
@@ -101,7 +135,12 @@ void VescToOdom::vescStateCallback(const VescStateStamped::SharedPtr state)
     current_speed = 0.0;
   }
   double current_steering_angle(0.0), current_angular_velocity(0.0);
-  if (use_servo_cmd_) {
+  // heading change since the last state, from the IMU samples in between
+  double imu_delta_yaw = imu_delta_yaw_;
+  imu_delta_yaw_ = 0.0;
+  if (use_imu_yaw_rate_) {
+    current_angular_velocity = last_imu_->angular_velocity.z;
+  } else if (use_servo_cmd_) {
     current_steering_angle =
       (last_servo_cmd_->data - steering_to_servo_offset_) / steering_to_servo_gain_;
     current_angular_velocity = current_speed * tan(current_steering_angle) / wheelbase_;
@@ -115,44 +154,68 @@ void VescToOdom::vescStateCallback(const VescStateStamped::SharedPtr state)
   // calc elapsed time
   auto dt = rclcpp::Time(state->header.stamp) - rclcpp::Time(last_state_->header.stamp);
 
-  /** @todo could probably do better propigating odometry, e.g. trapezoidal integration */
-
-  // propigate odometry
-  double x_dot = current_speed * cos(yaw_);
-  double y_dot = current_speed * sin(yaw_);
-  x_ += x_dot * dt.seconds();
-  y_ += y_dot * dt.seconds();
-  if (use_servo_cmd_) {
-    yaw_ += current_angular_velocity * dt.seconds();
+  if (use_tachometer_) {
+    // distance since the last state from the tachometer, which is absolute: its accuracy does not
+    // depend on the poll rate and dropped samples are covered by the next one. The difference is
+    // taken modulo 2^32 so that it survives the counter wrapping around.
+    int32_t counts = static_cast<int32_t>(
+      static_cast<uint32_t>(state->state.displacement) -
+      static_cast<uint32_t>(last_state_->state.displacement));
+    // same sign convention as the speed above
+    double distance = -counts * meters_per_tachometer_count_;
+
+    // propagate odometry along the mean of the old and the new heading (trapezoidal rule)
+    double delta_yaw = 0.0;
+    if (use_imu_yaw_rate_) {
+      delta_yaw = imu_delta_yaw;
+    } else if (use_servo_cmd_) {
+      delta_yaw = distance * tan(current_steering_angle) / wheelbase_;
+    }
+    x_ += distance * cos(yaw_ + delta_yaw / 2.0);
+    y_ += distance * sin(yaw_ + delta_yaw / 2.0);
+    yaw_ += delta_yaw;
+  } else {
+    /** @todo could probably do better propigating odometry, e.g. trapezoidal integration */
+
+    // propigate odometry
+    double x_dot = current_speed * cos(yaw_);
+    double y_dot = current_speed * sin(yaw_);
+    x_ += x_dot * dt.seconds();
+    y_ += y_dot * dt.seconds();
+    if (use_imu_yaw_rate_) {
+      yaw_ += imu_delta_yaw;
+    } else if (use_servo_cmd_) {
+      yaw_ += current_angular_velocity * dt.seconds();
+    }
   }
 
   // save state for next time
   last_state_ = state;
 
-  // publish odometry message
-  Odometry odom;
-  odom.header.frame_id = odom_frame_;
-  odom.header.stamp = state->header.stamp;
-  odom.child_frame_id = base_frame_;
+  // publish odometry message, as unique_ptr so that subscribers in the same process get it as is
+  auto odom = std::make_unique<Odometry>();
+  odom->header.frame_id = odom_frame_;
+  odom->header.stamp = state->header.stamp;
+  odom->child_frame_id = base_frame_;
 
   // Position
-  odom.pose.pose.position.x = x_;
-  odom.pose.pose.position.y = y_;
-  odom.pose.pose.orientation.x = 0.0;
-  odom.pose.pose.orientation.y = 0.0;
-  odom.pose.pose.orientation.z = sin(yaw_ / 2.0);
-  odom.pose.pose.orientation.w = cos(yaw_ / 2.0);
+  odom->pose.pose.position.x = x_;
+  odom->pose.pose.position.y = y_;
+  odom->pose.pose.orientation.x = 0.0;
+  odom->pose.pose.orientation.y = 0.0;
+  odom->pose.pose.orientation.z = sin(yaw_ / 2.0);
+  odom->pose.pose.orientation.w = cos(yaw_ / 2.0);
 
   // Position uncertainty
   /** @todo Think about position uncertainty, perhaps get from parameters? */
-  odom.pose.covariance[0] = 0.2;   ///< x
-  odom.pose.covariance[7] = 0.2;   ///< y
-  odom.pose.covariance[35] = 0.4;  ///< yaw
+  odom->pose.covariance[0] = 0.2;   ///< x
+  odom->pose.covariance[7] = 0.2;   ///< y
+  odom->pose.covariance[35] = 0.4;  ///< yaw
 
   // Velocity ("in the coordinate frame given by the child_frame_id")
-  odom.twist.twist.linear.x = current_speed;
-  odom.twist.twist.linear.y = 0.0;
-  odom.twist.twist.angular.z = current_angular_velocity;
+  odom->twist.twist.linear.x = current_speed;
+  odom->twist.twist.linear.y = 0.0;
+  odom->twist.twist.angular.z = current_angular_velocity;
 
   // Velocity uncertainty
   /** @todo Think about velocity uncertainty */
@@ -165,7 +228,7 @@ void VescToOdom::vescStateCallback(const VescStateStamped::SharedPtr state)
     tf.transform.translation.x = x_;
     tf.transform.translation.y = y_;
     tf.transform.translation.z = 0.0;
-    tf.transform.rotation = odom.pose.pose.orientation;
+    tf.transform.rotation = odom->pose.pose.orientation;
 
     if (rclcpp::ok()) {
       tf_pub_->sendTransform(tf);
@@ -173,15 +236,32 @@ void VescToOdom::vescStateCallback(const VescStateStamped::SharedPtr state)
   }
 
   if (rclcpp::ok()) {
-    odom_pub_->publish(odom);
+    odom_pub_->publish(std::move(odom));
   }
 }
 
-void VescToOdom::servoCmdCallback(const Float64::SharedPtr servo)
+void VescToOdom::servoCmdCallback(const Float64::ConstSharedPtr servo)
 {
   last_servo_cmd_ = servo;
 }
 
+void VescToOdom::imuCallback(const Imu::ConstSharedPtr imu)
+{
+  // a covariance of -1 marks a sample without angular velocity
+  if (imu->angular_velocity_covariance[0] < 0.0) {
+    return;
+  }
+  if (last_imu_) {
+    // trapezoidal rule between consecutive samples
+    double dt =
+      (rclcpp::Time(imu->header.stamp) - rclcpp::Time(last_imu_->header.stamp)).seconds();
+    if (dt > 0.0) {
+      imu_delta_yaw_ += 0.5 * (last_imu_->angular_velocity.z + imu->angular_velocity.z) * dt;
+    }
+  }
+  last_imu_ = imu;
+}
+
 }  // namespace vesc_ackermann
 
 #include "rclcpp_components/register_node_macro.hpp"  // NOLINT
@@ -0,0 +1,286 @@
+/**
+ * Throughput of the VESC packet codec and framer, built with -DVESC_DRIVER_BUILD_BENCHMARKS=ON.
+ *
+ *   vesc_codec_benchmark [--iterations N] [--noise RATIO] [--garbage RATIO] [--chunk BYTES] [--seed N]
+ *
+ * --noise is the probability of a bit flip per byte of a received frame, --garbage the number of
+ * random bytes inserted between frames relative to the frame bytes, --chunk the size of the
+ * pieces the byte stream is handed to the framer in (like the serial receive callback does).
+ * The framer is also run on a stream with a fixed amount of garbage, which measures how fast it
+ * resynchronizes on a corrupted link.
+ */
+
+#include "vesc_driver/datatypes.hpp"
+#include "vesc_driver/ring_buffer.hpp"
+#include "vesc_driver/vesc_crc.hpp"
+#include "vesc_driver/vesc_framer.hpp"
+#include "vesc_driver/vesc_packet.hpp"
+#include "vesc_driver/vesc_packet_factory.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace vesc_driver;
+
+namespace {
+
+	typedef std::chrono::steady_clock Clock;
+
+	// results are folded in here so that the compiler can not drop the work being measured
+	volatile uint64_t sink;
+
+	struct Options {
+		size_t iterations = 1000000;
+		double noise = 0.0;
+		double garbage = 0.0;
+		size_t chunk = 64;
+		unsigned int seed = 1;
+	};
+
+	void report(const char *name, size_t frames, Clock::duration elapsed, const char *note = "") {
+		double ns = static_cast<double>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		double ns_per_frame = frames > 0 ? ns / frames : 0.0;
+		double frames_per_s = ns > 0.0 ? frames * 1e9 / ns : 0.0;
+		std::printf("%-36s %14.0f frames/s %10.1f ns/frame  %s\n", name, frames_per_s, ns_per_frame, note);
+	}
+
+	/** Runs @p f @p iterations times (after a short warm-up) and reports one frame per call. */
+	template<typename F>
+	void run(const char *name, size_t iterations, F f) {
+		for (size_t i = 0; i < iterations / 10; i++) {
+			f(i);
+		}
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < iterations; i++) {
+			f(i);
+		}
+		report(name, iterations, Clock::now() - start);
+	}
+
+	/** A complete frame (start, length, payload, checksum, end) around @p payload. */
+	Buffer makeFrame(const Buffer &payload) {
+		Buffer frame;
+		if (payload.size() <= 255) {
+			frame.push_back(VescFrame::VESC_SOF_VAL_SMALL_FRAME);
+			frame.push_back(static_cast<uint8_t>(payload.size()));
+		} else {
+			frame.push_back(VescFrame::VESC_SOF_VAL_LARGE_FRAME);
+			frame.push_back(static_cast<uint8_t>(payload.size() >> 8));
+			frame.push_back(static_cast<uint8_t>(payload.size() & 0xFF));
+		}
+		frame.insert(frame.end(), payload.begin(), payload.end());
+		uint16_t crc = VescCrc::calculate(payload.data(), payload.size());
+		frame.push_back(static_cast<uint8_t>(crc >> 8));
+		frame.push_back(static_cast<uint8_t>(crc & 0xFF));
+		frame.push_back(VescFrame::VESC_EOF_VAL);
+		return frame;
+	}
+
+	/** COMM_GET_VALUES reply of @p size bytes (at least the 73 bytes of all fields). */
+	Buffer valuesPayload(size_t size, std::mt19937 &rng) {
+		Buffer payload(std::max<size_t>(size, 73));
+		for (uint8_t &b : payload) {
+			b = static_cast<uint8_t>(rng());
+		}
+		payload[0] = COMM_GET_VALUES;
+		return payload;
+	}
+
+	void benchmarkCrc(const Options &options, std::mt19937 &rng) {
+		const Buffer small(valuesPayload(73, rng));
+		const Buffer large(valuesPayload(VescFrame::VESC_MAX_PAYLOAD_SIZE, rng));
+
+		run("CRC::Calculate 73 B", options.iterations / 10, [&](size_t) {
+			sink += CRC::Calculate(small.data(), small.size(), VescFrame::CRC_TYPE);
+		});
+		run("CRC::Calculate 1024 B", options.iterations / 100, [&](size_t) {
+			sink += CRC::Calculate(large.data(), large.size(), VescFrame::CRC_TYPE);
+		});
+		run("VescCrc::calculate 73 B", options.iterations, [&](size_t) {
+			sink += VescCrc::calculate(small.data(), small.size());
+		});
+		run("VescCrc::calculate 1024 B", options.iterations / 10, [&](size_t) {
+			sink += VescCrc::calculate(large.data(), large.size());
+		});
+	}
+
+	void benchmarkDecode(const Options &options, std::mt19937 &rng) {
+		// firmware 5.2, hardware name "60", 12 byte uuid, not paired, no test build, hardware type 0
+		const Buffer fw_version(makeFrame(
+			Buffer{COMM_FW_VERSION, 5, 2, '6', '0', 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 0, 0}));
+		const Buffer values(makeFrame(valuesPayload(73, rng)));
+		const Buffer large(makeFrame(valuesPayload(VescFrame::VESC_MAX_PAYLOAD_SIZE, rng)));
+
+		run("createPacket FWVersion (26 B)", options.iterations, [&](size_t) {
+			int bytes_needed;
+			std::string what;
+			sink += VescPacketFactory::createPacket(
+				fw_version.begin(), fw_version.end(), &bytes_needed, &what)->frame().size();
+		});
+		run("createPacket Values (78 B)", options.iterations, [&](size_t) {
+			int bytes_needed;
+			std::string what;
+			sink += VescPacketFactory::createPacket(
+				values.begin(), values.end(), &bytes_needed, &what)->frame().size();
+		});
+		run("createPacket 1024 B payload", options.iterations / 10, [&](size_t) {
+			int bytes_needed;
+			std::string what;
+			sink += VescPacketFactory::createPacket(
+				large.begin(), large.end(), &bytes_needed, &what)->frame().size();
+		});
+		run("createPacket + all Values fields", options.iterations, [&](size_t) {
+			int bytes_needed;
+			std::string what;
+			VescPacketPtr packet(
+				VescPacketFactory::createPacket(values.begin(), values.end(), &bytes_needed, &what));
+			const VescPacketValues &v = static_cast<const VescPacketValues &>(*packet);
+			double sum = v.temp_fet() + v.temp_motor() + v.avg_motor_current() +
+				v.avg_input_current() + v.avg_id() + v.avg_iq() + v.duty_cycle_now() + v.rpm() +
+				v.v_in() + v.amp_hours() + v.amp_hours_charged() + v.watt_hours() +
+				v.watt_hours_charged() + v.tachometer() + v.tachometer_abs() + v.fault_code() +
+				v.pid_pos_now() + v.controller_id() + v.temp_mos1() + v.temp_mos2() + v.temp_mos3() +
+				v.avg_vd() + v.avg_vq();
+			sink += static_cast<uint64_t>(sum);
+		});
+	}
+
+	void benchmarkEncode(const Options &options) {
+		run("VescPacketSetDuty", options.iterations, [](size_t i) {
+			sink += VescPacketSetDuty(0.001 * (i & 0xFF)).frame()[5];
+		});
+		run("VescPacketSetCurrent", options.iterations, [](size_t i) {
+			sink += VescPacketSetCurrent(0.1 * (i & 0xFF)).frame()[5];
+		});
+		run("VescPacketSetCurrentBrake", options.iterations, [](size_t i) {
+			sink += VescPacketSetCurrentBrake(0.1 * (i & 0xFF)).frame()[5];
+		});
+		run("VescPacketSetRPM", options.iterations, [](size_t i) {
+			sink += VescPacketSetRPM(10.0 * (i & 0xFF)).frame()[5];
+		});
+		run("VescPacketSetPos", options.iterations, [](size_t i) {
+			sink += VescPacketSetPos(1.0 * (i & 0xFF)).frame()[5];
+		});
+		run("VescPacketSetServoPos", options.iterations, [](size_t i) {
+			sink += VescPacketSetServoPos(0.004 * (i & 0xFF)).frame()[3];
+		});
+		// the frame VescInterface actually sends with, for comparison
+		VescCommandFrame rpm(COMM_SET_RPM, 4, 1.0);
+		run("VescCommandFrame::encode (RPM)", options.iterations, [&rpm](size_t i) {
+			sink += rpm.encode(10.0 * (i & 0xFF))[5];
+		});
+	}
+
+	/**
+	 * Feeds a stream of Values replies, subject to bit flips (probability @p noise per byte) and
+	 * interleaved with @p garbage random bytes per frame byte, through a RingBuffer into VescFramer
+	 * in the same way VescInterface does.
+	 */
+	void benchmarkFramer(
+		const char *name, const Options &options, double noise, double garbage, std::mt19937 &rng) {
+		const size_t frame_count = std::max<size_t>(options.iterations / 10, 1);
+		const Buffer frame(makeFrame(valuesPayload(73, rng)));
+
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		std::poisson_distribution<size_t> garbage_length(garbage * frame.size());
+		Buffer stream;
+		stream.reserve(frame_count * frame.size() * (1.0 + garbage) + 1024);
+		for (size_t i = 0; i < frame_count; i++) {
+			for (uint8_t b : frame) {
+				if (noise > 0.0 && uniform(rng) < noise) {
+					b ^= static_cast<uint8_t>(1 << (rng() % 8));
+				}
+				stream.push_back(b);
+			}
+			for (size_t n = garbage > 0.0 ? garbage_length(rng) : 0; n > 0; n--) {
+				stream.push_back(static_cast<uint8_t>(rng()));
+			}
+		}
+
+		size_t decoded = 0;
+		VescFramer framer([&decoded](const VescPacketConstPtr &) { decoded++; });
+		RingBuffer ring(16 * VescFrame::VESC_MAX_FRAME_SIZE);
+		const size_t chunk = std::max<size_t>(options.chunk, 1);
+		size_t bytes_wanted = VescFrame::VESC_MIN_FRAME_SIZE;
+
+		Clock::time_point start = Clock::now();
+		for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+			ring.push(stream.data() + offset, std::min(chunk, stream.size() - offset));
+			if (ring.size() >= bytes_wanted) {
+				ring.pop(framer.process(ring.peek(), &bytes_wanted));
+			}
+		}
+		Clock::duration elapsed = Clock::now() - start;
+
+		const VescFramer::Errors &errors = framer.errors();
+		uint64_t rejected = 0;
+		for (uint64_t count : errors.frames) {
+			rejected += count;
+		}
+		char note[160];
+		std::snprintf(
+			note, sizeof(note), "%zu of %zu frames, %.1f MB/s, %llu rejected, %llu bytes skipped",
+			decoded, frame_count,
+			stream.size() * 1e3 / std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+			static_cast<unsigned long long>(rejected),
+			static_cast<unsigned long long>(errors.skipped_bytes));
+		report(name, decoded, elapsed, note);
+	}
+
+	bool parseOptions(int argc, char **argv, Options *options) {
+		for (int i = 1; i < argc; i++) {
+			const char *arg = argv[i];
+			const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+			if (!value) {
+				return false;
+			}
+			if (std::strcmp(arg, "--iterations") == 0) {
+				options->iterations = std::strtoul(value, nullptr, 10);
+			} else if (std::strcmp(arg, "--noise") == 0) {
+				options->noise = std::strtod(value, nullptr);
+			} else if (std::strcmp(arg, "--garbage") == 0) {
+				options->garbage = std::strtod(value, nullptr);
+			} else if (std::strcmp(arg, "--chunk") == 0) {
+				options->chunk = std::strtoul(value, nullptr, 10);
+			} else if (std::strcmp(arg, "--seed") == 0) {
+				options->seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+			} else {
+				return false;
+			}
+			i++;
+		}
+		return options->noise >= 0.0 && options->noise <= 1.0 && options->garbage >= 0.0;
+	}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parseOptions(argc, argv, &options)) {
+		std::fprintf(
+			stderr,
+			"usage: %s [--iterations N] [--noise RATIO] [--garbage RATIO] [--chunk BYTES] [--seed N]\n",
+			argv[0]);
+		return 1;
+	}
+	std::printf(
+		"iterations %zu, noise %g, garbage %g, chunk %zu B, seed %u\n", options.iterations,
+		options.noise, options.garbage, options.chunk, options.seed);
+
+	std::mt19937 rng(options.seed);
+	benchmarkCrc(options, rng);
+	benchmarkDecode(options, rng);
+	benchmarkEncode(options);
+	benchmarkFramer("VescFramer Values stream", options, options.noise, options.garbage, rng);
+	// resynchronizing on a corrupted link: 4 random bytes per frame byte and some bit flips
+	benchmarkFramer("VescFramer 4x garbage stream", options, 0.001, 4.0, rng);
+	return 0;
+}
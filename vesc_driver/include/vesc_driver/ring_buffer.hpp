@@ -0,0 +1,142 @@
+#ifndef VESC_DRIVER__RING_BUFFER_HPP_
+#define VESC_DRIVER__RING_BUFFER_HPP_
+
+#include "vesc_driver/vesc_packet.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace vesc_driver {
+
+	/**
+	 * Fixed-capacity single-producer / single-consumer byte ring.
+	 *
+	 * push() may only be called from one (producer) thread and peek() / pop() only from one
+	 * (consumer) thread. Both sides are wait-free, the storage is allocated once in the constructor.
+	 * Bytes that do not fit when pushed are dropped and accounted for in the overrun counters.
+	 */
+	class RingBuffer {
+	public:
+		/**
+		 * @param capacity Requested capacity in bytes, rounded up to the next power of two.
+		 */
+		explicit RingBuffer(size_t capacity);
+
+		RingBuffer(const RingBuffer &) = delete;
+
+		RingBuffer &operator=(const RingBuffer &) = delete;
+
+		/**
+		 * Discards the content and reallocates the storage for @p capacity bytes (rounded up to the
+		 * next power of two). Neither side may use the ring concurrently.
+		 */
+		void reset(size_t capacity);
+
+		size_t capacity() const {
+			return mask_ + 1;
+		}
+
+		/** Number of bytes available to the consumer. */
+		size_t size() const {
+			return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Appends up to @p size bytes (producer side).
+		 *
+		 * @return Number of bytes actually stored, the rest is counted as an overrun.
+		 */
+		size_t push(const uint8_t *data, size_t size);
+
+		/**
+		 * Stream position after the last byte pushed, i.e. the number of bytes stored since reset()
+		 * (producer side).
+		 */
+		size_t writePosition() const {
+			return head_.load(std::memory_order_relaxed);
+		}
+
+		/** Stream position of the first readable byte, i.e. the number of bytes popped (consumer side). */
+		size_t readPosition() const {
+			return tail_.load(std::memory_order_relaxed);
+		}
+
+		/** View of all bytes available to the consumer, valid until the next pop(). */
+		BufferView peek() const;
+
+		/** Releases the first @p size bytes of the readable data (consumer side). */
+		void pop(size_t size);
+
+		/** Total number of bytes dropped because the ring was full. */
+		uint64_t overrunBytes() const {
+			return overrun_bytes_.load(std::memory_order_relaxed);
+		}
+
+		/** Number of push() calls that had to drop bytes. */
+		uint64_t overrunCount() const {
+			return overrun_count_.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::unique_ptr<uint8_t[]> storage_;
+		size_t mask_;
+		// head_ is only written by the producer, tail_ only by the consumer. Both grow monotonically
+		// and are reduced modulo the capacity on access. Keep them on separate cache lines.
+		alignas(64) std::atomic<size_t> head_{0};
+		alignas(64) std::atomic<size_t> tail_{0};
+		std::atomic<uint64_t> overrun_bytes_{0};
+		std::atomic<uint64_t> overrun_count_{0};
+	};
+
+	/**
+	 * Arrival times of the chunks pushed into a RingBuffer, in a fixed-capacity single-producer /
+	 * single-consumer ring of its own. A chunk is identified by the stream position (see
+	 * RingBuffer::writePosition()) after its last byte.
+	 */
+	class RxTimestampRing {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * @param capacity Requested number of chunks, rounded up to the next power of two.
+		 */
+		explicit RxTimestampRing(size_t capacity);
+
+		RxTimestampRing(const RxTimestampRing &) = delete;
+
+		RxTimestampRing &operator=(const RxTimestampRing &) = delete;
+
+		/** Forgets all chunks. Neither side may use the ring concurrently. */
+		void reset();
+
+		/**
+		 * Records that the bytes before stream position @p end arrived at @p time (producer side). If
+		 * the ring is full the chunk is not recorded, its bytes get the time of a later chunk.
+		 */
+		void push(size_t end, Clock::time_point time);
+
+		/**
+		 * Arrival time of the byte at stream position @p position, or now if it was not recorded.
+		 * Forgets the chunks before it, so @p position must not decrease between calls (consumer
+		 * side).
+		 */
+		Clock::time_point at(size_t position);
+
+	private:
+		struct Chunk {
+			size_t end;
+			Clock::time_point time;
+		};
+
+		std::unique_ptr<Chunk[]> chunks_;
+		size_t mask_;
+		alignas(64) std::atomic<size_t> head_{0};
+		alignas(64) std::atomic<size_t> tail_{0};
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__RING_BUFFER_HPP_
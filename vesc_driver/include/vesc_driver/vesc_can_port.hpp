@@ -0,0 +1,82 @@
+#ifndef VESC_DRIVER__VESC_CAN_PORT_HPP_
+#define VESC_DRIVER__VESC_CAN_PORT_HPP_
+
+#include "vesc_driver/vesc_port.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace vesc_driver {
+
+	struct VescCanPortOptions {
+		/** CAN id of the VESC addressed as VescInterface::LOCAL_CONTROLLER */
+		int local_id = 0;
+		/** Our own CAN id, which the VESCs send their replies to. Must not be used by a VESC. */
+		int sender_id = 254;
+		/**
+		 * Stamp the received frames with the time the CAN controller received them if its driver
+		 * supports it, else with the time the kernel received them.
+		 */
+		bool hardware_timestamps = true;
+	};
+
+	/**
+	 * VescPort talking to the VESCs directly on a Linux SocketCAN interface (e.g. "can0"), the
+	 * device passed to VescInterface::connect(). Like the VESC firmware it translates between the
+	 * frames VescInterface sends and receives and the CAN protocol of the VESCs:
+	 *   - COMM_SET_DUTY, COMM_SET_CURRENT, COMM_SET_CURRENT_BRAKE, COMM_SET_RPM and COMM_SET_POS
+	 *     are sent as the CAN_PACKET_SET_* frames, without a reply,
+	 *   - other requests go into the receive buffer of the VESC (CAN_PACKET_PROCESS_SHORT_BUFFER or
+	 *     CAN_PACKET_FILL_RX_BUFFER + CAN_PACKET_PROCESS_RX_BUFFER), the reply comes back the same
+	 *     way and is received as a frame,
+	 *   - the CAN_PACKET_STATUS broadcasts (CAN_PACKET_STATUS to CAN_PACKET_STATUS_5, enabled in the
+	 *     app configuration of the VESC) are received as replies to COMM_GET_VALUES_SELECTIVE with
+	 *     the fields they contain and the CONTROLLER_ID of their sender.
+	 * Requests for LOCAL_CONTROLLER go to VescCanPortOptions::local_id, those forwarded to a CAN id
+	 * (COMM_FORWARD_CAN) to that id.
+	 *
+	 * The received frames are stamped with the kernel's receive time of the CAN frame they
+	 * complete, see VescCanPortOptions::hardware_timestamps.
+	 */
+	class VescCanPort : public VescPort {
+	public:
+		/** @throw std::invalid_argument if an id is out of range. */
+		explicit VescCanPort(const VescCanPortOptions &options = VescCanPortOptions());
+
+		~VescCanPort() override;
+
+		/** @p device is the name of the network interface. @throw std::runtime_error */
+		void open(const std::string &device, const ReceiveHandler &handler) override;
+
+		void close() override;
+
+		bool isOpen() const override;
+
+		/** Sends the complete frames in @p data, returns their size. */
+		size_t send(const Buffer &data) override;
+
+	private:
+		void receive(ReceiveHandler handler);
+		void receiveFrame(
+			uint32_t id, const uint8_t *data, size_t size, Clock::time_point rx_time,
+			const ReceiveHandler &handler);
+		bool sendPayload(int target, const uint8_t *payload, size_t size);
+		bool sendBuffer(int target, const uint8_t *payload, size_t size);
+		bool sendCanFrame(uint32_t id, const uint8_t *data, size_t size);
+
+		const VescCanPortOptions options_;
+		int socket_;
+		std::atomic<bool> run_;
+		std::thread thread_;
+
+		// only used by the receive thread: the reply being reassembled and the frame built from it
+		uint8_t rx_buffer_[VescFrame::VESC_MAX_PAYLOAD_SIZE];
+		Buffer rx_frame_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_CAN_PORT_HPP_
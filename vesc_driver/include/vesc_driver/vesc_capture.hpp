@@ -0,0 +1,96 @@
+#ifndef VESC_DRIVER__VESC_CAPTURE_HPP_
+#define VESC_DRIVER__VESC_CAPTURE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace vesc_driver {
+
+	/**
+	 * Capture file of the raw byte stream of a VESC link, as written by VescCaptureWriter.
+	 *
+	 * The file starts with the 8 byte magic "VESCCAP" followed by the format version (1) and the
+	 * system clock time of the start of the capture (int64, ns since the epoch). Each chunk of bytes
+	 * received or written is a record of
+	 *   - int64  steady clock time (ns) the chunk was received or written at
+	 *   - uint32 chunk size, with bit 31 set for bytes written to the VESC
+	 *   - the bytes of the chunk
+	 * All integers are little-endian.
+	 */
+	struct VescCapture {
+		static constexpr char MAGIC[8] = {'V', 'E', 'S', 'C', 'C', 'A', 'P', 1};
+		static constexpr size_t FILE_HEADER_SIZE = 16;
+		static constexpr size_t RECORD_HEADER_SIZE = 12;
+		static constexpr uint32_t TX_FLAG = 0x80000000u;
+	};
+
+	/**
+	 * Appends the chunks of a VESC link to a capture file. Thread-safe, the receive and transmit
+	 * threads record into the same file.
+	 */
+	class VescCaptureWriter {
+	public:
+		/** @throw std::runtime_error if @p path can not be created. */
+		explicit VescCaptureWriter(const std::string &path);
+
+		VescCaptureWriter(const VescCaptureWriter &) = delete;
+
+		VescCaptureWriter &operator=(const VescCaptureWriter &) = delete;
+
+		~VescCaptureWriter();
+
+		/** Records @p size bytes received from (@p tx false) or written to (@p tx true) the VESC. */
+		void write(bool tx, const uint8_t *data, size_t size);
+
+	private:
+		std::mutex mutex_;
+		std::FILE *file_;
+	};
+
+	/**
+	 * Reads a capture file through a read-only memory mapping, the records point right into it.
+	 */
+	class VescCaptureReader {
+	public:
+		struct Record {
+			int64_t time_ns;      ///< steady clock time of the chunk
+			bool tx;              ///< written to the VESC rather than received from it
+			const uint8_t *data;  ///< valid for the lifetime of the reader
+			size_t size;
+		};
+
+		/** @throw std::runtime_error if @p path can not be mapped or is not a capture file. */
+		explicit VescCaptureReader(const std::string &path);
+
+		VescCaptureReader(const VescCaptureReader &) = delete;
+
+		VescCaptureReader &operator=(const VescCaptureReader &) = delete;
+
+		~VescCaptureReader();
+
+		/** System clock time of the start of the capture, ns since the epoch. */
+		int64_t startTime() const {
+			return start_time_;
+		}
+
+		/** Gets the next record, returns false at the end (a truncated last record is ignored). */
+		bool next(Record *record);
+
+		/** Goes back to the first record. */
+		void rewind() {
+			offset_ = VescCapture::FILE_HEADER_SIZE;
+		}
+
+	private:
+		const uint8_t *data_ = nullptr;
+		size_t size_ = 0;
+		size_t offset_ = VescCapture::FILE_HEADER_SIZE;
+		int64_t start_time_ = 0;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_CAPTURE_HPP_
@@ -0,0 +1,51 @@
+#ifndef VESC_DRIVER__VESC_CONFIG_CACHE_HPP_
+#define VESC_DRIVER__VESC_CONFIG_CACHE_HPP_
+
+#include <string>
+
+#include "vesc_driver/vesc_packet.hpp"
+
+namespace vesc_driver {
+
+	/**
+	 * On-disk cache of the configuration packets (COMM_GET_MCCONF, COMM_GET_APPCONF) of VESCs, so
+	 * that a driver can start with the configuration it read last time instead of waiting for the
+	 * bulk read. Entries are keyed by the controller's uuid and firmware version (see key()), each
+	 * one is a file holding the raw frame as received, checked by its CRC when loaded.
+	 */
+	class VescConfigCache {
+	public:
+		/** Caches in @p directory, which is created by the first store(). */
+		explicit VescConfigCache(const std::string &directory);
+
+		/** The key of the controller that sent @p fw_version, e.g. "1c0036000b51353433383535-5.2" */
+		static std::string key(const VescPacketFWVersion &fw_version);
+
+		/**
+		 * Loads the packet with @p payload_id stored for @p key.
+		 *
+		 * @return An empty pointer if there is none or the file is not a valid frame.
+		 */
+		VescPacketPtr load(const std::string &key, int payload_id) const;
+
+		/**
+		 * Stores @p packet for @p key, replacing the one stored before. The file is replaced
+		 * atomically, a concurrent load() sees either version.
+		 *
+		 * @throw std::runtime_error if the file could not be written.
+		 */
+		void store(const std::string &key, const VescPacket &packet) const;
+
+		const std::string &directory() const {
+			return directory_;
+		}
+
+	private:
+		std::string path(const std::string &key, int payload_id) const;
+
+		std::string directory_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_CONFIG_CACHE_HPP_
@@ -0,0 +1,28 @@
+#ifndef VESC_DRIVER__VESC_CRC_HPP_
+#define VESC_DRIVER__VESC_CRC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vesc_driver {
+
+	/**
+	 * CRC-16/XMODEM (polynomial 0x1021, initial value 0, no reflection, no final xor), i.e. the
+	 * checksum described by VescFrame::CRC_TYPE.
+	 *
+	 * Unlike CRC::Calculate() with the CRC_TYPE parameters, which works bit by bit, this uses lookup
+	 * tables generated at compile time and processes bulk data eight bytes at a time
+	 * (slicing-by-8).
+	 */
+	class VescCrc {
+	public:
+		/**
+		 * Calculates the CRC of @p size bytes at @p data. Pass the result of a previous call as
+		 * @p crc to continue a calculation over non-contiguous pieces of data.
+		 */
+		static uint16_t calculate(const uint8_t *data, size_t size, uint16_t crc = 0);
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_CRC_HPP_
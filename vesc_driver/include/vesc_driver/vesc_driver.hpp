@@ -31,24 +31,42 @@
 #ifndef VESC_DRIVER__VESC_DRIVER_HPP_
 #define VESC_DRIVER__VESC_DRIVER_HPP_
 
+#include <ackermann_msgs/msg/ackermann_drive_stamped.hpp>
+#include <diagnostic_msgs/msg/diagnostic_array.hpp>
 #include <rclcpp/rclcpp.hpp>
+#include <sensor_msgs/msg/imu.hpp>
 #include <std_msgs/msg/float64.hpp>
 #include <vesc_msgs/msg/vesc_state.hpp>
 #include <vesc_msgs/msg/vesc_state_stamped.hpp>
+#include <vesc_msgs/msg/vesc_state_summary_stamped.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <optional>
+#include <vector>
 
+#include "vesc_driver/vesc_config_cache.hpp"
+#include "vesc_driver/vesc_instrumentation.hpp"
 #include "vesc_driver/vesc_interface.hpp"
 #include "vesc_driver/vesc_packet.hpp"
+#include "vesc_driver/vesc_sample_sink.hpp"
+#include "vesc_driver/vesc_telemetry_window.hpp"
+#include "vesc_driver/vesc_thread.hpp"
 
 namespace vesc_driver
 {
 
+using ackermann_msgs::msg::AckermannDriveStamped;
+using diagnostic_msgs::msg::DiagnosticArray;
+using sensor_msgs::msg::Imu;
 using std_msgs::msg::Float64;
 using vesc_msgs::msg::VescState;
 using vesc_msgs::msg::VescStateStamped;
+using vesc_msgs::msg::VescStateSummary;
+using vesc_msgs::msg::VescStateSummaryStamped;
 
 class VescDriver
   : public rclcpp::Node
@@ -56,12 +74,99 @@ class VescDriver
 public:
   explicit VescDriver(const rclcpp::NodeOptions & options);
 
+  /**
+   * Creates a driver whose VescInterface uses @p io_context and (if not null) @p executor, both
+   * shared with other drivers in the same process, see VescInterface.
+   */
+  VescDriver(
+    const rclcpp::NodeOptions & options, drivers::common::IoContext & io_context,
+    VescExecutor * executor);
+
+  /**
+   * Declares the parameters <prefix>_policy ("other", "fifo" or "rr"), <prefix>_priority and
+   * <prefix>_cpus (empty = any) of @p node and returns the ThreadConfig they describe.
+   */
+  static ThreadConfig declareThreadConfig(rclcpp::Node & node, const std::string & prefix);
+
+  /** True once the handshake is complete and commands are sent to the VESC rather than kept. */
+  bool isOperating() const;
+
 private:
+  void initialize();
+
   // interface to the VESC
   VescInterface vesc_;
-  void vescPacketCallback(const std::shared_ptr<VescPacket const> & packet);
+  void vescValuesCallback(const VescPacketValues & values);
+  void vescValuesSelectiveCallback(const VescPacketValuesSelective & values);
+  void vescFWVersionCallback(const VescPacketFWVersion & fw_version);
+  void vescMcConfCallback(const VescPacketMcConf & mcconf);
+  void vescAppConfCallback(const VescPacketAppConf & appconf);
+  void vescPlotInitCallback(const VescPacketPlotInit & plot_init);
+  void vescPlotSetGraphCallback(const VescPacketPlotSetGraph & set_graph);
+  void vescPlotDataCallback(const VescPacketPlotData & plot_data);
+  void vescSamplePrintCallback(const VescPacketSamplePrint & sample);
+  void vescImuDataCallback(const VescPacketImuData & imu);
+
+  // onboard IMU of the VESC on the port, polled on a schedule of its own and published on
+  // sensors/imu
+  void imuTimerCallback();
+  rclcpp::Publisher<Imu>::SharedPtr imu_pub_;
+  rclcpp::TimerBase::SharedPtr imu_timer_;
+  uint32_t imu_mask_ = 0;               ///< fields requested, see VescPacketImuData::Field
+  std::string imu_frame_id_;
+
+  // high-rate sample streams (e.g. for motor tuning) written to <sample_capture_prefix>_*.vsmp, see
+  // VescSampleFile; the sinks are only fed by the rx thread
+  std::string sample_capture_prefix_;
+  std::unique_ptr<VescSampleSink> sample_sink_;  ///< COMM_SAMPLE_PRINT
+  std::unique_ptr<VescSampleSink> plot_sink_;    ///< COMM_PLOT_DATA, a file per COMM_PLOT_INIT
+  int plot_count_ = 0;                  ///< plots started so far
+  float plot_graph_ = 0.0f;             ///< graph selected by COMM_PLOT_SET_GRAPH
   void vescErrorCallback(const std::string & error);
 
+  // commands received before the driver is operating, sent as soon as it is (latest wins per kind)
+  struct CommandLimit;
+  struct PendingCommand
+  {
+    CommandLimit * limit = nullptr;     ///< null if no command is pending
+    void (VescInterface::* set_command)(double, int) = nullptr;
+    double value = 0.0;                 ///< before clipping
+    double scale = 1.0;                 ///< applied after clipping
+  };
+  struct PendingCommands
+  {
+    PendingCommand motor;
+    PendingCommand servo;
+  };
+  PendingCommands pending_commands_;    ///< of the VESC on the serial port
+  std::mutex command_mutex_;            ///< protects the pending commands and the mode switch
+  bool deferCommands(std::unique_lock<std::mutex> & lock);
+  void sendCommand(
+    CommandLimit & limit, void (VescInterface::* set_command)(double, int), double value,
+    int can_id = VescInterface::LOCAL_CONTROLLER, double scale = 1.0);
+  void sendPendingCommands(PendingCommands & pending, int can_id);
+
+  // sensors/core at up to core_publish_rate and sensors/core_summary every core_summary_period
+  struct TelemetryOutput
+  {
+    rclcpp::Publisher<VescStateStamped>::SharedPtr state_pub;
+    rclcpp::Publisher<VescStateSummaryStamped>::SharedPtr summary_pub;  ///< null if disabled
+    std::chrono::steady_clock::time_point next_state;   ///< next sample to publish on state_pub
+    std::optional<VescTelemetryWindow> window;          ///< the samples of the current summary
+  };
+
+  // VESCs on the CAN bus, reached through COMM_FORWARD_CAN by the VESC on the serial port
+  struct CanController
+  {
+    int can_id;
+    TelemetryOutput telemetry;
+    std::vector<rclcpp::SubscriptionBase::SharedPtr> command_subs;
+    PendingCommands pending;            ///< commands received before the driver is operating
+    VescStateStamped telemetry_state;   ///< selective telemetry cache, only used by the rx thread
+  };
+  std::vector<CanController> can_controllers_;
+  CanController * findCanController(int controller_id);
+
   // limits on VESC commands
   struct CommandLimit
   {
@@ -71,11 +176,21 @@ private:
       const std::optional<double> & min_lower = std::optional<double>(),
       const std::optional<double> & max_upper = std::optional<double>());
     double clip(double value);
+    /**
+     * Narrows the configured limits to the range the VESC accepts, e.g. from its motor
+     * configuration: each configured bound is clamped into the range, a missing one is replaced by
+     * the range's bound. Replaces the range of an earlier call.
+     */
+    void setFeasibleRange(
+      const std::optional<double> & feasible_lower, const std::optional<double> & feasible_upper);
     rclcpp::Node * node_ptr;
     rclcpp::Logger logger;
+    rclcpp::Clock::SharedPtr clock;     ///< of the node, for the throttled clipping messages
     std::string name;
     std::optional<double> lower;
     std::optional<double> upper;
+    std::optional<double> configured_lower;  ///< lower from the parameters
+    std::optional<double> configured_upper;  ///< upper from the parameters
   };
 
   CommandLimit duty_cycle_limit_;
@@ -86,7 +201,7 @@ private:
   CommandLimit servo_limit_;
 
   // ROS services
-  rclcpp::Publisher<VescStateStamped>::SharedPtr state_pub_;
+  TelemetryOutput telemetry_output_;
   rclcpp::Publisher<Float64>::SharedPtr servo_sensor_pub_;
   rclcpp::SubscriptionBase::SharedPtr duty_cycle_sub_;
   rclcpp::SubscriptionBase::SharedPtr current_sub_;
@@ -96,6 +211,30 @@ private:
   rclcpp::SubscriptionBase::SharedPtr servo_sub_;
   rclcpp::TimerBase::SharedPtr timer_;
 
+  // fused ackermann_cmd mode: the conversion of vesc_ackermann::AckermannToVesc done in the driver
+  rclcpp::SubscriptionBase::SharedPtr ackermann_sub_;
+  double speed_to_erpm_gain_;
+  double speed_to_erpm_offset_;
+  double steering_to_servo_gain_;
+  double steering_to_servo_offset_;
+
+  // link diagnostics, published every diagnostics_period seconds
+  rclcpp::Publisher<DiagnosticArray>::SharedPtr diagnostics_pub_;
+  rclcpp::TimerBase::SharedPtr diagnostics_timer_;
+  std::string port_;
+  LatencyHistogram publish_latency_;    ///< publishState()
+  uint64_t reported_errors_ = 0;        ///< receive errors at the last diagnostics report
+  void publishState(
+    const rclcpp::Publisher<VescStateStamped>::SharedPtr & publisher, const VescStateStamped & msg);
+  void publishTelemetry(
+    TelemetryOutput & output, const VescStateStamped & msg,
+    std::chrono::steady_clock::time_point rx_time);
+  void createTelemetryOutput(TelemetryOutput & output, const std::string & prefix);
+  std::chrono::steady_clock::duration core_publish_period_;   ///< zero = every sample
+  std::chrono::steady_clock::duration core_summary_period_;   ///< zero = no summaries
+  size_t core_summary_capacity_;        ///< samples kept per summary window
+  void diagnosticsCallback();
+
   // driver modes (possible states)
   typedef enum
   {
@@ -103,12 +242,67 @@ private:
     MODE_OPERATING
   }
   driver_mode_t;
-  bool ensureOperatingMode();
+  void enterOperatingMode();
+  void subscribeCanCommand(
+    CanController & controller, const std::string & topic, CommandLimit & limit,
+    void (VescInterface::* set_command)(double, int));
 
   // other variables
-  driver_mode_t driver_mode_;           ///< driver state machine mode (state)
-  int fw_version_major_;                ///< firmware major version reported by vesc
-  int fw_version_minor_;                ///< firmware minor version reported by vesc
+  std::atomic<driver_mode_t> driver_mode_;  ///< driver state machine mode (state)
+  std::atomic<int> fw_version_major_;   ///< firmware major version reported by vesc
+  std::atomic<int> fw_version_minor_;   ///< firmware minor version reported by vesc
+
+  // startup handshake: COMM_FW_VERSION every fw_version_retry_interval until the VESC replies
+  void handshakeCallback();
+  rclcpp::TimerBase::SharedPtr handshake_timer_;
+  std::chrono::steady_clock::time_point handshake_start_;
+  std::chrono::steady_clock::duration handshake_timeout_;  ///< zero = wait forever
+
+  // motor and app configuration of the VESC, cached on disk per controller and firmware version:
+  // with a cached copy the driver starts operating right away and revalidates it in the background
+  bool configReady();
+  void applyConfig();
+  void applyMcConf(const VescPacketMcConf & mcconf);
+  enum ConfigState
+  {
+    CONFIG_UNKNOWN,                     ///< not requested yet
+    CONFIG_REQUESTED,                   ///< requested, no configuration known yet
+    CONFIG_CACHED,                      ///< limits seeded from the cache, revalidation requested
+    CONFIG_READ                         ///< limits seeded from a configuration read from the VESC
+  };
+  bool read_config_;                    ///< read the configuration and seed the command limits
+  std::unique_ptr<VescConfigCache> config_cache_;  ///< null if disabled
+  std::chrono::steady_clock::duration config_timeout_;  ///< to wait for the configuration
+  ConfigState config_state_;
+  std::chrono::steady_clock::time_point config_request_time_;
+  VescPacketPtr cached_mcconf_;         ///< as loaded from or stored to the cache
+  VescPacketPtr cached_appconf_;
+  std::mutex config_mutex_;             ///< protects the members below (timer vs rx thread)
+  std::string config_key_;              ///< cache key of the connected VESC, see VescConfigCache
+  std::optional<VescPacketMcConf> received_mcconf_;    ///< not applied yet
+  std::optional<VescPacketAppConf> received_appconf_;  ///< not applied yet
+
+  // telemetry polling, either one request per timer tick or pipelined (next request on reply)
+  void requestTelemetry();
+  void telemetryReceived(std::chrono::steady_clock::time_point rx_time);
+  rclcpp::Time receiveStamp(const VescFrame & packet);
+  int can_local_id_;                    ///< CAN id of the local VESC (socketcan transport), else -1
+  bool telemetry_selective_;            ///< poll COMM_GET_VALUES_SELECTIVE instead of COMM_GET_VALUES
+  bool telemetry_broadcast_;            ///< poll nothing, the VESCs broadcast CAN_PACKET_STATUS
+  uint32_t telemetry_fast_mask_;        ///< fields polled with every request
+  uint32_t telemetry_slow_mask_;        ///< fields polled every telemetry_slow_period_
+  std::chrono::steady_clock::duration telemetry_slow_period_;
+  bool telemetry_pipelined_;            ///< request the next sample as soon as a reply arrives
+  int telemetry_max_outstanding_;       ///< maximum number of unanswered pipelined requests
+  std::chrono::steady_clock::duration telemetry_timeout_;  ///< after which a request counts as lost
+  std::mutex telemetry_mutex_;          ///< protects the request state below (timer vs rx thread)
+  int telemetry_outstanding_;
+  std::chrono::steady_clock::time_point telemetry_last_request_;
+  std::chrono::steady_clock::time_point telemetry_slow_last_request_;
+  bool telemetry_rtt_pending_;          ///< no reply arrived since the last request yet
+  bool telemetry_stamp_half_rtt_;       ///< date the stamps back by half the round trip
+  std::atomic<int64_t> telemetry_half_rtt_ns_{0};  ///< filtered half round trip, in ns
+  VescStateStamped telemetry_state_;    ///< latest value of every field, only used by the rx thread
 
   // ROS callbacks
   void brakeCallback(const Float64::SharedPtr brake);
@@ -117,6 +311,7 @@ private:
   void positionCallback(const Float64::SharedPtr position);
   void servoCallback(const Float64::SharedPtr servo);
   void speedCallback(const Float64::SharedPtr speed);
+  void ackermannCmdCallback(const AckermannDriveStamped::ConstSharedPtr cmd);
   void timerCallback();
 };
 
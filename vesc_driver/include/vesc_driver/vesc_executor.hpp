@@ -0,0 +1,102 @@
+#ifndef VESC_DRIVER__VESC_EXECUTOR_HPP_
+#define VESC_DRIVER__VESC_EXECUTOR_HPP_
+
+#include "vesc_driver/vesc_thread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vesc_driver {
+
+	/**
+	 * Small pool of threads running the frame parser and the transmit scheduler of several
+	 * VescInterface objects, so the number of threads does not grow with the number of VESCs.
+	 * Without an executor each VescInterface runs a receive and a transmit thread of its own.
+	 *
+	 * Each link is assigned to the thread with the fewest links when it is attached and is serviced
+	 * by that thread only, i.e. the per-link single-consumer guarantees still hold.
+	 */
+	class VescExecutor {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Work of one link, implemented by VescInterface.
+		 */
+		class Link {
+		public:
+			virtual ~Link() {}
+
+			/**
+			 * Handles all work that is due at @p now and lowers @p wake_up to the time more work will
+			 * be due (if earlier). Called by one executor thread at a time.
+			 */
+			virtual void service(Clock::time_point now, Clock::time_point *wake_up) = 0;
+
+		private:
+			friend class VescExecutor;
+			// assigned by attach(), read by wakeUp() from other threads
+			std::atomic<size_t> worker_{0};
+		};
+
+		/** Starts @p thread_count (at least one) threads. */
+		explicit VescExecutor(size_t thread_count = 1);
+
+		VescExecutor(const VescExecutor &) = delete;
+
+		VescExecutor &operator=(const VescExecutor &) = delete;
+
+		/** Stops the threads, all links must have been detached. */
+		~VescExecutor();
+
+		size_t threadCount() const {
+			return workers_.size();
+		}
+
+		/** Starts servicing @p link. */
+		void attach(Link &link);
+
+		/** Stops servicing @p link, when this returns link.service() is not running any more. */
+		void detach(Link &link);
+
+		/** Makes the thread of @p link call link.service() soon, e.g. because data was received. */
+		void wakeUp(const Link &link);
+
+		/**
+		 * Applies @p config to all threads, see vesc_driver::applyThreadConfig().
+		 *
+		 * @throw std::runtime_error if a thread failed to apply it.
+		 */
+		void applyThreadConfig(const ThreadConfig &config);
+
+	private:
+		struct Worker {
+			std::mutex mutex;
+			// signalled by wakeUp() and stop
+			std::condition_variable cv;
+			// signalled at the end of each service pass, detach() waits on it
+			std::condition_variable idle_cv;
+			std::vector<Link *> links;
+			bool pending = false;
+			bool servicing = false;
+			bool run = true;
+			// run by the thread between two service passes, cleared when done
+			std::function<void()> task;
+			std::thread thread;
+		};
+
+		void run(Worker &worker);
+
+		std::vector<std::unique_ptr<Worker>> workers_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_EXECUTOR_HPP_
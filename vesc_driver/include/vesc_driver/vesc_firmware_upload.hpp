@@ -0,0 +1,135 @@
+#ifndef VESC_DRIVER__VESC_FIRMWARE_UPLOAD_HPP_
+#define VESC_DRIVER__VESC_FIRMWARE_UPLOAD_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "vesc_driver/vesc_packet.hpp"
+
+namespace vesc_driver {
+
+	/**
+	 * Compresses @p size bytes at @p data into @p compressed in the LZO1X format the VESC firmware
+	 * decompresses (COMM_WRITE_NEW_APP_DATA_LZO).
+	 *
+	 * @return false if the data could not be compressed, the chunk is then written uncompressed.
+	 */
+	typedef std::function<bool(const uint8_t *data, size_t size, Buffer *compressed)>
+		VescChunkCompressor;
+
+	/**
+	 * The LZO1X-1 compressor of liblzo2, empty if the package was built without it (see
+	 * VESC_DRIVER_HAVE_LZO). Another implementation can be passed as
+	 * VescFirmwareUploadOptions::compressor instead.
+	 */
+	VescChunkCompressor lzoCompressor();
+
+	struct VescFirmwareUploadOptions {
+		/** CAN id of the VESC to update through the one on the port, -1 for the one on the port */
+		int can_id = -1;
+		/**
+		 * Use the *_ALL_CAN requests: the VESC on the port forwards every request to all VESCs on
+		 * the CAN bus, so that they are all updated at once (they must run the same hardware).
+		 */
+		bool all_can = false;
+		/**
+		 * Image bytes per write, 0 = as many as fit in the largest frame (VESC_MAX_PAYLOAD_SIZE).
+		 * Firmware with a smaller packet buffer needs a smaller size.
+		 */
+		size_t chunk_size = 0;
+		/**
+		 * Writes in flight without a reply. Over a UART without flow control the VESC's receive
+		 * buffer (about one full frame) limits this to 1 or 2, USB links take more.
+		 */
+		size_t window = 2;
+		/** Compresses the chunks if set, e.g. lzoCompressor() */
+		VescChunkCompressor compressor;
+		std::chrono::milliseconds erase_timeout{30000};  ///< erasing takes seconds, more with all_can
+		std::chrono::milliseconds write_timeout{1000};   ///< after which a write is sent again
+		int write_retries = 3;          ///< repetitions of a write before the upload fails
+		/** Restart into the bootloader when done, which installs and starts the new firmware */
+		bool jump_to_bootloader = true;
+		/** Called with the bytes written so far and the total, from the uploading thread */
+		std::function<void(size_t written, size_t total)> progress;
+	};
+
+	/**
+	 * Uploads a firmware image to a VESC: erases the new application area, writes the image in
+	 * chunks of up to a full frame, keeping a window of writes in flight, and optionally restarts
+	 * into the bootloader, which installs it. Like the VESC Tool the image is preceded by its size
+	 * and CRC, which the bootloader checks before installing it.
+	 *
+	 * Frames go out through a send function and the replies are fed in with handlePacket(), which
+	 * may be called from any thread while run() blocks the calling one.
+	 */
+	class VescFirmwareUpload {
+	public:
+		/** Queues a frame for writing, false if it could not be queued (tried again later). */
+		typedef std::function<bool(const VescPacket &)> SendFunction;
+
+		/** @throw std::invalid_argument if the options are invalid or @p image is empty. */
+		VescFirmwareUpload(
+			const Buffer &image, const VescFirmwareUploadOptions &options, SendFunction send);
+
+		VescFirmwareUpload(const VescFirmwareUpload &) = delete;
+
+		VescFirmwareUpload &operator=(const VescFirmwareUpload &) = delete;
+
+		/**
+		 * Runs the upload to the end.
+		 *
+		 * @throw std::runtime_error if the VESC rejects or does not answer a request.
+		 */
+		void run();
+
+		/** Takes the replies to the upload requests, ignores other packets. */
+		void handlePacket(const VescPacket &packet);
+
+		/** Bytes sent by the write requests, i.e. after compression */
+		size_t bytesSent() const;
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Chunk {
+			uint32_t offset;
+			uint32_t size;                  ///< image bytes
+			std::unique_ptr<VescPacket> packet;
+			Clock::time_point sent;
+			int attempts = 0;
+			bool acked = false;
+		};
+
+		void erase(std::unique_lock<std::mutex> &lock);
+		void write(std::unique_lock<std::mutex> &lock);
+		bool sendChunk(Chunk &chunk, Clock::time_point now);
+		void reportProgress(std::unique_lock<std::mutex> &lock);
+
+		const VescFirmwareUploadOptions options_;
+		const SendFunction send_;
+		size_t total_;                      ///< size of the image with its header
+		size_t bytes_sent_;
+
+		mutable std::mutex mutex_;          ///< protects the members below (run() vs handlePacket())
+		std::condition_variable cv_;
+		std::vector<Chunk> chunks_;
+		std::deque<size_t> in_flight_;      ///< indices into chunks_, in the order sent
+		size_t acked_bytes_;
+		bool erase_pending_;
+		bool erase_replied_;
+		bool erase_ok_;
+		uint64_t events_;                   ///< replies taken, wakes up run()
+		std::string error_;                 ///< a write the VESC reported as failed
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_FIRMWARE_UPLOAD_HPP_
@@ -0,0 +1,148 @@
+#ifndef VESC_DRIVER__VESC_FRAME_POOL_HPP_
+#define VESC_DRIVER__VESC_FRAME_POOL_HPP_
+
+#include "vesc_driver/vesc_packet.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace vesc_driver {
+
+	/**
+	 * Thread-safe free list of equally sized memory blocks, all carved out of a single allocation
+	 * made in the constructor. allocate() returns nullptr once all blocks are in use.
+	 */
+	class FixedBlockPool {
+	public:
+		FixedBlockPool(size_t block_size, size_t block_count);
+
+		FixedBlockPool(const FixedBlockPool &) = delete;
+
+		FixedBlockPool &operator=(const FixedBlockPool &) = delete;
+
+		void *allocate();
+
+		void deallocate(void *block);
+
+		/** Whether @p block was handed out by this pool. */
+		bool owns(const void *block) const;
+
+		size_t blockSize() const {
+			return block_size_;
+		}
+
+	private:
+		size_t block_size_;
+		size_t block_count_;
+		std::unique_ptr<unsigned char[]> storage_;
+		std::vector<void *> free_;
+		std::mutex mutex_;
+	};
+
+	/**
+	 * Standard allocator drawing single objects from a FixedBlockPool dedicated to (the rebound) T.
+	 * Used with std::allocate_shared, which rebinds it to its control block type, so that the object
+	 * and its reference counts come out of one preallocated block. Falls back to the heap when the
+	 * pool is exhausted or more than one object is requested.
+	 */
+	template<typename T>
+	class PoolAllocator {
+	public:
+		typedef T value_type;
+
+		static const size_t POOL_BLOCK_COUNT = 64;
+
+		PoolAllocator() = default;
+
+		template<typename U>
+		PoolAllocator(const PoolAllocator<U> &) {}
+
+		T *allocate(size_t n) {
+			if (n == 1) {
+				void *block = pool().allocate();
+				if (block) {
+					return static_cast<T *>(block);
+				}
+			}
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, size_t n) {
+			if (n == 1 && pool().owns(p)) {
+				pool().deallocate(p);
+			} else {
+				::operator delete(p);
+			}
+		}
+
+		template<typename U>
+		bool operator==(const PoolAllocator<U> &) const {
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const PoolAllocator<U> &) const {
+			return false;
+		}
+
+	private:
+		static FixedBlockPool &pool() {
+			static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+			static FixedBlockPool p(sizeof(T), POOL_BLOCK_COUNT);
+			return p;
+		}
+	};
+
+	/**
+	 * Preallocated storage for received frames.
+	 *
+	 * Holds a fixed number of buffers with room for VESC_MAX_FRAME_SIZE bytes each. acquire() hands
+	 * one out as a shared_ptr whose custom deleter puts it back on the free list once the last
+	 * packet viewing into it is gone, so decoding frames does not touch the heap in steady state.
+	 */
+	class VescFramePool {
+	public:
+		static const size_t SLOT_COUNT = 64;
+
+		/** Return the global pool object */
+		static VescFramePool &instance();
+
+		/**
+		 * Returns a buffer of @p size bytes (at most VESC_MAX_FRAME_SIZE). If all slots are in use,
+		 * a heap-allocated buffer is returned instead.
+		 */
+		std::shared_ptr<Buffer> acquire(size_t size);
+
+		/** Number of slots currently handed out. */
+		size_t inUse();
+
+		VescFramePool(const VescFramePool &) = delete;
+
+		VescFramePool &operator=(const VescFramePool &) = delete;
+
+	private:
+		VescFramePool();
+
+		/** Custom deleter returning a slot to the pool. */
+		struct Recycler {
+			VescFramePool *pool;
+
+			void operator()(Buffer *slot) const {
+				pool->release(slot);
+			}
+		};
+
+		void release(Buffer *slot);
+
+		std::vector<Buffer> slots_;
+		std::vector<Buffer *> free_;
+		std::mutex mutex_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_FRAME_POOL_HPP_
@@ -0,0 +1,68 @@
+#ifndef VESC_DRIVER__VESC_FRAMER_HPP_
+#define VESC_DRIVER__VESC_FRAMER_HPP_
+
+#include "vesc_driver/ring_buffer.hpp"
+#include "vesc_driver/vesc_instrumentation.hpp"
+#include "vesc_driver/vesc_packet.hpp"
+#include "vesc_driver/vesc_packet_factory.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace vesc_driver {
+
+	/**
+	 * Splits a stream of received bytes into VESC packets. Bytes that do not start a valid frame
+	 * (line noise, a frame with a bad checksum, the tail of a frame whose start was lost) are skipped
+	 * until the stream is in sync again: the stream is scanned for the next start-of-frame byte
+	 * several bytes at a time, and only there a frame is attempted.
+	 */
+	class VescFramer {
+	public:
+		typedef std::function<void(const VescPacketConstPtr &)> PacketHandlerFunction;
+
+		/**
+		 * @param handler Function called for every decoded packet.
+		 * @param instrumentation Optional, receives the frame counters and the parse and handler
+		 *                        latencies (if built with VESC_DRIVER_INSTRUMENTATION).
+		 * @param timestamps Optional, arrival times of the received bytes, which the packets get as
+		 *                   VescFrame::rx_time(). Without, packets are stamped when decoded.
+		 */
+		explicit VescFramer(
+			PacketHandlerFunction handler, VescInstrumentation *instrumentation = nullptr,
+			RxTimestampRing *timestamps = nullptr);
+
+		/**
+		 * Decodes the packets at the front of @p buffer and calls the handler for each of them.
+		 *
+		 * @param buffer[in] Received bytes, starting where the previous call stopped.
+		 * @param bytes_wanted[out] Size @p buffer must reach before another call can make progress.
+		 * @param position[in] Stream position of the first byte of @p buffer in the timestamps.
+		 *
+		 * @return Number of bytes consumed (decoded or skipped). The remaining bytes are the beginning
+		 *         of an incomplete frame and must be passed in again.
+		 */
+		size_t process(const BufferView &buffer, size_t *bytes_wanted, size_t position = 0);
+
+		/** Totals since construction, read by the thread calling process() */
+		struct Errors {
+			std::array<uint64_t, VescPacketFactory::ERROR_COUNT> frames{};  ///< rejected, per reason
+			uint64_t skipped_bytes = 0;     ///< bytes skipped while searching for a frame start
+		};
+
+		const Errors &errors() const {
+			return errors_;
+		}
+
+	private:
+		PacketHandlerFunction handler_;
+		VescInstrumentation *instrumentation_;
+		RxTimestampRing *timestamps_;
+		Errors errors_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_FRAMER_HPP_
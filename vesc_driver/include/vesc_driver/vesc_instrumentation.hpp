@@ -0,0 +1,89 @@
+#ifndef VESC_DRIVER__VESC_INSTRUMENTATION_HPP_
+#define VESC_DRIVER__VESC_INSTRUMENTATION_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * VESC_INSTRUMENT(...) expands to its argument if the package is built with the
+ * VESC_DRIVER_INSTRUMENTATION option (the default) and to nothing otherwise, so the timestamps and
+ * counters cost nothing when compiled out.
+ */
+#ifdef VESC_DRIVER_INSTRUMENTATION
+#define VESC_INSTRUMENT(...) __VA_ARGS__
+#else
+#define VESC_INSTRUMENT(...)
+#endif
+
+namespace vesc_driver {
+
+	/**
+	 * Lock-free latency histogram with fixed, logarithmic buckets: bucket 0 counts samples below 1 us,
+	 * bucket i samples from 2^(i-1) us up to 2^i us, the last bucket everything above. record() may be
+	 * called from any number of threads.
+	 */
+	class LatencyHistogram {
+	public:
+		static constexpr int BUCKET_COUNT = 24;
+
+		typedef std::chrono::steady_clock Clock;
+
+		struct Snapshot {
+			uint64_t count = 0;
+			double mean_us = 0.0;
+			double max_us = 0.0;
+			uint64_t buckets[BUCKET_COUNT] = {};
+
+			/** Upper bound of the bucket holding the @p fraction quantile, e.g. 0.99 */
+			double quantileUs(double fraction) const;
+		};
+
+		void record(Clock::duration latency);
+
+		void record(Clock::time_point start, Clock::time_point end) {
+			record(end - start);
+		}
+
+		Snapshot snapshot() const;
+
+		/** Upper bound of bucket @p index in microseconds */
+		static double bucketLimitUs(int index);
+
+	private:
+		std::atomic<uint64_t> buckets_[BUCKET_COUNT] = {};
+		std::atomic<uint64_t> count_{0};
+		std::atomic<uint64_t> sum_ns_{0};
+		std::atomic<uint64_t> max_ns_{0};
+	};
+
+	/**
+	 * Stage timings and error counters of one VESC link. The members are only updated when the
+	 * package is built with VESC_DRIVER_INSTRUMENTATION, see ENABLED.
+	 */
+	struct VescInstrumentation {
+#ifdef VESC_DRIVER_INSTRUMENTATION
+		static constexpr bool ENABLED = true;
+#else
+		static constexpr bool ENABLED = false;
+#endif
+
+		// receive path
+		LatencyHistogram wake_up;           ///< framer woken up by the receive callback -> running
+		LatencyHistogram rx_to_dispatch;    ///< frame received (VescFrame::rx_time()) -> dispatched
+		LatencyHistogram parse;             ///< VescPacketFactory::createPacket()
+		LatencyHistogram handler;           ///< packet handlers, including publishing
+		// transmit path
+		LatencyHistogram command_to_write;  ///< command posted -> frame written to the serial port
+		LatencyHistogram write;             ///< writing one frame to the serial port
+
+		std::atomic<uint64_t> rx_frames{0};      ///< frames decoded
+		std::atomic<uint64_t> crc_errors{0};     ///< complete frames with a bad checksum
+		std::atomic<uint64_t> frame_errors{0};   ///< other malformed frames (length, end of frame, ...)
+		std::atomic<uint64_t> resync_bytes{0};   ///< bytes skipped while searching for a frame start
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_INSTRUMENTATION_HPP_
@@ -1,17 +1,34 @@
 #ifndef VESC_DRIVER__VESC_INTERFACE_HPP_
 #define VESC_DRIVER__VESC_INTERFACE_HPP_
 
+#include "vesc_driver/vesc_firmware_upload.hpp"
+#include "vesc_driver/vesc_instrumentation.hpp"
 #include "vesc_driver/vesc_packet.hpp"
+#include "vesc_driver/vesc_packet_dispatcher.hpp"
+#include "vesc_driver/vesc_thread.hpp"
 
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+
+namespace drivers {
+	namespace common {
+		class IoContext;
+	}  // namespace common
+}  // namespace drivers
 
 namespace vesc_driver {
 
+	class VescExecutor;
+
+	class VescPort;
+
 	/**
 	 * Class providing an interface to the Vedder VESC motor controller via a serial port interface.
 	 */
@@ -22,6 +39,55 @@ namespace vesc_driver {
 		typedef std::function<void(const VescPacketConstPtr &)> PacketHandlerFunction;
 		typedef std::function<void(const std::string &)> ErrorHandlerFunction;
 
+		/**
+		 * Counters describing the traffic on the link, see statistics().
+		 */
+		struct Statistics {
+			uint64_t rx_bytes = 0;          ///< bytes received from the serial port
+			uint64_t rx_overrun_bytes = 0;  ///< received bytes dropped because the receive ring was full
+			uint64_t rx_overrun_count = 0;  ///< number of receive callbacks that had to drop bytes
+			uint64_t tx_frames = 0;         ///< frames written to the serial port
+			uint64_t tx_bytes = 0;          ///< bytes written to the serial port
+			uint64_t tx_coalesced = 0;      ///< commands replaced by a newer one before being written
+			uint64_t tx_dropped = 0;        ///< packets dropped by send() because the queue was full
+			size_t tx_queue_depth = 0;      ///< frames currently waiting to be written
+		};
+
+		/**
+		 * Kinds of outgoing frames. Each kind has a latest-wins transmit slot: a new command replaces
+		 * a pending (not yet written) command of the same kind, so the link never carries stale
+		 * setpoints. All motor commands (duty cycle, current, brake, speed, position) share one slot.
+		 * Kinds are listed in order of transmit priority.
+		 */
+		enum TxKind {
+			TX_MOTOR,           ///< setDutyCycle(), setCurrent(), setBrake(), setSpeed(), setPosition(),
+			                    ///< setSpeedAndServo()
+			TX_SERVO,           ///< setServo()
+			TX_FW_VERSION,      ///< requestFWVersion()
+			TX_TELEMETRY,       ///< requestState(), requestStateSelective()
+			TX_IMU,             ///< requestImuData()
+			TX_TELEMETRY_SLOW,  ///< requestStateSelective() of rarely needed fields
+			TX_KIND_COUNT
+		};
+
+		/** CAN id argument addressing the VESC on the serial port itself */
+		static constexpr int LOCAL_CONTROLLER = -1;
+
+		/**
+		 * Physical link to the VESC.
+		 */
+		enum Transport {
+			TRANSPORT_UART,     ///< UART (e.g. via a USB to serial adapter), the baud rate applies
+			TRANSPORT_USB_CDC,  ///< native USB (virtual COM port), the baud rate is meaningless
+			TRANSPORT_CAN       ///< CAN bus through a VescCanPort (see setPort()), not paced either
+		};
+
+		enum FlowControl {
+			FLOW_CONTROL_NONE,
+			FLOW_CONTROL_HARDWARE,
+			FLOW_CONTROL_SOFTWARE
+		};
+
 		/**
 		 * Creates a VescInterface object. Opens the serial port interface to the VESC if @p port is not
 		 * empty, otherwise the serial port remains closed until connect() is called.
@@ -39,6 +105,20 @@ namespace vesc_driver {
 			const ErrorHandlerFunction &error_handler = ErrorHandlerFunction()
 		);
 
+		/**
+		 * Creates a VescInterface object that uses @p io_context for the serial port, e.g. shared by
+		 * several VescInterface objects, instead of running an IoContext of its own. If @p executor is
+		 * given, the frame parser and the transmit scheduler run on its threads as well, otherwise this
+		 * object starts its own. Both must outlive this object. The serial port remains closed until
+		 * connect() is called.
+		 */
+		VescInterface(
+			drivers::common::IoContext &io_context,
+			VescExecutor *executor,
+			const PacketHandlerFunction &packet_handler = PacketHandlerFunction(),
+			const ErrorHandlerFunction &error_handler = ErrorHandlerFunction()
+		);
+
 		/**
 		 * Delete copy constructor and equals operator.
 		 */
@@ -62,6 +142,81 @@ namespace vesc_driver {
 		 */
 		void setErrorHandler(const ErrorHandlerFunction &handler);
 
+		/**
+		 * Sets / updates the function this class calls when a packet of type PACKETTYPE is received,
+		 * e.g. subscribe<VescPacketValues>(...). The handler gets the decoded packet by reference and
+		 * is found by payload id, there are no string compares or casts on the receive path. Packets
+		 * are passed to the generic packet handler (if any) as well. Must be called before connect().
+		 */
+		template<typename PACKETTYPE>
+		void subscribe(std::function<void(const PACKETTYPE &)> handler) {
+			dispatcher().subscribe<PACKETTYPE>(std::move(handler));
+		}
+
+		/**
+		 * Selects how received bytes are handed over to the frame parser. By default (@p period_ms
+		 * <= 0) the parser is woken up by the serial receive callback as soon as enough bytes for the
+		 * pending frame have arrived. A positive @p period_ms restores the legacy behaviour of polling
+		 * the receive buffer every @p period_ms milliseconds. Must be called before connect(). Has no
+		 * effect with a VescExecutor, which is always event-driven.
+		 */
+		void setPollingPeriod(int period_ms);
+
+		/**
+		 * Selects the serial port settings used by the next connect(). Defaults are 115200 baud, no
+		 * flow control and TRANSPORT_UART. With TRANSPORT_UART writes are paced to the baud rate. With
+		 * TRANSPORT_USB_CDC the link runs at USB speed: writes are not paced, flow control is left to
+		 * USB and a larger receive buffer is used.
+		 */
+		void setBaudRate(uint32_t baud_rate);
+
+		void setFlowControl(FlowControl flow_control);
+
+		void setTransport(Transport transport);
+
+		/**
+		 * Limits the rate at which frames of @p kind are written to at most @p max_rate_hz, commands
+		 * issued faster than that are coalesced. @p max_rate_hz <= 0 removes the limit (default).
+		 */
+		void setRateLimit(TxKind kind, double max_rate_hz);
+
+		/**
+		 * Makes the VESC with CAN id @p can_id (0 - 255) addressable through the VESC on the serial
+		 * port: the request and set methods called with this @p can_id are wrapped in
+		 * COMM_FORWARD_CAN. Each controller has its own transmit slots, the slots of the same kind are
+		 * served round-robin. Replies are forwarded back over the serial port, VescPacketValues and
+		 * VescPacketValuesSelective (with the CONTROLLER_ID field) tell them apart by controller_id().
+		 * Must be called before connect().
+		 *
+		 * @throw std::invalid_argument if @p can_id is out of range.
+		 */
+		void addCanController(int can_id);
+
+		/**
+		 * Replaces the serial port by @p port, e.g. a VescReplayPort or a VescCanPort, connect() then
+		 * opens @p port with its argument. The baud rate and flow control settings only apply to the
+		 * serial port.
+		 *
+		 * @throw SerialException if connected.
+		 */
+		void setPort(std::unique_ptr<VescPort> port);
+
+		/**
+		 * Records the raw byte stream received and written, with timestamps, to the capture file
+		 * @p path (see VescCaptureWriter) from the next connect() to disconnect(). An existing file
+		 * is overwritten, an empty @p path (default) disables the capture.
+		 */
+		void setCaptureFile(const std::string &path);
+
+		/**
+		 * Scheduling settings applied by the framer and transmit threads started by connect() and, if
+		 * this object runs its own IoContext, by the threads of that IoContext (@p io). A shared
+		 * IoContext or VescExecutor is configured by its owner, see applyThreadConfig() and
+		 * VescExecutor::applyThreadConfig(). Failures are reported through the error handler, the
+		 * threads then keep running with their previous settings. Must be called before connect().
+		 */
+		void setThreadConfig(const ThreadConfig &framer, const ThreadConfig &io = ThreadConfig());
+
 		/**
 		 * Opens the serial port interface to the VESC.
 		 *
@@ -82,27 +237,81 @@ namespace vesc_driver {
 		bool isConnected() const;
 
 		/**
-		 * Send a VESC packet.
+		 * Returns a snapshot of the link counters. Safe to call from any thread.
+		 */
+		Statistics statistics() const;
+
+		/**
+		 * Stage latencies and error counters, only updated if built with VESC_DRIVER_INSTRUMENTATION.
+		 * Safe to read from any thread.
+		 */
+		const VescInstrumentation &instrumentation() const;
+
+		/**
+		 * Send a VESC packet. Packets sent this way are never coalesced, they are queued (with a
+		 * priority below the motor and servo commands) and dropped if the queue is full.
 		 */
 		void send(const VescPacket &packet);
 
-		void requestFWVersion();
+		/**
+		 * The request and set methods address the VESC on the serial port by default, or the one with
+		 * CAN id @p can_id added by addCanController().
+		 *
+		 * @throw std::invalid_argument if @p can_id is unknown.
+		 */
+		void requestFWVersion(int can_id = LOCAL_CONTROLLER);
 
-		void requestState();
+		void requestState(int can_id = LOCAL_CONTROLLER);
+
+		/**
+		 * Requests the fields selected by @p mask (see VescPacketValuesSelective::Field), the reply is
+		 * a VescPacketValuesSelective. Requests for different masks should use different @p kind
+		 * (TX_TELEMETRY or TX_TELEMETRY_SLOW) so that they do not replace each other.
+		 */
+		void requestStateSelective(
+			uint32_t mask, TxKind kind = TX_TELEMETRY, int can_id = LOCAL_CONTROLLER);
+
+		/**
+		 * Requests the IMU fields selected by @p mask (see VescPacketImuData::Field), the reply is a
+		 * VescPacketImuData. The requests have a slot of their own, so they can be polled at another
+		 * rate than the telemetry and are sent right after it when both are due.
+		 */
+		void requestImuData(uint32_t mask, int can_id = LOCAL_CONTROLLER);
 
-		void setDutyCycle(double duty_cycle);
+		void setDutyCycle(double duty_cycle, int can_id = LOCAL_CONTROLLER);
 
-		void setCurrent(double current);
+		void setCurrent(double current, int can_id = LOCAL_CONTROLLER);
 
-		void setBrake(double brake);
+		void setBrake(double brake, int can_id = LOCAL_CONTROLLER);
 
-		void setSpeed(double speed);
+		void setSpeed(double speed, int can_id = LOCAL_CONTROLLER);
 
-		void setPosition(double position);
+		void setPosition(double position, int can_id = LOCAL_CONTROLLER);
 
-		void setServo(double servo);
+		void setServo(double servo, int can_id = LOCAL_CONTROLLER);
+
+		/**
+		 * Sets the speed and the servo position together: both frames are written back-to-back in a
+		 * single write, so the VESC applies them in the same control cycle. The pair takes the motor
+		 * slot and replaces a pending servo command.
+		 */
+		void setSpeedAndServo(double speed, double servo, int can_id = LOCAL_CONTROLLER);
+
+		/**
+		 * Uploads the firmware @p image (the application binary) to the VESC on the port, to the one
+		 * with options.can_id (added by addCanController()) or, with options.all_can, to it and all
+		 * VESCs on its CAN bus, see VescFirmwareUpload. Blocks until the upload is done, the link keeps
+		 * working meanwhile. One upload at a time.
+		 *
+		 * @throw std::invalid_argument if the options are invalid or the CAN id is unknown.
+		 * @throw std::runtime_error if the upload failed or another one is running.
+		 */
+		void uploadFirmware(
+			const Buffer &image, const VescFirmwareUploadOptions &options = VescFirmwareUploadOptions());
 
 	private:
+		VescPacketDispatcher &dispatcher();
+
 		// Pimpl - hide serial port members from class users
 		class Impl;
 
@@ -31,7 +31,11 @@
 #ifndef VESC_DRIVER__VESC_PACKET_HPP_
 #define VESC_DRIVER__VESC_PACKET_HPP_
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <vector>
@@ -39,6 +43,7 @@
 
 #define CRCPP_USE_CPP11
 #include "vesc_driver/crc.hpp"
+#include "vesc_driver/datatypes.hpp"
 
 namespace vesc_driver
 {
@@ -47,6 +52,78 @@ typedef std::vector<uint8_t> Buffer;
 typedef std::pair<Buffer::iterator, Buffer::iterator> BufferRange;
 typedef std::pair<Buffer::const_iterator, Buffer::const_iterator> BufferRangeConst;
 
+/**
+ * Read-only view of a byte sequence stored in (at most) two contiguous pieces, e.g. the readable
+ * part of a RingBuffer that wraps around the end of its storage.
+ */
+class BufferView
+{
+public:
+  BufferView()
+  : data_{nullptr, nullptr}, size_{0, 0} {}
+
+  BufferView(
+    const uint8_t * first, size_t first_size,
+    const uint8_t * second = nullptr, size_t second_size = 0)
+  : data_{first, second}, size_{first_size, second_size} {}
+
+  size_t size() const
+  {
+    return size_[0] + size_[1];
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  uint8_t operator[](size_t i) const
+  {
+    return i < size_[0] ? data_[0][i] : data_[1][i - size_[0]];
+  }
+
+  /** Pointer to and size of the contiguous piece @p i (0 or 1). */
+  const uint8_t * segment(int i) const
+  {
+    return data_[i];
+  }
+
+  size_t segmentSize(int i) const
+  {
+    return size_[i];
+  }
+
+  /** View of @p count bytes starting at @p offset (clamped to the end of this view). */
+  BufferView subview(size_t offset, size_t count = SIZE_MAX) const
+  {
+    if (offset >= size_[0]) {
+      offset -= size_[0];
+      offset = std::min(offset, size_[1]);
+      return BufferView(data_[1] + offset, std::min(count, size_[1] - offset));
+    }
+    const size_t first = size_[0] - offset;
+    if (count <= first) {
+      return BufferView(data_[0] + offset, count);
+    }
+    return BufferView(data_[0] + offset, first, data_[1], std::min(count - first, size_[1]));
+  }
+
+  /** Copies the whole view to @p dst, which must have room for size() bytes. */
+  void copy(uint8_t * dst) const
+  {
+    if (size_[0] > 0) {
+      std::memcpy(dst, data_[0], size_[0]);
+    }
+    if (size_[1] > 0) {
+      std::memcpy(dst + size_[0], data_[1], size_[1]);
+    }
+  }
+
+private:
+  const uint8_t * data_[2];
+  size_t size_[2];
+};
+
 /** The raw frame for communicating with the VESC */
 class VescFrame
 {
@@ -59,6 +136,21 @@ public:
     return *frame_;
   }
 
+  /**
+   * Time the last byte of a received frame arrived at the serial port (steady clock), as recorded
+   * by the receive callback. Default-constructed for frames that were not received.
+   */
+  std::chrono::steady_clock::time_point rx_time() const
+  {
+    return rx_time_;
+  }
+
+  /** Set by the receiving side (VescFramer) before the frame is handed out. */
+  void setRxTime(std::chrono::steady_clock::time_point rx_time)
+  {
+    rx_time_ = rx_time;
+  }
+
   // VESC packet properties
   static const int VESC_MAX_PAYLOAD_SIZE = 1024;           ///< Maximum VESC payload size, in bytes
   static const int VESC_MIN_FRAME_SIZE = 5;                ///< Smallest VESC frame size, in bytes
@@ -68,7 +160,7 @@ public:
   static const unsigned int VESC_SOF_VAL_LARGE_FRAME = 3;  ///< VESC start of "large" frame value
   static const unsigned int VESC_EOF_VAL = 3;              ///< VESC end-of-frame value
 
-  /** CRC parameters for the VESC */
+  /** CRC parameters for the VESC, prefer the table-driven VescCrc for computing it */
   static constexpr CRC::Parameters<crcpp_uint16,
     16> CRC_TYPE = {0x1021, 0x0000, 0x0000, false, false};
 
@@ -78,10 +170,11 @@ protected:
 
   std::shared_ptr<Buffer> frame_;  ///< Stores frame data, shared_ptr for shallow copy
   BufferRange payload_;              ///< View into frame's payload section
+  std::chrono::steady_clock::time_point rx_time_;  ///< See rx_time()
 
 private:
-  /** Construct from buffer. Used by VescPacketFactory factory. */
-  VescFrame(const BufferRangeConst & frame, const BufferRangeConst & payload);
+  /** Construct from a (possibly wrapped) buffer. Used by VescPacketFactory factory. */
+  VescFrame(const BufferView & frame, size_t payload_offset, size_t payload_size);
 
   /** Give VescPacketFactory access to private constructor. */
   friend class VescPacketFactory;
@@ -95,17 +188,25 @@ class VescPacket : public VescFrame
 public:
   virtual ~VescPacket() {}
 
-  virtual const std::string & name() const
+  /** Human readable packet type name, for logging only, use payloadId() to tell packets apart */
+  virtual const char * name() const
   {
     return name_;
   }
 
+  /** The COMM_PACKET_ID of this packet, i.e. the first payload byte */
+  int payloadId() const
+  {
+    return *payload_.first;
+  }
+
 protected:
-  VescPacket(const std::string & name, int payload_size, int payload_id);
-  VescPacket(const std::string & name, std::shared_ptr<VescFrame> raw);
+  /** @p name must point to a string with static storage duration (e.g. a literal). */
+  VescPacket(const char * name, int payload_size, int payload_id);
+  VescPacket(const char * name, std::shared_ptr<VescFrame> raw);
 
 private:
-  std::string name_;
+  const char * name_;
 };
 
 typedef std::shared_ptr<VescPacket> VescPacketPtr;
@@ -116,6 +217,8 @@ typedef std::shared_ptr<VescPacket const> VescPacketConstPtr;
 class VescPacketFWVersion : public VescPacket
 {
 public:
+  static constexpr int PAYLOAD_ID = COMM_FW_VERSION;
+
   explicit VescPacketFWVersion(std::shared_ptr<VescFrame> raw);
 
   int fwMajor() const;
@@ -143,36 +246,185 @@ public:
 
 /*------------------------------------------------------------------------------------------------*/
 
+/**
+ * Leading part of the motor configuration (mc_configuration): the motor setup and the limits, in
+ * the units of the firmware (A, ERPM, V, degC, W, duty cycle 0 - 1).
+ */
+struct VescMcConfData
+{
+  uint32_t signature = 0;      ///< MCCONF_SIGNATURE, changes with the layout of the configuration
+  int     pwm_mode = 0;
+  int     comm_mode = 0;
+  int     motor_type = 0;
+  int     sensor_mode = 0;
+  double  current_max = 0.0;
+  double  current_min = 0.0;
+  double  in_current_max = 0.0;
+  double  in_current_min = 0.0;
+  double  abs_current_max = 0.0;
+  double  min_erpm = 0.0;
+  double  max_erpm = 0.0;
+  double  erpm_start = 0.0;
+  double  max_erpm_fbrake = 0.0;
+  double  max_erpm_fbrake_cc = 0.0;
+  double  min_vin = 0.0;
+  double  max_vin = 0.0;
+  double  battery_cut_start = 0.0;
+  double  battery_cut_end = 0.0;
+  bool    slow_abs_current = false;
+  double  temp_fet_start = 0.0;
+  double  temp_fet_end = 0.0;
+  double  temp_motor_start = 0.0;
+  double  temp_motor_end = 0.0;
+  double  temp_accel_dec = 0.0;
+  double  min_duty = 0.0;
+  double  max_duty = 0.0;
+  double  watt_max = 0.0;
+  double  watt_min = 0.0;
+};
+
+/**
+ * Reply to COMM_GET_MCCONF. Only the fields of VescMcConfData are decoded, they lead the
+ * serialized configuration of the firmware versions with the generated (confgenerator) layout.
+ * The rest of the payload differs between firmware versions and is kept raw in frame().
+ */
+class VescPacketMcConf : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_GET_MCCONF;
+
+  explicit VescPacketMcConf(std::shared_ptr<VescFrame> raw);
+
+  /** True if the payload contained all fields of data() */
+  bool complete() const {return complete_;}
+
+  const VescMcConfData & data() const {return data_;}
+
+private:
+  bool complete_;
+  VescMcConfData data_;
+};
+
+class VescPacketRequestMcConf : public VescPacket
+{
+public:
+  VescPacketRequestMcConf();
+};
+
+/**
+ * Leading part of the app configuration (app_configuration).
+ */
+struct VescAppConfData
+{
+  uint32_t signature = 0;      ///< APPCONF_SIGNATURE
+  int     controller_id = 0;
+  uint32_t timeout_msec = 0;   ///< commands time out after this long without a new one, 0 = never
+  double  timeout_brake_current = 0.0;
+  int     send_can_status = 0;
+  uint32_t send_can_status_rate_hz = 0;
+  int     can_baud_rate = 0;
+};
+
+/**
+ * Reply to COMM_GET_APPCONF, only the fields of VescAppConfData are decoded, see
+ * VescPacketMcConf.
+ */
+class VescPacketAppConf : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_GET_APPCONF;
+
+  explicit VescPacketAppConf(std::shared_ptr<VescFrame> raw);
+
+  /** True if the payload contained all fields of data() */
+  bool complete() const {return complete_;}
+
+  const VescAppConfData & data() const {return data_;}
+
+private:
+  bool complete_;
+  VescAppConfData data_;
+};
+
+class VescPacketRequestAppConf : public VescPacket
+{
+public:
+  VescPacketRequestAppConf();
+};
+
+/*------------------------------------------------------------------------------------------------*/
+
+/**
+ * Motor controller state as sent in reply to COMM_GET_VALUES and COMM_GET_VALUES_SELECTIVE, in
+ * engineering units. Decoded in one pass when the packet is created.
+ */
+struct VescValuesData
+{
+  double  temp_fet = 0.0;
+  double  temp_motor = 0.0;
+  double  avg_motor_current = 0.0;
+  double  avg_input_current = 0.0;
+  double  avg_id = 0.0;
+  double  avg_iq = 0.0;
+  double  duty_cycle_now = 0.0;
+  double  rpm = 0.0;
+  double  v_in = 0.0;
+  double  amp_hours = 0.0;
+  double  amp_hours_charged = 0.0;
+  double  watt_hours = 0.0;
+  double  watt_hours_charged = 0.0;
+  int32_t tachometer = 0;
+  int32_t tachometer_abs = 0;
+  int     fault_code = 0;
+  double  pid_pos_now = 0.0;
+  int32_t controller_id = 0;
+  double  temp_mos1 = 0.0;
+  double  temp_mos2 = 0.0;
+  double  temp_mos3 = 0.0;
+  double  avg_vd = 0.0;
+  double  avg_vq = 0.0;
+};
+
+/**
+ * Reply to COMM_GET_VALUES. Fields missing from a short payload (older firmware) are 0.
+ */
 class VescPacketValues : public VescPacket
 {
 public:
+  static constexpr int PAYLOAD_ID = COMM_GET_VALUES;
+
   explicit VescPacketValues(std::shared_ptr<VescFrame> raw);
 
-  double  temp_fet() const;
-  double  temp_motor() const;
-  double  avg_motor_current() const;
-  double  avg_input_current() const;
-  double  avg_id() const;
-  double  avg_iq() const;
-  double  duty_cycle_now() const;
-  double  rpm() const;
-  double  duty_now() const;
-  double  v_in() const;
-  double  amp_hours() const;
-  double  amp_hours_charged() const;
-  double  watt_hours() const;
-  double  watt_hours_charged() const;
-  int32_t tachometer() const;
-  int32_t tachometer_abs() const;
-  int     fault_code() const;
-  double  pid_pos_now() const;
-  int32_t controller_id() const;
-
-  double  temp_mos1() const;
-  double  temp_mos2() const;
-  double  temp_mos3() const;
-  double  avg_vd() const;
-  double  avg_vq()  const;
+  /** All fields at once */
+  const VescValuesData & data() const {return data_;}
+
+  double  temp_fet() const {return data_.temp_fet;}
+  double  temp_motor() const {return data_.temp_motor;}
+  double  avg_motor_current() const {return data_.avg_motor_current;}
+  double  avg_input_current() const {return data_.avg_input_current;}
+  double  avg_id() const {return data_.avg_id;}
+  double  avg_iq() const {return data_.avg_iq;}
+  double  duty_cycle_now() const {return data_.duty_cycle_now;}
+  double  rpm() const {return data_.rpm;}
+  double  v_in() const {return data_.v_in;}
+  double  amp_hours() const {return data_.amp_hours;}
+  double  amp_hours_charged() const {return data_.amp_hours_charged;}
+  double  watt_hours() const {return data_.watt_hours;}
+  double  watt_hours_charged() const {return data_.watt_hours_charged;}
+  int32_t tachometer() const {return data_.tachometer;}
+  int32_t tachometer_abs() const {return data_.tachometer_abs;}
+  int     fault_code() const {return data_.fault_code;}
+  double  pid_pos_now() const {return data_.pid_pos_now;}
+  int32_t controller_id() const {return data_.controller_id;}
+
+  double  temp_mos1() const {return data_.temp_mos1;}
+  double  temp_mos2() const {return data_.temp_mos2;}
+  double  temp_mos3() const {return data_.temp_mos3;}
+  double  avg_vd() const {return data_.avg_vd;}
+  double  avg_vq() const {return data_.avg_vq;}
+
+private:
+  VescValuesData data_;
 };
 
 class VescPacketRequestValues : public VescPacket
@@ -180,6 +432,287 @@ class VescPacketRequestValues : public VescPacket
 public:
   VescPacketRequestValues();
 };
+
+/*------------------------------------------------------------------------------------------------*/
+
+/**
+ * Reply to COMM_GET_VALUES_SELECTIVE, contains only the fields selected by the field mask of the
+ * request. The accessors of fields not contained in mask() return 0.
+ */
+class VescPacketValuesSelective : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_GET_VALUES_SELECTIVE;
+
+  /** Field mask bits, the fields are sent in the order of their bits */
+  enum Field : uint32_t
+  {
+    TEMP_FET = 1u << 0,
+    TEMP_MOTOR = 1u << 1,
+    AVG_MOTOR_CURRENT = 1u << 2,
+    AVG_INPUT_CURRENT = 1u << 3,
+    AVG_ID = 1u << 4,
+    AVG_IQ = 1u << 5,
+    DUTY_CYCLE_NOW = 1u << 6,
+    RPM = 1u << 7,
+    V_IN = 1u << 8,
+    AMP_HOURS = 1u << 9,
+    AMP_HOURS_CHARGED = 1u << 10,
+    WATT_HOURS = 1u << 11,
+    WATT_HOURS_CHARGED = 1u << 12,
+    TACHOMETER = 1u << 13,
+    TACHOMETER_ABS = 1u << 14,
+    FAULT_CODE = 1u << 15,
+    PID_POS_NOW = 1u << 16,
+    CONTROLLER_ID = 1u << 17,
+    TEMP_MOS = 1u << 18,  ///< temp_mos1(), temp_mos2() and temp_mos3()
+    AVG_VD = 1u << 19,
+    AVG_VQ = 1u << 20,
+    ALL_FIELDS = (1u << 21) - 1
+  };
+
+  explicit VescPacketValuesSelective(std::shared_ptr<VescFrame> raw);
+
+  /** Fields contained in this packet, fields missing from a truncated payload are cleared */
+  uint32_t mask() const
+  {
+    return mask_;
+  }
+
+  /** True if all @p fields are contained in this packet */
+  bool has(uint32_t fields) const
+  {
+    return (mask_ & fields) == fields;
+  }
+
+  /** All fields at once, the fields not contained in mask() are 0 */
+  const VescValuesData & data() const {return data_;}
+
+  double  temp_fet() const {return data_.temp_fet;}
+  double  temp_motor() const {return data_.temp_motor;}
+  double  avg_motor_current() const {return data_.avg_motor_current;}
+  double  avg_input_current() const {return data_.avg_input_current;}
+  double  avg_id() const {return data_.avg_id;}
+  double  avg_iq() const {return data_.avg_iq;}
+  double  duty_cycle_now() const {return data_.duty_cycle_now;}
+  double  rpm() const {return data_.rpm;}
+  double  v_in() const {return data_.v_in;}
+  double  amp_hours() const {return data_.amp_hours;}
+  double  amp_hours_charged() const {return data_.amp_hours_charged;}
+  double  watt_hours() const {return data_.watt_hours;}
+  double  watt_hours_charged() const {return data_.watt_hours_charged;}
+  int32_t tachometer() const {return data_.tachometer;}
+  int32_t tachometer_abs() const {return data_.tachometer_abs;}
+  int     fault_code() const {return data_.fault_code;}
+  double  pid_pos_now() const {return data_.pid_pos_now;}
+  int32_t controller_id() const {return data_.controller_id;}
+  double  temp_mos1() const {return data_.temp_mos1;}
+  double  temp_mos2() const {return data_.temp_mos2;}
+  double  temp_mos3() const {return data_.temp_mos3;}
+  double  avg_vd() const {return data_.avg_vd;}
+  double  avg_vq() const {return data_.avg_vq;}
+
+private:
+  uint32_t mask_;
+  VescValuesData data_;
+};
+
+class VescPacketRequestValuesSelective : public VescPacket
+{
+public:
+  /** @param mask Fields to request, see VescPacketValuesSelective::Field */
+  explicit VescPacketRequestValuesSelective(uint32_t mask);
+};
+
+/*------------------------------------------------------------------------------------------------*/
+
+/**
+ * Sample of the IMU of the VESC as sent in reply to COMM_GET_IMU_DATA, in the units of the
+ * firmware (after the rotation set in its IMU configuration).
+ */
+struct VescImuData
+{
+  double roll = 0.0;                    ///< rad
+  double pitch = 0.0;
+  double yaw = 0.0;
+  double acc_x = 0.0;                   ///< g
+  double acc_y = 0.0;
+  double acc_z = 0.0;
+  double gyro_x = 0.0;                  ///< deg/s
+  double gyro_y = 0.0;
+  double gyro_z = 0.0;
+  double mag_x = 0.0;
+  double mag_y = 0.0;
+  double mag_z = 0.0;
+  double q0 = 0.0;                      ///< orientation quaternion, w
+  double q1 = 0.0;                      ///< x
+  double q2 = 0.0;                      ///< y
+  double q3 = 0.0;                      ///< z
+};
+
+class VescPacketImuData : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_GET_IMU_DATA;
+
+  /** Field mask bits, the fields are sent in the order of their bits */
+  enum Field : uint32_t
+  {
+    ROLL = 1u << 0,
+    PITCH = 1u << 1,
+    YAW = 1u << 2,
+    ACC_X = 1u << 3,
+    ACC_Y = 1u << 4,
+    ACC_Z = 1u << 5,
+    GYRO_X = 1u << 6,
+    GYRO_Y = 1u << 7,
+    GYRO_Z = 1u << 8,
+    MAG_X = 1u << 9,
+    MAG_Y = 1u << 10,
+    MAG_Z = 1u << 11,
+    Q0 = 1u << 12,
+    Q1 = 1u << 13,
+    Q2 = 1u << 14,
+    Q3 = 1u << 15,
+    RPY = ROLL | PITCH | YAW,
+    ACC = ACC_X | ACC_Y | ACC_Z,
+    GYRO = GYRO_X | GYRO_Y | GYRO_Z,
+    MAG = MAG_X | MAG_Y | MAG_Z,
+    QUATERNION = Q0 | Q1 | Q2 | Q3,
+    ALL_FIELDS = (1u << 16) - 1
+  };
+
+  explicit VescPacketImuData(std::shared_ptr<VescFrame> raw);
+
+  /** Fields contained in this packet, fields missing from a truncated payload are cleared */
+  uint32_t mask() const
+  {
+    return mask_;
+  }
+
+  /** True if all @p fields are contained in this packet */
+  bool has(uint32_t fields) const
+  {
+    return (mask_ & fields) == fields;
+  }
+
+  /** All fields at once, the fields not contained in mask() are 0 */
+  const VescImuData & data() const {return data_;}
+
+private:
+  uint32_t mask_;
+  VescImuData data_;
+};
+
+class VescPacketRequestImuData : public VescPacket
+{
+public:
+  /** @param mask Fields to request, see VescPacketImuData::Field */
+  explicit VescPacketRequestImuData(uint32_t mask);
+};
+
+/*------------------------------------------------------------------------------------------------*/
+
+/**
+ * Start of a new plot (COMM_PLOT_INIT), sent by the firmware before a stream of
+ * VescPacketPlotData, e.g. by its terminal commands for motor tuning.
+ */
+class VescPacketPlotInit : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_PLOT_INIT;
+
+  explicit VescPacketPlotInit(std::shared_ptr<VescFrame> raw);
+
+  const std::string & nameX() const {return name_x_;}
+  const std::string & nameY() const {return name_y_;}
+
+private:
+  std::string name_x_;
+  std::string name_y_;
+};
+
+/** A graph added to the current plot (COMM_PLOT_ADD_GRAPH), numbered from 0 in this order */
+class VescPacketPlotAddGraph : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_PLOT_ADD_GRAPH;
+
+  explicit VescPacketPlotAddGraph(std::shared_ptr<VescFrame> raw);
+
+  const std::string & graphName() const {return graph_name_;}
+
+private:
+  std::string graph_name_;
+};
+
+/** Selects the graph the following VescPacketPlotData belong to (COMM_PLOT_SET_GRAPH) */
+class VescPacketPlotSetGraph : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_PLOT_SET_GRAPH;
+
+  explicit VescPacketPlotSetGraph(std::shared_ptr<VescFrame> raw);
+
+  int graph() const {return graph_;}
+
+private:
+  int graph_;
+};
+
+/** One point of the current graph (COMM_PLOT_DATA) */
+class VescPacketPlotData : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_PLOT_DATA;
+
+  struct Point
+  {
+    double x = 0.0;
+    double y = 0.0;
+  };
+
+  explicit VescPacketPlotData(std::shared_ptr<VescFrame> raw);
+
+  double x() const {return point_.x;}
+  double y() const {return point_.y;}
+
+private:
+  Point point_;
+};
+
+/**
+ * One sample of the motor sampling buffer (COMM_SAMPLE_PRINT), sent at a high rate after a
+ * COMM_SAMPLE_PRINT request. Currents in A, voltages in V, switching frequency in Hz.
+ */
+struct VescSampleData
+{
+  double  curr0 = 0.0;
+  double  curr1 = 0.0;
+  double  ph1 = 0.0;
+  double  ph2 = 0.0;
+  double  ph3 = 0.0;
+  double  vzero = 0.0;
+  double  curr_fir = 0.0;
+  double  f_sw = 0.0;
+  int     status = 0;
+  int     phase = 0;
+};
+
+class VescPacketSamplePrint : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_SAMPLE_PRINT;
+
+  explicit VescPacketSamplePrint(std::shared_ptr<VescFrame> raw);
+
+  /** All fields, those missing from a short payload (older firmware) are 0 */
+  const VescSampleData & data() const {return data_;}
+
+private:
+  VescSampleData data_;
+};
+
 /*------------------------------------------------------------------------------------------------*/
 
 class VescPacketSetDuty : public VescPacket
@@ -240,6 +773,126 @@ public:
   //  double servo_pos() const;
 };
 
+/*------------------------------------------------------------------------------------------------*/
+
+// Firmware upload, see VescFirmwareUpload. With a @p can_id >= 0 the request is wrapped in
+// COMM_FORWARD_CAN for the VESC with that CAN id, with @p all_can the *_ALL_CAN variant is sent,
+// which the VESC on the port forwards to all VESCs on the CAN bus before executing it itself.
+
+/** Erases the flash area the new application is written to (COMM_ERASE_NEW_APP) */
+class VescPacketEraseNewApp : public VescPacket
+{
+public:
+  VescPacketEraseNewApp(uint32_t size, bool all_can = false, int can_id = -1);
+};
+
+/** Reply to COMM_ERASE_NEW_APP(_ALL_CAN) */
+class VescPacketEraseNewAppResult : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_ERASE_NEW_APP;
+
+  explicit VescPacketEraseNewAppResult(std::shared_ptr<VescFrame> raw);
+
+  bool ok() const {return ok_;}
+
+private:
+  bool ok_;
+};
+
+/**
+ * Writes @p size bytes at @p data to @p offset of the new application (COMM_WRITE_NEW_APP_DATA).
+ * With @p decompressed_size > 0 the data are LZO1X compressed and decompress to that many bytes
+ * (COMM_WRITE_NEW_APP_DATA_LZO).
+ */
+class VescPacketWriteNewAppData : public VescPacket
+{
+public:
+  VescPacketWriteNewAppData(
+    uint32_t offset, const uint8_t * data, size_t size, size_t decompressed_size = 0,
+    bool all_can = false, int can_id = -1);
+
+  /** Payload bytes in front of the data */
+  static int headerSize(bool compressed, int can_id = -1)
+  {
+    return (can_id >= 0 ? 2 : 0) + (compressed ? 7 : 5);
+  }
+};
+
+/** Reply to all COMM_WRITE_NEW_APP_DATA variants */
+class VescPacketWriteNewAppDataResult : public VescPacket
+{
+public:
+  static constexpr int PAYLOAD_ID = COMM_WRITE_NEW_APP_DATA;
+
+  explicit VescPacketWriteNewAppDataResult(std::shared_ptr<VescFrame> raw);
+
+  bool ok() const {return ok_;}
+
+  /** False if the firmware does not echo the offset of the write (before 3.x) */
+  bool hasOffset() const {return has_offset_;}
+
+  uint32_t offset() const {return offset_;}
+
+private:
+  bool ok_;
+  bool has_offset_;
+  uint32_t offset_;
+};
+
+/**
+ * Restarts into the bootloader (COMM_JUMP_TO_BOOTLOADER), which copies a complete new application
+ * over the running one and starts it. There is no reply.
+ */
+class VescPacketJumpToBootloader : public VescPacket
+{
+public:
+  explicit VescPacketJumpToBootloader(bool all_can = false, int can_id = -1);
+};
+
+/*------------------------------------------------------------------------------------------------*/
+
+/**
+ * Reusable frame for a command made of its payload id followed by a single big-endian integer,
+ * i.e. the layout of all VescPacketSet* packets. The frame buffer is allocated once, encode()
+ * patches the value and the checksum in place, so a new setpoint costs neither an allocation nor
+ * a pass over the whole payload. With a CAN id the command is wrapped in COMM_FORWARD_CAN, i.e.
+ * sent to the VESC with that id through the one on the serial port.
+ */
+class VescCommandFrame : public VescFrame
+{
+public:
+  /**
+   * @param payload_id COMM_PACKET_ID of the command, e.g. COMM_SET_RPM.
+   * @param value_size Size of the value field in bytes, 0 (no value), 2 or 4.
+   * @param scale Factor the command value is multiplied by before truncation to an integer.
+   * @param can_id CAN id of the VESC to forward the command to, -1 for the VESC on the port.
+   */
+  VescCommandFrame(int payload_id, int value_size, double scale, int can_id = -1);
+
+  /**
+   * Encodes @p value into the frame.
+   *
+   * @return The frame buffer, which stays at the same address for the lifetime of this object.
+   */
+  const Buffer & encode(double value);
+
+  /**
+   * Encodes @p value as is, without scaling, e.g. a field mask. It must fit in the value field.
+   *
+   * @return The frame buffer, see encode().
+   */
+  const Buffer & encodeRaw(uint32_t value);
+
+private:
+  const Buffer & updateCrc();
+
+  int value_offset_;  ///< payload offset of the value, after the (forwarding prefix and) id
+  int value_size_;
+  double scale_;
+  uint16_t id_crc_;  ///< CRC of the bytes before the value, the value is folded in on top of it
+};
+
 }  // namespace vesc_driver
 
 #endif  // VESC_DRIVER__VESC_PACKET_HPP_
@@ -0,0 +1,64 @@
+#ifndef VESC_DRIVER__VESC_PACKET_DISPATCHER_HPP_
+#define VESC_DRIVER__VESC_PACKET_DISPATCHER_HPP_
+
+#include "vesc_driver/vesc_packet.hpp"
+
+#include <array>
+#include <cassert>
+#include <functional>
+#include <utility>
+
+namespace vesc_driver {
+
+	/**
+	 * Routes decoded packets to handlers registered per packet type.
+	 *
+	 * Handlers are kept in a table indexed by the COMM_PACKET_ID payload byte, so dispatching a
+	 * packet is a single lookup and call, without string compares, RTTI or shared_ptr copies. The
+	 * packet types must declare their id as PACKETTYPE::PAYLOAD_ID and be registered with the
+	 * VescPacketFactory under that same id.
+	 */
+	class VescPacketDispatcher {
+	public:
+		typedef std::function<void(const VescPacket &)> HandlerFunction;
+
+		/**
+		 * Sets / updates the handler for packets of type PACKETTYPE, e.g.
+		 * subscribe<VescPacketValues>(...). An empty @p handler removes the subscription.
+		 */
+		template<typename PACKETTYPE>
+		void subscribe(std::function<void(const PACKETTYPE &)> handler) {
+			static_assert(
+				PACKETTYPE::PAYLOAD_ID >= 0 && PACKETTYPE::PAYLOAD_ID < 256, "invalid payload id");
+			if (!handler) {
+				handlers_[PACKETTYPE::PAYLOAD_ID] = HandlerFunction();
+				return;
+			}
+			handlers_[PACKETTYPE::PAYLOAD_ID] = [handler = std::move(handler)](const VescPacket &packet) {
+				// the factory creates exactly one packet type per payload id
+				assert(dynamic_cast<const PACKETTYPE *>(&packet) != nullptr);
+				handler(static_cast<const PACKETTYPE &>(packet));
+			};
+		}
+
+		/**
+		 * Calls the handler subscribed to the type of @p packet.
+		 *
+		 * @return false if there is no handler for this packet type.
+		 */
+		bool dispatch(const VescPacket &packet) const {
+			const HandlerFunction &handler = handlers_[packet.payloadId() & 0xFF];
+			if (!handler) {
+				return false;
+			}
+			handler(packet);
+			return true;
+		}
+
+	private:
+		std::array<HandlerFunction, 256> handlers_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_PACKET_DISPATCHER_HPP_
@@ -31,6 +31,7 @@
 #ifndef VESC_DRIVER__VESC_PACKET_FACTORY_HPP_
 #define VESC_DRIVER__VESC_PACKET_FACTORY_HPP_
 
+#include "vesc_driver/vesc_frame_pool.hpp"
 #include "vesc_driver/vesc_packet.hpp"
 
 #include <cstdint>
@@ -52,6 +53,23 @@ public:
   /** Return the global factory object */
   static VescPacketFactory * getFactory();
 
+  /** Reasons why createPacket() did not return a packet */
+  enum Error
+  {
+    ERROR_NONE,
+    ERROR_INCOMPLETE_FRAME,         ///< more bytes are needed, see num_bytes_needed
+    ERROR_NO_START_OF_FRAME,
+    ERROR_INVALID_LENGTH,           ///< payload longer than VESC_MAX_PAYLOAD_SIZE
+    ERROR_NO_PAYLOAD,
+    ERROR_UNKNOWN_PAYLOAD,          ///< no packet type registered for the payload id
+    ERROR_INVALID_END_OF_FRAME,
+    ERROR_INVALID_CHECKSUM,
+    ERROR_COUNT
+  };
+
+  /** Human readable description of @p error, e.g. "Invalid checksum" */
+  static const char * errorString(Error error);
+
   /**
    * Create a VescPacket from a buffer (factory function). Packet must start (start of frame
    * character) at @p begin and complete (end of frame character) before *p end. The buffer element
@@ -77,6 +95,30 @@ public:
     const Buffer::const_iterator & end,
     int * num_bytes_needed, std::string * what);
 
+  /**
+   * Create a VescPacket from a view into a buffer made of up to two contiguous pieces, e.g. a
+   * RingBuffer wrapping around the end of its storage. Otherwise identical to the iterator
+   * overload above, the packet must start at the beginning of @p buffer.
+   */
+  static VescPacketPtr createPacket(
+    const BufferView & buffer,
+    int * num_bytes_needed, std::string * what);
+
+  /**
+   * Create a VescPacket from a view into a buffer, reporting why no packet was created as an
+   * Error code, which is cheap enough for resynchronizing on a noisy stream. The checks are
+   * ordered by cost: a frame whose header (length, payload id) is invalid is rejected as soon as
+   * the header is in the buffer, without waiting for the rest of it, and the checksum is only
+   * computed for frames that pass all other checks. Otherwise identical to the overloads above.
+   */
+  static VescPacketPtr createPacket(
+    const BufferView & buffer,
+    int * num_bytes_needed, Error * error);
+
+  /**
+   * Packet constructor function. The raw frame passed in is only valid during the call, packets
+   * must copy it (as VescPacket does) rather than keep the pointer.
+   */
   typedef std::function<VescPacketPtr(std::shared_ptr<VescFrame>)> CreateFn;
 
   /** Register a packet type with the factory. */
@@ -105,7 +147,8 @@ public:
 
   static VescPacketPtr create(std::shared_ptr<VescFrame> frame)
   {
-    return VescPacketPtr(new PACKETTYPE(frame));
+    // packet object and control block come out of a preallocated per-type pool
+    return std::allocate_shared<PACKETTYPE>(PoolAllocator<PACKETTYPE>(), frame);
   }
 };
 
@@ -0,0 +1,59 @@
+#ifndef VESC_DRIVER__VESC_PORT_HPP_
+#define VESC_DRIVER__VESC_PORT_HPP_
+
+#include "vesc_driver/vesc_packet.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace vesc_driver {
+
+	/**
+	 * Byte stream to and from a VESC used by VescInterface, a serial port by default. See
+	 * VescReplayPort for a stand-in that plays back a capture file and VescCanPort for the CAN bus.
+	 */
+	class VescPort {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		/**
+		 * Called with each chunk of received bytes, from a thread of the port. Returns the number of
+		 * bytes accepted: a lossless() port offers the rest again later, any other port drops it.
+		 * @p rx_time is the time the chunk arrived if the port knows it (e.g. from a timestamp of the
+		 * driver), Clock::time_point() if the handler is to take the time of the call.
+		 */
+		typedef std::function<size_t(const uint8_t *data, size_t size, Clock::time_point rx_time)>
+			ReceiveHandler;
+
+		virtual ~VescPort() = default;
+
+		/**
+		 * Opens @p device and starts passing received bytes to @p handler.
+		 *
+		 * @throw std::exception if the device can not be opened.
+		 */
+		virtual void open(const std::string &device, const ReceiveHandler &handler) = 0;
+
+		virtual void close() = 0;
+
+		virtual bool isOpen() const = 0;
+
+		/**
+		 * Writes @p data, from the transmit thread only.
+		 *
+		 * @return Number of bytes written.
+		 */
+		virtual size_t send(const Buffer &data) = 0;
+
+		/** True if received bytes the handler can not take yet are held back rather than lost. */
+		virtual bool lossless() const {
+			return false;
+		}
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_PORT_HPP_
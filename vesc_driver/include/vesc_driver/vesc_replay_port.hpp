@@ -0,0 +1,61 @@
+#ifndef VESC_DRIVER__VESC_REPLAY_PORT_HPP_
+#define VESC_DRIVER__VESC_REPLAY_PORT_HPP_
+
+#include "vesc_driver/vesc_capture.hpp"
+#include "vesc_driver/vesc_port.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace vesc_driver {
+
+	/**
+	 * VescPort playing back the received bytes of a capture file (see VescCaptureWriter) instead of
+	 * talking to a VESC, e.g. VescInterface::setPort(std::make_unique<VescReplayPort>(0.0)) followed
+	 * by connect("capture.vcap"). The chunks are handed to the receive handler straight out of the
+	 * memory-mapped file. Bytes sent to the port are discarded.
+	 */
+	class VescReplayPort : public VescPort {
+	public:
+		/**
+		 * @param speed Playback speed, 1.0 reproduces the recorded timing, 0 (or less) replays as
+		 *              fast as the receiver takes the data.
+		 * @param end_handler Called from the replay thread after the last chunk.
+		 */
+		explicit VescReplayPort(double speed = 1.0, std::function<void()> end_handler = {});
+
+		~VescReplayPort() override;
+
+		/** @p device is the path of the capture file. @throw std::runtime_error */
+		void open(const std::string &device, const ReceiveHandler &handler) override;
+
+		void close() override;
+
+		bool isOpen() const override;
+
+		size_t send(const Buffer &data) override;
+
+		bool lossless() const override {
+			return true;
+		}
+
+	private:
+		void replay(ReceiveHandler handler);
+
+		double speed_;
+		std::function<void()> end_handler_;
+		std::unique_ptr<VescCaptureReader> reader_;
+		std::thread thread_;
+		std::mutex mutex_;
+		std::condition_variable cv_;  ///< interrupts the pacing sleeps on close()
+		bool run_ = false;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_REPLAY_PORT_HPP_
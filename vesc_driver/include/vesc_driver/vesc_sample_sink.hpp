@@ -0,0 +1,122 @@
+#ifndef VESC_DRIVER__VESC_SAMPLE_SINK_HPP_
+#define VESC_DRIVER__VESC_SAMPLE_SINK_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vesc_driver {
+
+	/**
+	 * Sample file written by VescSampleSink, one float32 column per signal.
+	 *
+	 * The file starts with the 8 byte magic "VESCSMP" followed by the format version (1), the column
+	 * count (uint32) and the column names, each a uint16 length followed by the bytes of the name.
+	 * The rest of the file is a sequence of chunks of
+	 *   - uint32 row count n
+	 *   - n float32 values of the first column, then n values of the second column, ...
+	 * All values are little-endian.
+	 */
+	struct VescSampleFile {
+		static constexpr char MAGIC[8] = {'V', 'E', 'S', 'C', 'S', 'M', 'P', 1};
+	};
+
+	/**
+	 * Streams rows of samples (e.g. COMM_SAMPLE_PRINT or COMM_PLOT_DATA at kHz rates) to sample
+	 * files without file I/O on the producing thread: rows are collected column by column in
+	 * preallocated chunks, which a writer thread of its own writes out when they are full. If the
+	 * writer falls behind and all chunks are in use, rows are dropped and counted rather than
+	 * blocking the producer.
+	 *
+	 * append() and open() must be called from a single thread (e.g. the one dispatching the
+	 * received packets), the statistics may be read from any thread.
+	 */
+	class VescSampleSink {
+	public:
+		/**
+		 * Creates a sink for rows of @p column_count values in @p chunk_count chunks of @p chunk_rows
+		 * rows. Rows are dropped until the first open().
+		 */
+		explicit VescSampleSink(size_t column_count, size_t chunk_rows = 4096, size_t chunk_count = 8);
+
+		VescSampleSink(const VescSampleSink &) = delete;
+
+		VescSampleSink &operator=(const VescSampleSink &) = delete;
+
+		/** Writes the rows appended so far and closes the file. */
+		~VescSampleSink();
+
+		/**
+		 * Starts a new file at @p path with the names @p columns (one per column), the rows appended
+		 * so far still go to the previous file. The file is created by the writer thread, a failure is
+		 * reported by error() and the rows up to the next open() are dropped.
+		 */
+		void open(const std::string &path, const std::vector<std::string> &columns);
+
+		/** Appends one row of columnCount() values. */
+		void append(const float *row);
+
+		size_t columnCount() const {
+			return column_count_;
+		}
+
+		/** Rows written to files so far */
+		uint64_t rowsWritten() const {
+			return rows_written_.load(std::memory_order_relaxed);
+		}
+
+		/** Rows dropped: no free chunk, no file open or a failed write */
+		uint64_t rowsDropped() const {
+			return rows_dropped_.load(std::memory_order_relaxed);
+		}
+
+		/** The last error of the writer thread, empty if there was none */
+		std::string error() const;
+
+	private:
+		struct Chunk {
+			std::vector<float> values;    ///< column major, chunk_rows_ values per column
+			size_t rows = 0;
+		};
+
+		/** A chunk to write, or a file to open if chunk is null */
+		struct Op {
+			Chunk *chunk = nullptr;
+			std::string path;
+			std::vector<std::string> columns;
+		};
+
+		void submitCurrent();
+		void writerThread();
+		void openFile(const Op &op);
+		void writeChunk(Chunk &chunk);
+		void closeFile();
+
+		const size_t column_count_;
+		const size_t chunk_rows_;
+		std::vector<Chunk> chunks_;
+		Chunk *current_;                  ///< filled by append(), null if none was free
+
+		mutable std::mutex mutex_;        ///< protects the members below
+		std::condition_variable cv_;
+		std::vector<Chunk *> free_;
+		std::vector<Op> ops_;             ///< in order
+		bool stopping_;
+		std::string error_;
+
+		std::FILE *file_;                 ///< only used by the writer thread
+		std::string path_;
+		std::atomic<uint64_t> rows_written_;
+		std::atomic<uint64_t> rows_dropped_;
+		std::thread writer_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_SAMPLE_SINK_HPP_
@@ -0,0 +1,254 @@
+#ifndef VESC_DRIVER__VESC_SCHEMA_HPP_
+#define VESC_DRIVER__VESC_SCHEMA_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace vesc_driver {
+
+	/**
+	 * Declarative layout of fixed size VESC payloads. A packet is described by a Schema of
+	 * SchemaField, each mapping a big-endian integer in the payload to a member of a plain struct, and
+	 * the Schema generates the decoder and the encoder, e.g.
+	 *
+	 *   using ValuesSchema = Schema<
+	 *     SchemaField<&Values::temp_fet, int16_t, 1, 10>,    // offset 1, 2 bytes, value = raw / 10
+	 *     SchemaField<&Values::rpm, int32_t, 23>, ...>;
+	 *   ValuesSchema::decode(payload, values);
+	 *
+	 * Decoding is a single pass without branches: each field is one unaligned load, one byte swap and
+	 * one conversion, all offsets and scales are compile-time constants.
+	 */
+	namespace schema {
+
+		/** Reads a big-endian integer of type T from @p data, which need not be aligned. */
+		template<typename T>
+		inline T loadBigEndian(const uint8_t *data) {
+			static_assert(std::is_integral<T>::value, "fields are integers on the wire");
+			typedef typename std::make_unsigned<T>::type U;
+			U raw;
+			std::memcpy(&raw, data, sizeof(raw));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			if constexpr (sizeof(U) == 2) {
+				raw = __builtin_bswap16(raw);
+			} else if constexpr (sizeof(U) == 4) {
+				raw = __builtin_bswap32(raw);
+			} else if constexpr (sizeof(U) == 8) {
+				raw = __builtin_bswap64(raw);
+			}
+#elif !defined(__BYTE_ORDER__)
+			raw = 0;
+			for (size_t i = 0; i < sizeof(U); i++) {
+				raw = static_cast<U>((raw << 8) | data[i]);
+			}
+#endif
+			return static_cast<T>(raw);
+		}
+
+		/** Writes @p value as a big-endian integer to @p data, which need not be aligned. */
+		template<typename T>
+		inline void storeBigEndian(uint8_t *data, T value) {
+			static_assert(std::is_integral<T>::value, "fields are integers on the wire");
+			typedef typename std::make_unsigned<T>::type U;
+			U raw = static_cast<U>(value);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			if constexpr (sizeof(U) == 2) {
+				raw = __builtin_bswap16(raw);
+			} else if constexpr (sizeof(U) == 4) {
+				raw = __builtin_bswap32(raw);
+			} else if constexpr (sizeof(U) == 8) {
+				raw = __builtin_bswap64(raw);
+			}
+			std::memcpy(data, &raw, sizeof(raw));
+#elif defined(__BYTE_ORDER__)
+			std::memcpy(data, &raw, sizeof(raw));
+#else
+			for (size_t i = 0; i < sizeof(U); i++) {
+				data[i] = static_cast<uint8_t>(raw >> (8 * (sizeof(U) - 1 - i)));
+			}
+#endif
+		}
+
+		/**
+		 * Raw type of a float sent by the firmware's buffer_append_float32_auto(): an IEEE 754 like
+		 * 32 bit pattern (sign, 8 bit exponent, 23 bit mantissa) built without relying on the float
+		 * format of the controller. Used by the configuration packets.
+		 */
+		struct Float32Auto {
+			uint32_t bits;
+		};
+
+		inline double decodeFloat32Auto(uint32_t bits) {
+			int e = static_cast<int>((bits >> 23) & 0xFF);
+			const uint32_t sig_i = bits & 0x7FFFFF;
+			double sig = 0.0;
+			if (e != 0 || sig_i != 0) {
+				sig = static_cast<double>(sig_i) / (8388608.0 * 2.0) + 0.5;
+				e -= 126;
+			}
+			if (bits & (1u << 31)) {
+				sig = -sig;
+			}
+			return std::ldexp(sig, e);
+		}
+
+		inline uint32_t encodeFloat32Auto(double value) {
+			// subnormals are flushed to 0 like the firmware does
+			if (std::fabs(value) < 1.5e-38) {
+				value = 0.0;
+			}
+			int e = 0;
+			const double sig = std::frexp(value, &e);
+			const double sig_abs = std::fabs(sig);
+			uint32_t sig_i = 0;
+			if (sig_abs >= 0.5) {
+				sig_i = static_cast<uint32_t>((sig_abs - 0.5) * 2.0 * 8388608.0);
+				e += 126;
+			}
+			uint32_t bits = ((static_cast<uint32_t>(e) & 0xFF) << 23) | (sig_i & 0x7FFFFF);
+			if (sig < 0) {
+				bits |= 1u << 31;
+			}
+			return bits;
+		}
+
+		template<typename M>
+		struct MemberPointer;
+
+		template<typename S, typename T>
+		struct MemberPointer<T S::*> {
+			typedef S Struct;
+			typedef T Type;
+		};
+
+	}  // namespace schema
+
+	/**
+	 * One field of a Schema: the big-endian integer of type @p Raw at payload offset @p Offset (the
+	 * payload id is at offset 0) holds the value of @p Member multiplied by @p Scale. Floating point
+	 * members are decoded as raw / Scale and encoded as the truncation of value * Scale, integer
+	 * members are copied as is. A @p Raw of schema::Float32Auto holds the value itself. @p Mask is
+	 * the field's bit in COMM_GET_VALUES_SELECTIVE style field masks, fields sent as a group (e.g.
+	 * the three MOSFET temperatures) share it.
+	 */
+	template<auto Member, typename Raw, size_t Offset, int64_t Scale = 1, uint32_t Mask = 0>
+	struct SchemaField {
+		typedef typename schema::MemberPointer<decltype(Member)>::Struct Struct;
+		typedef typename schema::MemberPointer<decltype(Member)>::Type Type;
+
+		static constexpr size_t OFFSET = Offset;
+		static constexpr size_t SIZE = sizeof(Raw);
+		static constexpr uint32_t MASK = Mask;
+
+		static_assert(
+			std::is_floating_point<Type>::value || Scale == 1, "integer members can not be scaled");
+		static_assert(
+			!std::is_same<Raw, schema::Float32Auto>::value ||
+			(std::is_floating_point<Type>::value && Scale == 1), "auto floats are not scaled");
+
+		static void decodeAt(const uint8_t *data, Struct &out) {
+			if constexpr (std::is_same<Raw, schema::Float32Auto>::value) {
+				out.*Member = static_cast<Type>(
+					schema::decodeFloat32Auto(schema::loadBigEndian<uint32_t>(data)));
+			} else if constexpr (std::is_floating_point<Type>::value) {
+				out.*Member = static_cast<Type>(schema::loadBigEndian<Raw>(data)) /
+					static_cast<Type>(Scale);
+			} else {
+				out.*Member = static_cast<Type>(schema::loadBigEndian<Raw>(data));
+			}
+		}
+
+		static void encodeAt(const Struct &in, uint8_t *data) {
+			if constexpr (std::is_same<Raw, schema::Float32Auto>::value) {
+				schema::storeBigEndian<uint32_t>(data, schema::encodeFloat32Auto(in.*Member));
+			} else if constexpr (std::is_floating_point<Type>::value) {
+				schema::storeBigEndian<Raw>(data, static_cast<Raw>(in.*Member * static_cast<double>(Scale)));
+			} else {
+				schema::storeBigEndian<Raw>(data, static_cast<Raw>(in.*Member));
+			}
+		}
+
+		/**
+		 * Decodes the field at @p offset if all bits of MASK are set in @p requested and it fits
+		 * into @p size bytes, see Schema::decodeSelected().
+		 */
+		static size_t decodeSelected(
+			const uint8_t *payload, size_t size, size_t offset, uint32_t requested, uint32_t *mask,
+			bool *truncated, Struct &out) {
+			if (*truncated || (requested & MASK) != MASK) {
+				return offset;
+			}
+			if (offset + SIZE > size) {
+				// a group only counts if all its fields are contained
+				*mask &= ~MASK;
+				*truncated = true;
+				return offset;
+			}
+			decodeAt(payload + offset, out);
+			*mask |= MASK;
+			return offset + SIZE;
+		}
+	};
+
+	/**
+	 * A fixed payload layout made of @p Fields, see SchemaField.
+	 */
+	template<typename... Fields>
+	struct Schema {
+		/** Payload size needed to hold all fields */
+		static constexpr size_t SIZE =
+			std::max({static_cast<size_t>(0), (Fields::OFFSET + Fields::SIZE)...});
+
+		/** Decodes all fields of @p payload, which must have SIZE bytes. */
+		template<typename Struct>
+		static void decode(const uint8_t *payload, Struct &out) {
+			(Fields::decodeAt(payload + Fields::OFFSET, out), ...);
+		}
+
+		/**
+		 * Decodes @p payload of @p size bytes. Of a payload shorter than SIZE (e.g. from older
+		 * firmware sending fewer fields) only the fields it contains completely are decoded, the others
+		 * are left untouched.
+		 */
+		template<typename Struct>
+		static void decode(const uint8_t *payload, size_t size, Struct &out) {
+			if (size >= SIZE) {
+				decode(payload, out);
+			} else {
+				((Fields::OFFSET + Fields::SIZE <= size ? Fields::decodeAt(payload + Fields::OFFSET, out) :
+				(void)0), ...);
+			}
+		}
+
+		/** Encodes all fields into @p payload, which must have room for SIZE bytes. */
+		template<typename Struct>
+		static void encode(const Struct &in, uint8_t *payload) {
+			(Fields::encodeAt(in, payload + Fields::OFFSET), ...);
+		}
+
+		/**
+		 * Decodes a payload that contains only the fields selected by the field mask @p requested,
+		 * back-to-back in schema order starting at @p offset (the fixed offsets are ignored), like the
+		 * reply to COMM_GET_VALUES_SELECTIVE. Fields that are not contained are left untouched.
+		 *
+		 * @return The mask of the fields contained in @p payload, a truncated payload only contains
+		 *         the fields before the cut.
+		 */
+		template<typename Struct>
+		static uint32_t decodeSelected(
+			const uint8_t *payload, size_t size, size_t offset, uint32_t requested, Struct &out) {
+			uint32_t mask = 0;
+			bool truncated = false;
+			((offset = Fields::decodeSelected(
+				payload, size, offset, requested, &mask, &truncated, out)), ...);
+			return mask;
+		}
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_SCHEMA_HPP_
@@ -0,0 +1,89 @@
+#ifndef VESC_DRIVER__VESC_TELEMETRY_WINDOW_HPP_
+#define VESC_DRIVER__VESC_TELEMETRY_WINDOW_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace vesc_driver {
+
+	/** The values of one telemetry reply (COMM_GET_VALUES or the merged selective ones) to summarize */
+	struct VescTelemetrySample {
+		std::chrono::steady_clock::time_point rx_time;
+		double current_motor;
+		double current_input;
+		double voltage_input;
+		double speed;
+		double charge_drawn;
+		double charge_regen;
+		double energy_drawn;
+		double energy_regen;
+	};
+
+	/** Statistics of the samples of one VescTelemetryWindow */
+	struct VescTelemetrySummary {
+		struct Range {
+			double min;
+			double max;
+			double mean;
+		};
+
+		std::chrono::steady_clock::duration duration;  ///< from the first to the last sample
+		size_t sample_count;                           ///< samples the ranges are computed from
+		Range current_motor;
+		Range current_input;
+		Range voltage_input;
+		Range speed;
+		double charge_drawn;                ///< counter increases since the previous window
+		double charge_regen;
+		double energy_drawn;
+		double energy_regen;
+	};
+
+	/**
+	 * Collects the telemetry samples of a time window in a ring of fixed size and summarizes them
+	 * when the window is closed, so that a high telemetry rate can be reported at a low one. If a
+	 * window has more samples than the ring holds, the ranges are computed from the latest ones; the
+	 * counter increases and the duration always cover the whole window.
+	 *
+	 * Not thread safe, meant to be fed by the thread dispatching the received packets.
+	 */
+	class VescTelemetryWindow {
+	public:
+		/** Creates a window of at most @p capacity samples (at least one), allocated up front. */
+		explicit VescTelemetryWindow(size_t capacity);
+
+		/** Adds @p sample, replacing the oldest one if the ring is full. */
+		void add(const VescTelemetrySample &sample);
+
+		bool empty() const {
+			return size_ == 0;
+		}
+
+		/** Arrival time of the first sample of the window, only valid if not empty() */
+		std::chrono::steady_clock::time_point start() const {
+			return first_.rx_time;
+		}
+
+		/**
+		 * Summarizes the samples added since the last call and starts the next window. The counters
+		 * are compared with the last sample of the previous window, or with the first sample of
+		 * this window if it is the first one; a counter that went down (e.g. the VESC restarted)
+		 * counts from zero.
+		 *
+		 * Must not be called if empty().
+		 */
+		VescTelemetrySummary close();
+
+	private:
+		std::vector<VescTelemetrySample> ring_;
+		size_t head_;                       ///< index of the oldest sample
+		size_t size_;
+		VescTelemetrySample first_;         ///< first sample of the window, even if replaced
+		bool has_previous_;
+		VescTelemetrySample previous_;      ///< last sample of the previous window
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_TELEMETRY_WINDOW_HPP_
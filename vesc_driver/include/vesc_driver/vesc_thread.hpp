@@ -0,0 +1,65 @@
+#ifndef VESC_DRIVER__VESC_THREAD_HPP_
+#define VESC_DRIVER__VESC_THREAD_HPP_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace drivers {
+	namespace common {
+		class IoContext;
+	}
+}
+
+namespace vesc_driver {
+
+	/**
+	 * Scheduling settings of a thread on the VESC path, e.g. to keep the framer running on time while
+	 * other processes load the machine. Only supported on Linux, real-time policies need
+	 * CAP_SYS_NICE or an rtprio limit (see limits.conf) and locking memory needs CAP_IPC_LOCK or a
+	 * large enough memlock limit.
+	 */
+	struct ThreadConfig {
+		enum Policy {
+			POLICY_DEFAULT,  ///< leave the scheduling policy and priority alone
+			POLICY_FIFO,     ///< SCHED_FIFO
+			POLICY_RR        ///< SCHED_RR
+		};
+
+		Policy policy = POLICY_DEFAULT;
+		int priority = 0;            ///< real-time priority, 1 (lowest) to 99, for POLICY_FIFO and POLICY_RR
+		std::vector<int> cpus;       ///< CPUs the thread may run on, empty = any
+		bool lock_memory = false;    ///< lock the process memory and pre-fault the thread's stack
+
+		bool isDefault() const {
+			return policy == POLICY_DEFAULT && cpus.empty() && !lock_memory;
+		}
+	};
+
+	/**
+	 * Parses a policy name, "other" (POLICY_DEFAULT), "fifo" or "rr".
+	 *
+	 * @return false if @p name is unknown.
+	 */
+	bool parseThreadPolicy(const std::string &name, ThreadConfig::Policy *policy);
+
+	/**
+	 * Applies @p config to the calling thread.
+	 *
+	 * @throw std::runtime_error if a setting could not be applied, the settings before it are kept.
+	 */
+	void applyThreadConfig(const ThreadConfig &config);
+
+	/**
+	 * Applies @p config to each thread of @p io_context by running a task on all of them at once. The
+	 * threads must be idle enough to pick up the task within @p timeout.
+	 *
+	 * @throw std::runtime_error if a thread failed to apply the settings or the timeout expired.
+	 */
+	void applyThreadConfig(
+		drivers::common::IoContext &io_context, const ThreadConfig &config,
+		std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_THREAD_HPP_
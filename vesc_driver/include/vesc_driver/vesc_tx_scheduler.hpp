@@ -0,0 +1,148 @@
+#ifndef VESC_DRIVER__VESC_TX_SCHEDULER_HPP_
+#define VESC_DRIVER__VESC_TX_SCHEDULER_HPP_
+
+#include "vesc_driver/vesc_packet.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace vesc_driver {
+
+	/**
+	 * Decides which frame goes out on the link next.
+	 *
+	 * Frames are posted to latest-wins slots: a slot holds at most one pending frame and posting to
+	 * a slot that still has an unsent frame replaces it (counted as coalesced), so the link never
+	 * carries a stale setpoint. Each slot has a priority and an optional minimum interval between
+	 * two transmissions (rate cap). Pending slots of equal priority are served round-robin, e.g. the
+	 * motor commands of several VESCs on one link. Frames that must not be coalesced go to a bounded
+	 * FIFO instead.
+	 *
+	 * pop() hands out the highest priority eligible frame and paces the link, i.e. it does not
+	 * release more data than the link can carry (plus a small lead), so frames wait here, where
+	 * they can still be replaced, rather than in the operating system's serial buffers.
+	 *
+	 * All storage is preallocated, posting and popping frames does not allocate.
+	 */
+	class VescTxScheduler {
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		struct Statistics {
+			uint64_t frames = 0;      ///< frames handed out by pop()
+			uint64_t bytes = 0;       ///< bytes handed out by pop()
+			uint64_t coalesced = 0;   ///< pending frames replaced by a newer one before being sent
+			uint64_t dropped = 0;     ///< frames rejected because the FIFO was full
+			size_t queue_depth = 0;   ///< frames currently waiting (pending slots + FIFO)
+		};
+
+		/**
+		 * @param fifo_capacity Number of frames the FIFO can hold.
+		 * @param fifo_priority Priority of the FIFO relative to the slots.
+		 */
+		explicit VescTxScheduler(size_t fifo_capacity = 16, int fifo_priority = 0);
+
+		VescTxScheduler(const VescTxScheduler &) = delete;
+
+		VescTxScheduler &operator=(const VescTxScheduler &) = delete;
+
+		/**
+		 * Adds a latest-wins slot. Lower @p priority values are sent first. Slots must be added
+		 * before the scheduler is used from several threads.
+		 *
+		 * @return The slot id to post() to.
+		 */
+		int addSlot(int priority);
+
+		/** Caps the transmission rate of @p slot, @p max_rate_hz <= 0 removes the cap. */
+		void setRateLimit(int slot, double max_rate_hz);
+
+		/** Bytes per second the link can carry, used for pacing. 0 disables pacing. */
+		void setLinkRate(double bytes_per_second);
+
+		/** Makes @p frame the pending frame of @p slot, replacing an unsent one. */
+		void post(int slot, const Buffer &frame);
+
+		/** Drops the pending frame of @p slot, if any, so that it is not sent. */
+		void discard(int slot);
+
+		/**
+		 * Appends @p frame to the FIFO.
+		 *
+		 * @return false if the FIFO is full and the frame was dropped.
+		 */
+		bool enqueue(const Buffer &frame);
+
+		/**
+		 * Waits until a frame may be sent and copies it to @p frame. @p posted (if given) is set to the
+		 * time the frame was posted or enqueued.
+		 *
+		 * @return false once stop() has been called.
+		 */
+		bool pop(Buffer &frame, Clock::time_point *posted = nullptr);
+
+		/**
+		 * Non-blocking pop(): copies the next frame to @p frame if one may be sent now. Otherwise
+		 * lowers @p wake_up to the time a frame will become ready, if any is pending or rate capped.
+		 *
+		 * @return true if a frame was copied.
+		 */
+		bool tryPop(Buffer &frame, Clock::time_point *wake_up, Clock::time_point *posted = nullptr);
+
+		/**
+		 * Sets a function called (without any lock held) whenever a frame was posted or enqueued, used
+		 * to wake up an external thread calling tryPop(). Must be set before the scheduler is used.
+		 */
+		void setWakeUpHandler(std::function<void()> handler);
+
+		/** Wakes up pop() and makes it (and subsequent calls) return false until start(). */
+		void stop();
+
+		void start();
+
+		Statistics statistics();
+
+	private:
+		/** Maximum amount of data (in time on the wire) released ahead of the link */
+		static constexpr std::chrono::microseconds LINK_LEAD{1000};
+
+		struct Slot {
+			int priority;
+			bool pending;
+			Clock::duration min_interval;
+			Clock::time_point last_sent;
+			Clock::time_point posted;
+			Buffer frame;
+		};
+
+		/** Index of the slot to send next, SIZE_MAX for the FIFO, also outputs the wake-up time. */
+		bool selectNext(Clock::time_point now, size_t *selected, Clock::time_point *wake_up) const;
+
+		/** Removes the next frame if it may be sent at @p now, mutex_ must be held. */
+		bool take(
+			Clock::time_point now, Buffer &frame, Clock::time_point *wake_up, Clock::time_point *posted);
+
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		bool stopped_;
+		std::vector<Slot> slots_;
+		std::vector<Buffer> fifo_;
+		std::vector<Clock::time_point> fifo_posted_;
+		size_t fifo_head_;
+		size_t fifo_size_;
+		size_t next_slot_;  ///< round-robin position among slots of equal priority
+		int fifo_priority_;
+		double link_seconds_per_byte_;
+		Clock::time_point link_busy_until_;
+		Statistics stats_;
+		std::function<void()> wake_up_handler_;
+	};
+
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__VESC_TX_SCHEDULER_HPP_
@@ -0,0 +1,67 @@
+from launch import LaunchDescription
+from ament_index_python.packages import get_package_share_directory
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+import os
+
+
+def generate_launch_description():
+
+    vesc_config = os.path.join(
+        get_package_share_directory('vesc_driver'),
+        'params',
+        'vesc_config.yaml'
+        )
+
+    # the driver, the ackermann command conversion and the odometry run in one process, with
+    # intra-process comms sensors/core is passed to the odometry without copies. The commands to
+    # the driver are not: its command subscriptions opt out of intra-process comms, so they go
+    # through the middleware, which does not allocate in the driver's callbacks
+    intra_process = [{'use_intra_process_comms': True}]
+
+    container = ComposableNodeContainer(
+        name='vesc_container',
+        namespace='',
+        package='rclcpp_components',
+        executable='component_container',
+        composable_node_descriptions=[
+            ComposableNode(
+                package='vesc_driver',
+                plugin='vesc_driver::VescDriver',
+                name='vesc_driver_node',
+                parameters=[vesc_config],
+                extra_arguments=intra_process),
+            ComposableNode(
+                package='vesc_ackermann',
+                plugin='vesc_ackermann::AckermannToVesc',
+                name='ackermann_to_vesc_node',
+                parameters=[{
+                    'speed_to_erpm_gain': 4614.0,
+                    'speed_to_erpm_offset': 0.0,
+                    'steering_angle_to_servo_gain': -1.2135,
+                    'steering_angle_to_servo_offset': 0.5304,
+                }],
+                extra_arguments=intra_process),
+            ComposableNode(
+                package='vesc_ackermann',
+                plugin='vesc_ackermann::VescToOdom',
+                name='vesc_to_odom_node',
+                parameters=[{
+                    'odom_frame': 'odom',
+                    'base_frame': 'base_link',
+                    'speed_to_erpm_gain': 4614.0,
+                    'speed_to_erpm_offset': 0.0,
+                    'use_servo_cmd_to_calc_angular_velocity': True,
+                    'steering_angle_to_servo_gain': -1.2135,
+                    'steering_angle_to_servo_offset': 0.5304,
+                    'wheelbase': 0.2,
+                    'publish_tf': True,
+                    'use_tachometer': False,
+                    'tachometer_counts_per_erev': 6.0,
+                }],
+                extra_arguments=intra_process),
+        ],
+        output='screen',
+    )
+
+    return LaunchDescription([container])
@@ -0,0 +1,98 @@
+#include "vesc_driver/ring_buffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace vesc_driver {
+
+	RingBuffer::RingBuffer(size_t capacity) {
+		reset(capacity);
+	}
+
+	void RingBuffer::reset(size_t capacity) {
+		size_t rounded = 1;
+		while (rounded < capacity) {
+			rounded <<= 1;
+		}
+		if (!storage_ || rounded != this->capacity()) {
+			storage_.reset(new uint8_t[rounded]);
+			mask_ = rounded - 1;
+		}
+		head_.store(0, std::memory_order_relaxed);
+		tail_.store(0, std::memory_order_relaxed);
+	}
+
+	size_t RingBuffer::push(const uint8_t *data, size_t size) {
+		const size_t head = head_.load(std::memory_order_relaxed);
+		const size_t tail = tail_.load(std::memory_order_acquire);
+		const size_t count = std::min(size, capacity() - (head - tail));
+
+		// copy in at most two pieces, the second one starts at the beginning of the storage
+		const size_t offset = head & mask_;
+		const size_t first = std::min(count, capacity() - offset);
+		std::memcpy(storage_.get() + offset, data, first);
+		std::memcpy(storage_.get(), data + first, count - first);
+
+		head_.store(head + count, std::memory_order_release);
+
+		if (count < size) {
+			overrun_bytes_.fetch_add(size - count, std::memory_order_relaxed);
+			overrun_count_.fetch_add(1, std::memory_order_relaxed);
+		}
+		return count;
+	}
+
+	BufferView RingBuffer::peek() const {
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		const size_t head = head_.load(std::memory_order_acquire);
+		const size_t count = head - tail;
+
+		const size_t offset = tail & mask_;
+		const size_t first = std::min(count, capacity() - offset);
+		return BufferView(storage_.get() + offset, first, storage_.get(), count - first);
+	}
+
+	void RingBuffer::pop(size_t size) {
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		tail_.store(tail + size, std::memory_order_release);
+	}
+
+	RxTimestampRing::RxTimestampRing(size_t capacity) {
+		size_t rounded = 1;
+		while (rounded < capacity) {
+			rounded <<= 1;
+		}
+		chunks_.reset(new Chunk[rounded]);
+		mask_ = rounded - 1;
+	}
+
+	void RxTimestampRing::reset() {
+		head_.store(0, std::memory_order_relaxed);
+		tail_.store(0, std::memory_order_relaxed);
+	}
+
+	void RxTimestampRing::push(size_t end, Clock::time_point time) {
+		const size_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) > mask_) {
+			return;
+		}
+		chunks_[head & mask_] = Chunk{end, time};
+		head_.store(head + 1, std::memory_order_release);
+	}
+
+	RxTimestampRing::Clock::time_point RxTimestampRing::at(size_t position) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		const size_t head = head_.load(std::memory_order_acquire);
+		// the chunk holding position is the first one that ends after it
+		for (; tail != head; tail++) {
+			const Chunk &chunk = chunks_[tail & mask_];
+			if (chunk.end > position) {
+				tail_.store(tail, std::memory_order_release);
+				return chunk.time;
+			}
+		}
+		tail_.store(tail, std::memory_order_release);
+		return Clock::now();
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,471 @@
+#include "vesc_driver/vesc_can_port.hpp"
+#include "vesc_driver/datatypes.hpp"
+#include "vesc_driver/vesc_crc.hpp"
+#include "vesc_driver/vesc_schema.hpp"
+
+#ifdef __linux__
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace vesc_driver {
+
+	namespace {
+
+		/** Payload of a COMM_GET_VALUES_SELECTIVE reply, add() the fields in the order of their bits */
+		class SelectiveReply {
+		public:
+			SelectiveReply()
+				: mask_(0), size_(5) {
+				data_[0] = COMM_GET_VALUES_SELECTIVE;
+			}
+
+			template<typename T>
+			void add(uint32_t field, T raw) {
+				mask_ |= field;
+				schema::storeBigEndian<T>(data_ + size_, raw);
+				size_ += sizeof(T);
+			}
+
+			const uint8_t *finish(size_t *size) {
+				schema::storeBigEndian<uint32_t>(data_ + 1, mask_);
+				*size = size_;
+				return data_;
+			}
+
+		private:
+			uint8_t data_[32];
+			uint32_t mask_;
+			size_t size_;
+		};
+
+		/** Replaces @p frame by the frame carrying @p payload. */
+		void buildFrame(const uint8_t *payload, size_t size, Buffer *frame) {
+			frame->clear();
+			if (size < 256) {
+				frame->push_back(VescFrame::VESC_SOF_VAL_SMALL_FRAME);
+				frame->push_back(static_cast<uint8_t>(size));
+			} else {
+				frame->push_back(VescFrame::VESC_SOF_VAL_LARGE_FRAME);
+				frame->push_back(static_cast<uint8_t>(size >> 8));
+				frame->push_back(static_cast<uint8_t>(size & 0xFF));
+			}
+			frame->insert(frame->end(), payload, payload + size);
+			const uint16_t crc = VescCrc::calculate(payload, size);
+			frame->push_back(static_cast<uint8_t>(crc >> 8));
+			frame->push_back(static_cast<uint8_t>(crc & 0xFF));
+			frame->push_back(VescFrame::VESC_EOF_VAL);
+		}
+
+		/** CAN_PACKET_SET_* sending the value of a COMM_SET_* payload as it is, -1 if there is none */
+		int setCommand(uint8_t payload_id) {
+			switch (payload_id) {
+				case COMM_SET_DUTY:
+					return CAN_PACKET_SET_DUTY;
+				case COMM_SET_CURRENT:
+					return CAN_PACKET_SET_CURRENT;
+				case COMM_SET_CURRENT_BRAKE:
+					return CAN_PACKET_SET_CURRENT_BRAKE;
+				case COMM_SET_RPM:
+					return CAN_PACKET_SET_RPM;
+				case COMM_SET_POS:
+					return CAN_PACKET_SET_POS;
+				default:
+					return -1;
+			}
+		}
+
+#ifdef __linux__
+		std::runtime_error canError(const char *what, const std::string &device) {
+			return std::runtime_error(std::string(what) + " " + device + ": " + std::strerror(errno));
+		}
+
+		/**
+		 * Converts the CLOCK_REALTIME timestamp @p ts to the steady clock, false if it is not set or
+		 * not plausible (e.g. a hardware timestamp in the clock domain of the CAN controller).
+		 */
+		bool steadyTime(
+			const timespec &ts, std::chrono::system_clock::time_point realtime_now,
+			VescPort::Clock::time_point steady_now, VescPort::Clock::time_point *time) {
+			if (ts.tv_sec == 0 && ts.tv_nsec == 0) {
+				return false;
+			}
+			auto received = std::chrono::system_clock::time_point(
+				std::chrono::duration_cast<std::chrono::system_clock::duration>(
+					std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+			auto age = realtime_now - received;
+			if (age > std::chrono::seconds(1) || age < -std::chrono::milliseconds(1)) {
+				return false;
+			}
+			*time = steady_now - std::chrono::duration_cast<VescPort::Clock::duration>(
+				std::max(age, std::chrono::system_clock::duration::zero()));
+			return true;
+		}
+#endif
+
+	}  // namespace
+
+	VescCanPort::VescCanPort(const VescCanPortOptions &options)
+		: options_(options), socket_(-1), run_(false) {
+		if (options_.local_id < 0 || options_.local_id > 254) {
+			throw std::invalid_argument("Local CAN id out of range");
+		}
+		if (options_.sender_id < 0 || options_.sender_id > 254 ||
+			options_.sender_id == options_.local_id) {
+			throw std::invalid_argument("Sender CAN id out of range or used by the local VESC");
+		}
+		rx_frame_.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+	}
+
+	VescCanPort::~VescCanPort() {
+		close();
+	}
+
+	void VescCanPort::open(const std::string &device, const ReceiveHandler &handler) {
+#ifdef __linux__
+		close();
+		if (device.empty() || device.size() >= IFNAMSIZ) {
+			throw std::runtime_error("Invalid CAN interface name '" + device + "'");
+		}
+		int fd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+		if (fd < 0) {
+			throw canError("Failed to create a CAN socket for", device);
+		}
+		ifreq ifr;
+		std::memset(&ifr, 0, sizeof(ifr));
+		std::strncpy(ifr.ifr_name, device.c_str(), IFNAMSIZ - 1);
+		if (::ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+			auto error = canError("Failed to find the CAN interface", device);
+			::close(fd);
+			throw error;
+		}
+		sockaddr_can addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.can_family = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+		if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+			auto error = canError("Failed to bind to the CAN interface", device);
+			::close(fd);
+			throw error;
+		}
+
+		// the VESCs only use extended data frames
+		can_filter filter;
+		filter.can_id = CAN_EFF_FLAG;
+		filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG;
+		::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+
+		// receive timestamps, without them the frames are stamped by the receive handler
+		int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+		if (options_.hardware_timestamps) {
+			// enabling them on the interface needs CAP_NET_ADMIN, some drivers always provide them
+			hwtstamp_config config;
+			std::memset(&config, 0, sizeof(config));
+			config.tx_type = HWTSTAMP_TX_OFF;
+			config.rx_filter = HWTSTAMP_FILTER_ALL;
+			ifr.ifr_data = reinterpret_cast<char *>(&config);
+			::ioctl(fd, SIOCSHWTSTAMP, &ifr);
+			timestamping |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+		}
+		::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping));
+
+		// lets the receive thread check for close() in between
+		timeval timeout = {0, 100000};
+		::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		socket_ = fd;
+		run_ = true;
+		thread_ = std::thread(&VescCanPort::receive, this, handler);
+#else
+		(void)device;
+		(void)handler;
+		throw std::runtime_error("SocketCAN is only available on Linux");
+#endif
+	}
+
+	void VescCanPort::close() {
+		run_ = false;
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+#ifdef __linux__
+		if (socket_ >= 0) {
+			::close(socket_);
+		}
+#endif
+		socket_ = -1;
+	}
+
+	bool VescCanPort::isOpen() const {
+		// the receive thread stops on a fatal error, e.g. the interface went away
+		return socket_ >= 0 && run_;
+	}
+
+	size_t VescCanPort::send(const Buffer &data) {
+		size_t sent = 0;
+		while (sent < data.size()) {
+			const uint8_t *frame = data.data() + sent;
+			const size_t left = data.size() - sent;
+			size_t header;
+			size_t payload_size;
+			if (frame[0] == VescFrame::VESC_SOF_VAL_SMALL_FRAME && left >= 2) {
+				header = 2;
+				payload_size = frame[1];
+			} else if (frame[0] == VescFrame::VESC_SOF_VAL_LARGE_FRAME && left >= 3) {
+				header = 3;
+				payload_size = (static_cast<size_t>(frame[1]) << 8) | frame[2];
+			} else {
+				break;
+			}
+			// payload, CRC and end of frame
+			const size_t frame_size = header + payload_size + 3;
+			if (payload_size == 0 || frame_size > left ||
+				!sendPayload(options_.local_id, frame + header, payload_size)) {
+				break;
+			}
+			sent += frame_size;
+		}
+		return sent;
+	}
+
+	bool VescCanPort::sendPayload(int target, const uint8_t *payload, size_t size) {
+		if (payload[0] == COMM_FORWARD_CAN && size >= 3) {
+			target = payload[1];
+			payload += 2;
+			size -= 2;
+		}
+		const int command = setCommand(payload[0]);
+		if (command >= 0 && size == 5) {
+			// the setpoint has the same scale in both protocols
+			return sendCanFrame((static_cast<uint32_t>(command) << 8) | target, payload + 1, 4);
+		}
+		return sendBuffer(target, payload, size);
+	}
+
+	/** Sends a request to the receive buffer of @p target, like comm_can_send_buffer() of the VESC. */
+	bool VescCanPort::sendBuffer(int target, const uint8_t *payload, size_t size) {
+		uint8_t data[8];
+		if (size <= 6) {
+			data[0] = static_cast<uint8_t>(options_.sender_id);
+			data[1] = 0;  // process the request and send the reply back to sender_id
+			std::memcpy(data + 2, payload, size);
+			return sendCanFrame(
+				(static_cast<uint32_t>(CAN_PACKET_PROCESS_SHORT_BUFFER) << 8) | target, data, size + 2);
+		}
+
+		// 7 bytes per frame up to offset 255, then 6 bytes per frame with a 16 bit offset
+		size_t offset = 0;
+		while (offset < size) {
+			size_t chunk;
+			uint32_t id;
+			if (offset <= 255) {
+				chunk = std::min<size_t>(7, size - offset);
+				data[0] = static_cast<uint8_t>(offset);
+				std::memcpy(data + 1, payload + offset, chunk);
+				id = (static_cast<uint32_t>(CAN_PACKET_FILL_RX_BUFFER) << 8) | target;
+				if (!sendCanFrame(id, data, chunk + 1)) {
+					return false;
+				}
+			} else {
+				chunk = std::min<size_t>(6, size - offset);
+				schema::storeBigEndian<uint16_t>(data, static_cast<uint16_t>(offset));
+				std::memcpy(data + 2, payload + offset, chunk);
+				id = (static_cast<uint32_t>(CAN_PACKET_FILL_RX_BUFFER_LONG) << 8) | target;
+				if (!sendCanFrame(id, data, chunk + 2)) {
+					return false;
+				}
+			}
+			offset += chunk;
+		}
+		data[0] = static_cast<uint8_t>(options_.sender_id);
+		data[1] = 0;
+		schema::storeBigEndian<uint16_t>(data + 2, static_cast<uint16_t>(size));
+		schema::storeBigEndian<uint16_t>(data + 4, VescCrc::calculate(payload, size));
+		return sendCanFrame(
+			(static_cast<uint32_t>(CAN_PACKET_PROCESS_RX_BUFFER) << 8) | target, data, 6);
+	}
+
+	bool VescCanPort::sendCanFrame(uint32_t id, const uint8_t *data, size_t size) {
+#ifdef __linux__
+		can_frame frame;
+		std::memset(&frame, 0, sizeof(frame));
+		frame.can_id = id | CAN_EFF_FLAG;
+		frame.can_dlc = static_cast<uint8_t>(size);
+		std::memcpy(frame.data, data, size);
+		for (int attempt = 0; attempt < 100; attempt++) {
+			ssize_t written = ::write(socket_, &frame, sizeof(frame));
+			if (written == static_cast<ssize_t>(sizeof(frame))) {
+				return true;
+			}
+			if (written >= 0 || errno != ENOBUFS) {
+				return false;
+			}
+			// the transmit queue of the interface is full, it drains at the bit rate of the bus
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+#else
+		(void)id;
+		(void)data;
+		(void)size;
+#endif
+		return false;
+	}
+
+	void VescCanPort::receive(ReceiveHandler handler) {
+#ifdef __linux__
+		while (run_) {
+			can_frame frame;
+			char control[CMSG_SPACE(3 * sizeof(timespec))];
+			iovec iov = {&frame, sizeof(frame)};
+			msghdr msg;
+			std::memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			ssize_t size = ::recvmsg(socket_, &msg, 0);
+			if (size < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+					continue;
+				}
+				// e.g. the interface went down, isOpen() reports it
+				run_ = false;
+				break;
+			}
+			if (size < static_cast<ssize_t>(sizeof(frame)) || !(frame.can_id & CAN_EFF_FLAG)) {
+				continue;
+			}
+
+			// the hardware timestamp if there is a plausible one, else the one of the kernel
+			Clock::time_point rx_time;
+			for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING) {
+					continue;
+				}
+				timespec ts[3];
+				std::memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+				auto realtime_now = std::chrono::system_clock::now();
+				auto steady_now = Clock::now();
+				if (!(options_.hardware_timestamps &&
+					  steadyTime(ts[2], realtime_now, steady_now, &rx_time))) {
+					steadyTime(ts[0], realtime_now, steady_now, &rx_time);
+				}
+			}
+			receiveFrame(
+				frame.can_id & CAN_EFF_MASK, frame.data, std::min<size_t>(frame.can_dlc, 8), rx_time,
+				handler);
+		}
+#else
+		(void)handler;
+#endif
+	}
+
+	void VescCanPort::receiveFrame(
+		uint32_t id, const uint8_t *data, size_t size, Clock::time_point rx_time,
+		const ReceiveHandler &handler) {
+		const uint32_t command = id >> 8;
+		const uint8_t node = static_cast<uint8_t>(id & 0xFF);
+		const bool to_us = node == options_.sender_id;
+		using schema::loadBigEndian;
+		typedef VescPacketValuesSelective S;
+		SelectiveReply status;
+		const uint8_t *payload = nullptr;
+		size_t payload_size = 0;
+
+		switch (command) {
+			case CAN_PACKET_FILL_RX_BUFFER:
+				if (to_us && size > 1) {
+					const size_t offset = data[0];
+					std::memcpy(rx_buffer_ + offset, data + 1, size - 1);
+				}
+				return;
+			case CAN_PACKET_FILL_RX_BUFFER_LONG:
+				if (to_us && size > 2) {
+					const size_t offset = loadBigEndian<uint16_t>(data);
+					if (offset + size - 2 <= sizeof(rx_buffer_)) {
+						std::memcpy(rx_buffer_ + offset, data + 2, size - 2);
+					}
+				}
+				return;
+			case CAN_PACKET_PROCESS_RX_BUFFER:
+				// a reply (1) to a request of ours, complete if the CRC matches
+				if (to_us && size >= 6 && data[1] == 1) {
+					payload_size = loadBigEndian<uint16_t>(data + 2);
+					if (payload_size == 0 || payload_size > sizeof(rx_buffer_) ||
+						VescCrc::calculate(rx_buffer_, payload_size) !=
+						loadBigEndian<uint16_t>(data + 4)) {
+						return;
+					}
+					payload = rx_buffer_;
+				}
+				break;
+			case CAN_PACKET_PROCESS_SHORT_BUFFER:
+				if (to_us && size > 2 && data[1] == 1) {
+					payload = data + 2;
+					payload_size = size - 2;
+				}
+				break;
+			case CAN_PACKET_STATUS:
+				if (size >= 8) {
+					// 0.1 A to 0.01 A
+					status.add<int32_t>(S::AVG_MOTOR_CURRENT, loadBigEndian<int16_t>(data + 4) * 10);
+					status.add<int16_t>(S::DUTY_CYCLE_NOW, loadBigEndian<int16_t>(data + 6));
+					status.add<int32_t>(S::RPM, loadBigEndian<int32_t>(data));
+				}
+				break;
+			case CAN_PACKET_STATUS_2:
+				if (size >= 8) {
+					status.add<int32_t>(S::AMP_HOURS, loadBigEndian<int32_t>(data));
+					status.add<int32_t>(S::AMP_HOURS_CHARGED, loadBigEndian<int32_t>(data + 4));
+				}
+				break;
+			case CAN_PACKET_STATUS_3:
+				if (size >= 8) {
+					status.add<int32_t>(S::WATT_HOURS, loadBigEndian<int32_t>(data));
+					status.add<int32_t>(S::WATT_HOURS_CHARGED, loadBigEndian<int32_t>(data + 4));
+				}
+				break;
+			case CAN_PACKET_STATUS_4:
+				if (size >= 8) {
+					status.add<int16_t>(S::TEMP_FET, loadBigEndian<int16_t>(data));
+					status.add<int16_t>(S::TEMP_MOTOR, loadBigEndian<int16_t>(data + 2));
+					status.add<int32_t>(S::AVG_INPUT_CURRENT, loadBigEndian<int16_t>(data + 4) * 10);
+					// 1/50 degree to 1e-6 degree
+					status.add<int32_t>(S::PID_POS_NOW, loadBigEndian<int16_t>(data + 6) * 20000);
+				}
+				break;
+			case CAN_PACKET_STATUS_5:
+				if (size >= 8) {
+					status.add<int16_t>(S::V_IN, loadBigEndian<int16_t>(data + 4));
+					status.add<int32_t>(S::TACHOMETER, loadBigEndian<int32_t>(data));
+				}
+				break;
+			default:
+				return;
+		}
+		if (!payload) {
+			size_t status_size;
+			status.finish(&status_size);
+			if (status_size == 5) {
+				return;
+			}
+			status.add<uint8_t>(S::CONTROLLER_ID, node);
+			payload = status.finish(&payload_size);
+		}
+		buildFrame(payload, payload_size, &rx_frame_);
+		handler(rx_frame_.data(), rx_frame_.size(), rx_time);
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,122 @@
+#include "vesc_driver/vesc_capture.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace vesc_driver {
+
+	constexpr char VescCapture::MAGIC[8];
+
+	namespace {
+
+		void putLe(uint8_t *dst, uint64_t value, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				dst[i] = static_cast<uint8_t>(value >> (8 * i));
+			}
+		}
+
+		uint64_t getLe(const uint8_t *src, size_t size) {
+			uint64_t value = 0;
+			for (size_t i = 0; i < size; i++) {
+				value |= static_cast<uint64_t>(src[i]) << (8 * i);
+			}
+			return value;
+		}
+
+		std::runtime_error captureError(const char *what, const std::string &path) {
+			return std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+		}
+
+	}  // namespace
+
+	VescCaptureWriter::VescCaptureWriter(const std::string &path)
+		: file_(std::fopen(path.c_str(), "wb")) {
+		if (!file_) {
+			throw captureError("Failed to create capture file", path);
+		}
+		// a receive chunk is usually a few bytes, let stdio batch them into large writes
+		std::setvbuf(file_, nullptr, _IOFBF, 1 << 16);
+
+		uint8_t header[VescCapture::FILE_HEADER_SIZE];
+		std::memcpy(header, VescCapture::MAGIC, sizeof(VescCapture::MAGIC));
+		putLe(header + 8, std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count(), 8);
+		std::fwrite(header, 1, sizeof(header), file_);
+	}
+
+	VescCaptureWriter::~VescCaptureWriter() {
+		std::fclose(file_);
+	}
+
+	void VescCaptureWriter::write(bool tx, const uint8_t *data, size_t size) {
+		uint8_t header[VescCapture::RECORD_HEADER_SIZE];
+		putLe(header, std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count(), 8);
+		putLe(header + 8, static_cast<uint32_t>(size) | (tx ? VescCapture::TX_FLAG : 0u), 4);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::fwrite(header, 1, sizeof(header), file_);
+		std::fwrite(data, 1, size, file_);
+	}
+
+	VescCaptureReader::VescCaptureReader(const std::string &path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw captureError("Failed to open capture file", path);
+		}
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw captureError("Failed to open capture file", path);
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		if (size_ < VescCapture::FILE_HEADER_SIZE) {
+			::close(fd);
+			throw std::runtime_error("Not a VESC capture file: " + path);
+		}
+		void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			throw captureError("Failed to map capture file", path);
+		}
+		data_ = static_cast<const uint8_t *>(p);
+		// records are read front to back
+		::madvise(p, size_, MADV_SEQUENTIAL);
+
+		if (std::memcmp(data_, VescCapture::MAGIC, sizeof(VescCapture::MAGIC)) != 0) {
+			::munmap(p, size_);
+			throw std::runtime_error("Not a VESC capture file: " + path);
+		}
+		start_time_ = static_cast<int64_t>(getLe(data_ + 8, 8));
+	}
+
+	VescCaptureReader::~VescCaptureReader() {
+		::munmap(const_cast<uint8_t *>(data_), size_);
+	}
+
+	bool VescCaptureReader::next(Record *record) {
+		if (size_ - offset_ < VescCapture::RECORD_HEADER_SIZE) {
+			return false;
+		}
+		const uint8_t *header = data_ + offset_;
+		uint32_t size_field = static_cast<uint32_t>(getLe(header + 8, 4));
+		size_t size = size_field & ~VescCapture::TX_FLAG;
+		if (size_ - offset_ - VescCapture::RECORD_HEADER_SIZE < size) {
+			return false;
+		}
+		record->time_ns = static_cast<int64_t>(getLe(header, 8));
+		record->tx = (size_field & VescCapture::TX_FLAG) != 0;
+		record->data = header + VescCapture::RECORD_HEADER_SIZE;
+		record->size = size;
+		offset_ += VescCapture::RECORD_HEADER_SIZE + size;
+		return true;
+	}
+
+}  // namespace vesc_driver
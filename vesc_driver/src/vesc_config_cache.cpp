@@ -0,0 +1,91 @@
+#include "vesc_driver/vesc_config_cache.hpp"
+#include "vesc_driver/vesc_packet_factory.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+namespace vesc_driver {
+
+	namespace {
+
+		std::runtime_error cacheError(const char *what, const std::string &path) {
+			return std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+		}
+
+	}  // namespace
+
+	VescConfigCache::VescConfigCache(const std::string &directory)
+		: directory_(directory) {
+	}
+
+	std::string VescConfigCache::key(const VescPacketFWVersion &fw_version) {
+		static const char HEX[] = "0123456789abcdef";
+		std::string key;
+		for (int i = 0; i < 12; i++) {
+			key += HEX[fw_version.uuid()[i] >> 4];
+			key += HEX[fw_version.uuid()[i] & 0x0F];
+		}
+		return key + "-" + std::to_string(fw_version.fwMajor()) + "." +
+			   std::to_string(fw_version.fwMinor());
+	}
+
+	std::string VescConfigCache::path(const std::string &key, int payload_id) const {
+		return directory_ + "/" + key + "-" + std::to_string(payload_id) + ".frame";
+	}
+
+	VescPacketPtr VescConfigCache::load(const std::string &key, int payload_id) const {
+		std::FILE *file = std::fopen(path(key, payload_id).c_str(), "rb");
+		if (!file) {
+			return VescPacketPtr();
+		}
+		Buffer frame(VescFrame::VESC_MAX_FRAME_SIZE + 1);
+		const size_t size = std::fread(frame.data(), 1, frame.size(), file);
+		std::fclose(file);
+		if (size > VescFrame::VESC_MAX_FRAME_SIZE) {
+			return VescPacketPtr();
+		}
+		frame.resize(size);
+
+		// the file must hold exactly one valid frame of the expected type
+		int num_bytes_needed = 0;
+		VescPacketPtr packet = VescPacketFactory::createPacket(
+			frame.begin(), frame.end(), &num_bytes_needed, nullptr);
+		if (!packet || packet->frame().size() != size || packet->payloadId() != payload_id) {
+			return VescPacketPtr();
+		}
+		return packet;
+	}
+
+	void VescConfigCache::store(const std::string &key, const VescPacket &packet) const {
+		std::error_code error;
+		std::filesystem::create_directories(directory_, error);
+		if (error) {
+			throw std::runtime_error(
+				"Failed to create the directory " + directory_ + ": " + error.message());
+		}
+
+		// write a temporary file and move it over the old one
+		const std::string file_path = path(key, packet.payloadId());
+		const std::string tmp_path = file_path + ".tmp";
+		std::FILE *file = std::fopen(tmp_path.c_str(), "wb");
+		if (!file) {
+			throw cacheError("Failed to create", tmp_path);
+		}
+		const Buffer &frame = packet.frame();
+		const bool written = std::fwrite(frame.data(), 1, frame.size(), file) == frame.size();
+		if (std::fclose(file) != 0 || !written) {
+			std::remove(tmp_path.c_str());
+			throw cacheError("Failed to write", tmp_path);
+		}
+		if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+			std::remove(tmp_path.c_str());
+			throw cacheError("Failed to replace", file_path);
+		}
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,73 @@
+#include "vesc_driver/vesc_crc.hpp"
+
+#include <array>
+
+namespace vesc_driver {
+
+	namespace {
+
+		constexpr uint16_t CRC_POLYNOMIAL = 0x1021;
+		constexpr int CRC_SLICES = 8;
+
+		typedef std::array<std::array<uint16_t, 256>, CRC_SLICES> CrcTables;
+
+		/**
+		 * tables[0][i] is the CRC of the single byte i, tables[k][i] the CRC of byte i followed by k
+		 * zero bytes. That allows folding k + 1 bytes in a single step.
+		 */
+		constexpr CrcTables makeCrcTables() {
+			CrcTables tables{};
+			for (int i = 0; i < 256; i++) {
+				uint16_t crc = static_cast<uint16_t>(i << 8);
+				for (int bit = 0; bit < 8; bit++) {
+					crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ CRC_POLYNOMIAL : (crc << 1));
+				}
+				tables[0][i] = crc;
+			}
+			for (int k = 1; k < CRC_SLICES; k++) {
+				for (int i = 0; i < 256; i++) {
+					const uint16_t prev = tables[k - 1][i];
+					tables[k][i] = static_cast<uint16_t>((prev << 8) ^ tables[0][prev >> 8]);
+				}
+			}
+			return tables;
+		}
+
+		constexpr CrcTables CRC_TABLES = makeCrcTables();
+
+		/** The standard CRC-16/XMODEM check value, the CRC of "123456789" */
+		constexpr uint16_t crcCheckValue() {
+			const char check[] = "123456789";
+			uint16_t crc = 0;
+			for (int i = 0; i < 9; i++) {
+				crc = static_cast<uint16_t>((crc << 8) ^ CRC_TABLES[0][((crc >> 8) ^ check[i]) & 0xFF]);
+			}
+			return crc;
+		}
+
+		static_assert(crcCheckValue() == 0x31C3, "CRC tables do not match CRC-16/XMODEM");
+
+	}  // namespace
+
+	uint16_t VescCrc::calculate(const uint8_t *data, size_t size, uint16_t crc) {
+		const auto &t = CRC_TABLES;
+
+		// slicing-by-8: the current CRC is folded into the first two bytes of each block
+		while (size >= CRC_SLICES) {
+			crc = static_cast<uint16_t>(
+				t[7][(crc >> 8) ^ data[0]] ^ t[6][(crc & 0xFF) ^ data[1]] ^
+				t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^
+				t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]]);
+			data += CRC_SLICES;
+			size -= CRC_SLICES;
+		}
+
+		// remaining bytes, one at a time
+		while (size-- > 0) {
+			crc = static_cast<uint16_t>((crc << 8) ^ t[0][(crc >> 8) ^ *data++]);
+		}
+
+		return crc;
+	}
+
+}  // namespace vesc_driver
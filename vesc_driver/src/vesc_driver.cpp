@@ -29,16 +29,24 @@
 // -*- mode:c++; fill-column: 100; -*-
 
 #include "vesc_driver/vesc_driver.hpp"
+#include "vesc_driver/vesc_can_port.hpp"
+#include "vesc_driver/vesc_replay_port.hpp"
 
+#include <rclcpp/message_memory_strategy.hpp>
 #include <vesc_msgs/msg/vesc_state.hpp>
 #include <vesc_msgs/msg/vesc_state_stamped.hpp>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace vesc_driver {
 
@@ -47,11 +55,50 @@ namespace vesc_driver {
 	using std_msgs::msg::Float64;
 	using vesc_msgs::msg::VescStateStamped;
 
+	namespace {
+
+		/**
+		 * Takes every message into the same instance once the callback of the previous one has
+		 * released it, so that receiving a command does not allocate in steady state.
+		 */
+		template<typename MessageT>
+		class ReusedMessageStrategy
+			: public rclcpp::message_memory_strategy::MessageMemoryStrategy<MessageT> {
+		public:
+			std::shared_ptr<MessageT> borrow_message() override {
+				if (message_.use_count() != 1) {
+					// the first take, or a callback kept the last message
+					message_ = std::make_shared<MessageT>();
+				}
+				return message_;
+			}
+
+		private:
+			std::shared_ptr<MessageT> message_;
+		};
+
+		/**
+		 * Subscribes a command topic, see ReusedMessageStrategy. The commands are taken from the
+		 * middleware also with intra-process comms enabled for the node: rclcpp allocates for
+		 * every message it delivers intra-process, the middleware copies a command in place.
+		 */
+		template<typename MessageT, typename CallbackT>
+		typename rclcpp::Subscription<MessageT>::SharedPtr createCommandSubscription(
+			rclcpp::Node &node, const std::string &topic, CallbackT &&callback) {
+			rclcpp::SubscriptionOptions options;
+			options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+			return node.create_subscription<MessageT>(
+				topic, rclcpp::QoS{10}, std::forward<CallbackT>(callback), options,
+				std::make_shared<ReusedMessageStrategy<MessageT>>());
+		}
+
+	}  // namespace
+
 	VescDriver::VescDriver(const rclcpp::NodeOptions &options)
 		: rclcpp::Node("vesc_driver", options),
 		  vesc_(
 			  std::string(),
-			  std::bind(&VescDriver::vescPacketCallback, this, _1),
+			  VescInterface::PacketHandlerFunction(),
 			  std::bind(&VescDriver::vescErrorCallback, this, _1)),
 		  duty_cycle_limit_(this, "duty_cycle", -1.0, 1.0),
 		  current_limit_(this, "current"),
@@ -61,9 +108,275 @@ namespace vesc_driver {
 		  servo_limit_(this, "servo", 0.0, 1.0),
 		  driver_mode_(MODE_INITIALIZING),
 		  fw_version_major_(-1),
-		  fw_version_minor_(-1) {
+		  fw_version_minor_(-1),
+		  read_config_(false),
+		  config_state_(CONFIG_UNKNOWN),
+		  can_local_id_(-1),
+		  telemetry_selective_(false),
+		  telemetry_broadcast_(false),
+		  telemetry_fast_mask_(0),
+		  telemetry_slow_mask_(0),
+		  telemetry_pipelined_(false),
+		  telemetry_max_outstanding_(1),
+		  telemetry_outstanding_(0),
+		  telemetry_rtt_pending_(false),
+		  telemetry_stamp_half_rtt_(false) {
+		initialize();
+	}
+
+	VescDriver::VescDriver(
+		const rclcpp::NodeOptions &options, drivers::common::IoContext &io_context, VescExecutor *executor)
+		: rclcpp::Node("vesc_driver", options),
+		  vesc_(
+			  io_context,
+			  executor,
+			  VescInterface::PacketHandlerFunction(),
+			  std::bind(&VescDriver::vescErrorCallback, this, _1)),
+		  duty_cycle_limit_(this, "duty_cycle", -1.0, 1.0),
+		  current_limit_(this, "current"),
+		  brake_limit_(this, "brake"),
+		  speed_limit_(this, "speed"),
+		  position_limit_(this, "position"),
+		  servo_limit_(this, "servo", 0.0, 1.0),
+		  driver_mode_(MODE_INITIALIZING),
+		  fw_version_major_(-1),
+		  fw_version_minor_(-1),
+		  read_config_(false),
+		  config_state_(CONFIG_UNKNOWN),
+		  can_local_id_(-1),
+		  telemetry_selective_(false),
+		  telemetry_broadcast_(false),
+		  telemetry_fast_mask_(0),
+		  telemetry_slow_mask_(0),
+		  telemetry_pipelined_(false),
+		  telemetry_max_outstanding_(1),
+		  telemetry_outstanding_(0),
+		  telemetry_rtt_pending_(false),
+		  telemetry_stamp_half_rtt_(false) {
+		initialize();
+	}
+
+	void VescDriver::initialize() {
 		// get vesc serial port address
 		std::string port = declare_parameter<std::string>("port", "");
+		port_ = port;
+
+		// offline use: with replay set, port names a capture file which is played back instead of
+		// talking to a VESC (replay_speed 1.0 = recorded timing, 0 = as fast as possible)
+		const bool replay = declare_parameter<bool>("replay", false);
+		if (replay) {
+			double replay_speed = declare_parameter<double>("replay_speed", 1.0);
+			vesc_.setPort(std::make_unique<VescReplayPort>(replay_speed, [this]() {
+				RCLCPP_INFO(
+					get_logger(), "Replay of %s finished, %lu bytes received.", port_.c_str(),
+					static_cast<unsigned long>(vesc_.statistics().rx_bytes));
+			}));
+		}
+		// record the raw byte stream of the link, e.g. to replay it later
+		vesc_.setCaptureFile(declare_parameter<std::string>("capture_file", ""));
+
+		// serial port settings, the baud rate is ignored by native USB (CDC) links
+		std::string transport = declare_parameter<std::string>("transport", "uart");
+		if (transport == "usb_cdc") {
+			vesc_.setTransport(VescInterface::TRANSPORT_USB_CDC);
+		} else if (transport == "socketcan") {
+			// port names the CAN interface, the VESC with can_local_id takes the place of the one on
+			// the serial port (a replayed capture holds the frames built by VescCanPort)
+			VescCanPortOptions can_options;
+			can_options.local_id = declare_parameter<int>("can_local_id", 0);
+			can_options.sender_id = declare_parameter<int>("can_sender_id", 254);
+			can_options.hardware_timestamps = declare_parameter<bool>("can_hardware_timestamps", true);
+			try {
+				if (!replay) {
+					vesc_.setPort(std::make_unique<VescCanPort>(can_options));
+				}
+				vesc_.setTransport(VescInterface::TRANSPORT_CAN);
+				can_local_id_ = can_options.local_id;
+			} catch (const std::invalid_argument &e) {
+				RCLCPP_WARN(get_logger(), "Invalid CAN settings, %s, using 'uart'.", e.what());
+			}
+		} else if (transport != "uart") {
+			RCLCPP_WARN(get_logger(), "Unknown transport '%s', using 'uart'.", transport.c_str());
+		}
+		vesc_.setBaudRate(static_cast<uint32_t>(declare_parameter<int>("baud_rate", 115200)));
+		std::string flow_control = declare_parameter<std::string>("flow_control", "none");
+		if (flow_control == "hardware") {
+			vesc_.setFlowControl(VescInterface::FLOW_CONTROL_HARDWARE);
+		} else if (flow_control == "software") {
+			vesc_.setFlowControl(VescInterface::FLOW_CONTROL_SOFTWARE);
+		} else if (flow_control != "none") {
+			RCLCPP_WARN(get_logger(), "Unknown flow_control '%s', using 'none'.", flow_control.c_str());
+		}
+
+		// 0 = parse frames as soon as they arrive, > 0 = poll the receive buffer every N ms
+		vesc_.setPollingPeriod(declare_parameter<int>("rx_poll_period_ms", 0));
+
+		// maximum rate per command kind in Hz, faster commands are coalesced (latest wins), 0 = no limit
+		vesc_.setRateLimit(VescInterface::TX_MOTOR, declare_parameter<double>("tx_rate_limit_motor", 0.0));
+		vesc_.setRateLimit(VescInterface::TX_SERVO, declare_parameter<double>("tx_rate_limit_servo", 0.0));
+		vesc_.setRateLimit(
+			VescInterface::TX_TELEMETRY, declare_parameter<double>("tx_rate_limit_telemetry", 0.0));
+
+		// "full" polls COMM_GET_VALUES, "selective" polls a fast and a slow COMM_GET_VALUES_SELECTIVE
+		// field mask (see VescPacketValuesSelective::Field) and merges the replies, "broadcast" polls
+		// nothing and merges the CAN_PACKET_STATUS broadcasts received by the socketcan transport
+		std::string telemetry_mode = declare_parameter<std::string>("telemetry_mode", "full");
+		telemetry_selective_ = telemetry_mode == "selective";
+		telemetry_broadcast_ = telemetry_mode == "broadcast";
+		if (telemetry_broadcast_ && can_local_id_ < 0) {
+			RCLCPP_WARN(
+				get_logger(), "telemetry_mode 'broadcast' needs the socketcan transport, using 'full'.");
+			telemetry_broadcast_ = false;
+		} else if (!telemetry_selective_ && !telemetry_broadcast_ && telemetry_mode != "full") {
+			RCLCPP_WARN(get_logger(), "Unknown telemetry_mode '%s', using 'full'.", telemetry_mode.c_str());
+		}
+		telemetry_fast_mask_ = static_cast<uint32_t>(declare_parameter<int>(
+			"telemetry_fast_mask",
+			VescPacketValuesSelective::RPM | VescPacketValuesSelective::V_IN |
+			VescPacketValuesSelective::AVG_MOTOR_CURRENT | VescPacketValuesSelective::TACHOMETER)) &
+			VescPacketValuesSelective::ALL_FIELDS;
+		telemetry_slow_mask_ = static_cast<uint32_t>(declare_parameter<int>(
+			"telemetry_slow_mask", VescPacketValuesSelective::ALL_FIELDS)) &
+			VescPacketValuesSelective::ALL_FIELDS & ~telemetry_fast_mask_;
+		telemetry_slow_period_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(declare_parameter<double>("telemetry_slow_period", 1.0)));
+
+		// telemetry_rate is the polling rate of the timer, in pipelined mode the timer only starts the
+		// pipeline and restarts it after telemetry_timeout seconds without a reply
+		double telemetry_rate = declare_parameter<double>("telemetry_rate", 50.0);
+		if (telemetry_rate <= 0.0) {
+			RCLCPP_WARN(get_logger(), "Invalid telemetry_rate %f, using 50 Hz.", telemetry_rate);
+			telemetry_rate = 50.0;
+		}
+		telemetry_pipelined_ = declare_parameter<bool>("telemetry_pipelined", false);
+		telemetry_max_outstanding_ = std::max(1, declare_parameter<int>("telemetry_max_outstanding", 1));
+		telemetry_timeout_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(declare_parameter<double>("telemetry_timeout", 0.1)));
+		// telemetry is stamped with the arrival time of the reply, optionally moved back by half the
+		// request / reply round trip to approximate the time the VESC sampled it
+		telemetry_stamp_half_rtt_ = declare_parameter<bool>("telemetry_stamp_half_rtt", false);
+
+		// sensors/core is published for every sample or at most at core_publish_rate Hz, the statistics
+		// of the samples of every core_summary_period seconds go to sensors/core_summary (0 = off)
+		double core_publish_rate = declare_parameter<double>("core_publish_rate", 0.0);
+		if (core_publish_rate < 0.0) {
+			RCLCPP_WARN(get_logger(), "Invalid core_publish_rate %f, using 0.", core_publish_rate);
+			core_publish_rate = 0.0;
+		}
+		core_publish_period_ = core_publish_rate > 0.0 ?
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(1.0 / core_publish_rate)) :
+			std::chrono::steady_clock::duration::zero();
+		core_summary_period_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(
+				std::max(0.0, declare_parameter<double>("core_summary_period", 1.0))));
+		core_summary_capacity_ = static_cast<size_t>(
+			std::max<int64_t>(1, declare_parameter<int64_t>("core_summary_capacity", 1024)));
+
+		// read the motor configuration to narrow the command limits to what the VESC accepts, cached in
+		// config_cache_dir ("" = $ROS_HOME/vesc_config or ~/.ros/vesc_config, "none" = no cache)
+		read_config_ = declare_parameter<bool>("read_config", false);
+		std::string config_cache_dir = declare_parameter<std::string>("config_cache_dir", "");
+		config_timeout_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(declare_parameter<double>("config_timeout", 2.0)));
+		if (read_config_ && config_cache_dir != "none") {
+			const char *ros_home = std::getenv("ROS_HOME");
+			const char *home = std::getenv("HOME");
+			if (config_cache_dir.empty() && ros_home) {
+				config_cache_dir = std::string(ros_home) + "/vesc_config";
+			} else if (config_cache_dir.empty() && home) {
+				config_cache_dir = std::string(home) + "/.ros/vesc_config";
+			}
+			if (!config_cache_dir.empty()) {
+				config_cache_ = std::make_unique<VescConfigCache>(config_cache_dir);
+			}
+		}
+
+		// stream COMM_SAMPLE_PRINT and COMM_PLOT_DATA to <sample_capture_prefix>_samples.vsmp and
+		// <sample_capture_prefix>_plot_<n>.vsmp, "" = off
+		sample_capture_prefix_ = declare_parameter<std::string>("sample_capture_prefix", "");
+		if (!sample_capture_prefix_.empty()) {
+			sample_sink_ = std::make_unique<VescSampleSink>(10);
+			sample_sink_->open(
+				sample_capture_prefix_ + "_samples.vsmp",
+				{"curr0", "curr1", "ph1", "ph2", "ph3", "vzero", "curr_fir", "f_sw", "status", "phase"});
+			plot_sink_ = std::make_unique<VescSampleSink>(3);
+		}
+
+		// real-time settings of the framer and transmit threads and of the serial I/O threads, only if
+		// they are our own (a shared IoContext and VescExecutor are configured by their owner)
+		bool lock_memory = declare_parameter<bool>("lock_memory", false);
+		ThreadConfig framer_thread = declareThreadConfig(*this, "framer_thread");
+		ThreadConfig io_thread = declareThreadConfig(*this, "io_thread");
+		framer_thread.lock_memory = lock_memory;
+		io_thread.lock_memory = lock_memory;
+		vesc_.setThreadConfig(framer_thread, io_thread);
+
+		// VESCs on the CAN bus behind the one on the port, each gets its own can_<id>/ topics
+		for (int64_t can_id : declare_parameter<std::vector<int64_t>>("can_ids", std::vector<int64_t>())) {
+			try {
+				vesc_.addCanController(static_cast<int>(can_id));
+			} catch (const std::invalid_argument &e) {
+				RCLCPP_WARN(get_logger(), "Ignoring CAN id %ld, %s.", static_cast<long>(can_id), e.what());
+				continue;
+			}
+			CanController controller;
+			controller.can_id = static_cast<int>(can_id);
+			can_controllers_.push_back(controller);
+		}
+		if (!can_controllers_.empty()) {
+			// the replies are told apart by their controller id
+			telemetry_fast_mask_ |= VescPacketValuesSelective::CONTROLLER_ID;
+			telemetry_slow_mask_ |= VescPacketValuesSelective::CONTROLLER_ID;
+		}
+
+		// handle the decoded packets we are interested in
+		vesc_.subscribe<VescPacketValues>(std::bind(&VescDriver::vescValuesCallback, this, _1));
+		vesc_.subscribe<VescPacketValuesSelective>(
+			std::bind(&VescDriver::vescValuesSelectiveCallback, this, _1));
+		vesc_.subscribe<VescPacketFWVersion>(std::bind(&VescDriver::vescFWVersionCallback, this, _1));
+		vesc_.subscribe<VescPacketImuData>(std::bind(&VescDriver::vescImuDataCallback, this, _1));
+		if (sample_sink_) {
+			vesc_.subscribe<VescPacketPlotInit>(std::bind(&VescDriver::vescPlotInitCallback, this, _1));
+			vesc_.subscribe<VescPacketPlotSetGraph>(
+				std::bind(&VescDriver::vescPlotSetGraphCallback, this, _1));
+			vesc_.subscribe<VescPacketPlotData>(std::bind(&VescDriver::vescPlotDataCallback, this, _1));
+			vesc_.subscribe<VescPacketSamplePrint>(
+				std::bind(&VescDriver::vescSamplePrintCallback, this, _1));
+		}
+		if (read_config_) {
+			vesc_.subscribe<VescPacketMcConf>(std::bind(&VescDriver::vescMcConfCallback, this, _1));
+			vesc_.subscribe<VescPacketAppConf>(std::bind(&VescDriver::vescAppConfCallback, this, _1));
+		}
+
+		// create vesc state (telemetry) publishers, the same topics below can_<id>/ for the VESCs
+		// on the CAN bus. All publishers the packet callbacks use exist before connecting: replies,
+		// CAN status broadcasts and replayed captures arrive as soon as the port is open.
+		createTelemetryOutput(telemetry_output_, "");
+		for (auto &controller : can_controllers_) {
+			createTelemetryOutput(controller.telemetry, "can_" + std::to_string(controller.can_id) + "/");
+		}
+
+		// since vesc state does not include the servo position, publish the commanded
+		// servo position as a "sensor". It is published from the command callbacks, like the
+		// commands it bypasses intra-process comms, where every message would be allocated.
+		rclcpp::PublisherOptions servo_sensor_options;
+		servo_sensor_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+		servo_sensor_pub_ = create_publisher<Float64>(
+			"sensors/servo_position_command", rclcpp::QoS{10}, servo_sensor_options);
+
+		// the onboard IMU, polled at imu_rate Hz (0 = not at all)
+		double imu_rate = declare_parameter<double>("imu_rate", 0.0);
+		imu_mask_ = static_cast<uint32_t>(declare_parameter<int>(
+			"imu_mask",
+			VescPacketImuData::ACC | VescPacketImuData::GYRO | VescPacketImuData::QUATERNION)) &
+			VescPacketImuData::ALL_FIELDS;
+		imu_frame_id_ = declare_parameter<std::string>("imu_frame_id", "imu");
+		if (imu_rate < 0.0) {
+			RCLCPP_WARN(get_logger(), "Invalid imu_rate %f, not polling the IMU.", imu_rate);
+		} else if (imu_rate > 0.0 && imu_mask_ != 0) {
+			imu_pub_ = create_publisher<Imu>("sensors/imu", rclcpp::QoS{10});
+		}
 
 		// attempt to connect to the serial port
 		try {
@@ -74,32 +387,91 @@ namespace vesc_driver {
 			return;
 		}
 
-		// create vesc state (telemetry) publisher
-		state_pub_ = create_publisher<VescStateStamped>("sensors/core", rclcpp::QoS{10});
+		// subscribe to motor and servo command topics. From the take to the write queue of
+		// vesc_ the commands do not allocate: the messages are reused, the limits log with a cached
+		// clock and VescInterface encodes into preallocated frames (see
+		// test/test_vesc_command_allocations.cpp).
+		duty_cycle_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/motor/duty_cycle", std::bind(&VescDriver::dutyCycleCallback, this, _1));
+		current_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/motor/current", std::bind(&VescDriver::currentCallback, this, _1));
+		brake_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/motor/brake", std::bind(&VescDriver::brakeCallback, this, _1));
+		speed_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/motor/speed", std::bind(&VescDriver::speedCallback, this, _1));
+		position_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/motor/position", std::bind(&VescDriver::positionCallback, this, _1));
+		servo_sub_ = createCommandSubscription<Float64>(
+			*this, "commands/servo/position", std::bind(&VescDriver::servoCallback, this, _1));
 
-		// since vesc state does not include the servo position, publish the commanded
-		// servo position as a "sensor"
-		servo_sensor_pub_ = create_publisher<Float64>(
-			"sensors/servo_position_command", rclcpp::QoS{10});
-
-		// subscribe to motor and servo command topics
-		duty_cycle_sub_ = create_subscription<Float64>(
-			"commands/motor/duty_cycle", rclcpp::QoS{10}, std::bind(
-				&VescDriver::dutyCycleCallback, this,
-				_1));
-		current_sub_ = create_subscription<Float64>(
-			"commands/motor/current", rclcpp::QoS{10}, std::bind(&VescDriver::currentCallback, this, _1));
-		brake_sub_ = create_subscription<Float64>(
-			"commands/motor/brake", rclcpp::QoS{10}, std::bind(&VescDriver::brakeCallback, this, _1));
-		speed_sub_ = create_subscription<Float64>(
-			"commands/motor/speed", rclcpp::QoS{10}, std::bind(&VescDriver::speedCallback, this, _1));
-		position_sub_ = create_subscription<Float64>(
-			"commands/motor/position", rclcpp::QoS{10}, std::bind(&VescDriver::positionCallback, this, _1));
-		servo_sub_ = create_subscription<Float64>(
-			"commands/servo/position", rclcpp::QoS{10}, std::bind(&VescDriver::servoCallback, this, _1));
-
-		// create a 50Hz timer, used for state machine & polling VESC telemetry
-		timer_ = create_wall_timer(20ms, std::bind(&VescDriver::timerCallback, this));
+		// optionally take ackermann commands directly, saving the hop through the Float64 topics
+		if (declare_parameter<bool>("ackermann_cmd", false)) {
+			speed_to_erpm_gain_ = declare_parameter<double>("speed_to_erpm_gain", 4614.0);
+			speed_to_erpm_offset_ = declare_parameter<double>("speed_to_erpm_offset", 0.0);
+			steering_to_servo_gain_ = declare_parameter<double>("steering_angle_to_servo_gain", -1.2135);
+			steering_to_servo_offset_ = declare_parameter<double>("steering_angle_to_servo_offset", 0.5304);
+			ackermann_sub_ = createCommandSubscription<AckermannDriveStamped>(
+				*this, "ackermann_cmd", std::bind(&VescDriver::ackermannCmdCallback, this, _1));
+		}
+
+		// the same topics below can_<id>/ for the VESCs on the CAN bus
+		for (auto &controller : can_controllers_) {
+			const std::string prefix = "can_" + std::to_string(controller.can_id) + "/";
+			subscribeCanCommand(
+				controller, prefix + "commands/motor/duty_cycle", duty_cycle_limit_,
+				&VescInterface::setDutyCycle);
+			subscribeCanCommand(
+				controller, prefix + "commands/motor/current", current_limit_, &VescInterface::setCurrent);
+			subscribeCanCommand(
+				controller, prefix + "commands/motor/brake", brake_limit_, &VescInterface::setBrake);
+			subscribeCanCommand(
+				controller, prefix + "commands/motor/speed", speed_limit_, &VescInterface::setSpeed);
+			subscribeCanCommand(
+				controller, prefix + "commands/motor/position", position_limit_,
+				&VescInterface::setPosition);
+			subscribeCanCommand(
+				controller, prefix + "commands/servo/position", servo_limit_, &VescInterface::setServo);
+		}
+
+		// link counters and latency histograms (if built with VESC_DRIVER_INSTRUMENTATION)
+		double diagnostics_period = declare_parameter<double>("diagnostics_period", 1.0);
+		if (diagnostics_period > 0.0) {
+			diagnostics_pub_ = create_publisher<DiagnosticArray>("diagnostics", rclcpp::QoS{10});
+			diagnostics_timer_ = create_wall_timer(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::duration<double>(diagnostics_period)),
+				std::bind(&VescDriver::diagnosticsCallback, this));
+		}
+
+		// startup handshake, the first request goes out right away
+		double retry_interval = declare_parameter<double>("fw_version_retry_interval", 0.1);
+		if (retry_interval <= 0.0) {
+			RCLCPP_WARN(get_logger(), "Invalid fw_version_retry_interval %f, using 0.1 s.", retry_interval);
+			retry_interval = 0.1;
+		}
+		handshake_timeout_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(
+				std::max(0.0, declare_parameter<double>("fw_version_timeout", 5.0))));
+		handshake_start_ = std::chrono::steady_clock::now();
+		vesc_.requestFWVersion();
+		handshake_timer_ = create_wall_timer(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::duration<double>(retry_interval)),
+			std::bind(&VescDriver::handshakeCallback, this));
+
+		// create a timer, used for state machine & polling VESC telemetry
+		timer_ = create_wall_timer(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::duration<double>(1.0 / telemetry_rate)),
+			std::bind(&VescDriver::timerCallback, this));
+
+		// poll the onboard IMU
+		if (imu_pub_) {
+			imu_timer_ = create_wall_timer(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::duration<double>(1.0 / imu_rate)),
+				std::bind(&VescDriver::imuTimerCallback, this));
+		}
 	}
 
 /* TODO or TO-THINKABOUT LIST
@@ -112,15 +484,135 @@ namespace vesc_driver {
   - what to do if no servo command received recently?
   - what is the motor safe off state (0 current?)
   - what to do if a command parameter is out of range, ignore?
-  - try to predict vesc bounds (from vesc config) and command detect bounds errors
 */
 
-	bool VescDriver::ensureOperatingMode() {
-		if (driver_mode_ != MODE_OPERATING) {
-			RCLCPP_WARN(get_logger(), "Cannot process callback because the node is not in the operating mode.");
+	ThreadConfig VescDriver::declareThreadConfig(rclcpp::Node &node, const std::string &prefix) {
+		ThreadConfig config;
+		std::string policy = node.declare_parameter<std::string>(prefix + "_policy", "other");
+		if (!parseThreadPolicy(policy, &config.policy)) {
+			RCLCPP_WARN(
+				node.get_logger(), "Unknown %s_policy '%s', using 'other'.", prefix.c_str(), policy.c_str());
+		}
+		config.priority = node.declare_parameter<int>(prefix + "_priority", 0);
+		for (int64_t cpu : node.declare_parameter<std::vector<int64_t>>(
+				prefix + "_cpus", std::vector<int64_t>())) {
+			config.cpus.push_back(static_cast<int>(cpu));
+		}
+		return config;
+	}
+
+	/**
+	 * Locks command_mutex_ into @p lock and returns true while the driver is not operating yet, i.e.
+	 * commands must be kept in the pending slots. Does not lock once the driver is operating.
+	 */
+	bool VescDriver::deferCommands(std::unique_lock<std::mutex> &lock) {
+		if (driver_mode_.load(std::memory_order_acquire) == MODE_OPERATING) {
 			return false;
 		}
-		return true;
+		lock = std::unique_lock<std::mutex>(command_mutex_);
+		return driver_mode_.load(std::memory_order_relaxed) != MODE_OPERATING;
+	}
+
+	/**
+	 * Sends @p value clipped by @p limit and multiplied by @p scale with @p set_command, or keeps it
+	 * until the driver is operating. A pending command is replaced by a newer one of the same kind
+	 * (servo or motor, all motor commands share a slot like in VescInterface).
+	 */
+	void VescDriver::sendCommand(
+		CommandLimit &limit, void (VescInterface::*set_command)(double, int), double value, int can_id,
+		double scale) {
+		std::unique_lock<std::mutex> lock;
+		if (deferCommands(lock)) {
+			PendingCommands &pending = can_id == VescInterface::LOCAL_CONTROLLER ?
+									   pending_commands_ : findCanController(can_id)->pending;
+			PendingCommand &slot = set_command == &VescInterface::setServo ? pending.servo : pending.motor;
+			slot.limit = &limit;
+			slot.set_command = set_command;
+			slot.value = value;
+			slot.scale = scale;
+			return;
+		}
+		(vesc_.*set_command)(limit.clip(value) * scale, can_id);
+	}
+
+	/** Sends and clears the commands in @p pending, command_mutex_ must be held. */
+	void VescDriver::sendPendingCommands(PendingCommands &pending, int can_id) {
+		for (PendingCommand *slot : {&pending.motor, &pending.servo}) {
+			if (slot->limit) {
+				(vesc_.*slot->set_command)(slot->limit->clip(slot->value) * slot->scale, can_id);
+				*slot = PendingCommand();
+			}
+		}
+	}
+
+	/**
+	 * Switches to MODE_OPERATING and sends the commands received so far. Called on the thread that
+	 * completes the handshake: the receive thread on the firmware version reply, or the handshake
+	 * timer once the configuration is known (read_config).
+	 */
+	void VescDriver::enterOperatingMode() {
+		std::lock_guard<std::mutex> lock(command_mutex_);
+		if (driver_mode_.load(std::memory_order_relaxed) == MODE_OPERATING) {
+			return;
+		}
+		// the pending commands go out before any newer one, which waits for the lock until then
+		sendPendingCommands(pending_commands_, VescInterface::LOCAL_CONTROLLER);
+		for (auto &controller : can_controllers_) {
+			sendPendingCommands(controller.pending, controller.can_id);
+		}
+		driver_mode_.store(MODE_OPERATING, std::memory_order_release);
+		RCLCPP_INFO(
+			get_logger(), "Connected to VESC with firmware version %d.%d",
+			fw_version_major_.load(), fw_version_minor_.load());
+	}
+
+	bool VescDriver::isOperating() const {
+		return driver_mode_.load(std::memory_order_acquire) == MODE_OPERATING;
+	}
+
+	/**
+	 * Requests the firmware version every fw_version_retry_interval seconds until the driver is
+	 * operating, gives up after fw_version_timeout seconds.
+	 */
+	void VescDriver::handshakeCallback() {
+		if (driver_mode_.load(std::memory_order_acquire) == MODE_OPERATING) {
+			handshake_timer_->cancel();
+			return;
+		}
+		if (fw_version_major_.load() < 0) {
+			if (handshake_timeout_ != std::chrono::steady_clock::duration::zero() &&
+				std::chrono::steady_clock::now() - handshake_start_ > handshake_timeout_) {
+				RCLCPP_FATAL(
+					get_logger(), "No reply from the VESC within %.1f s.",
+					std::chrono::duration<double>(handshake_timeout_).count());
+				handshake_timer_->cancel();
+				rclcpp::shutdown();
+				return;
+			}
+			vesc_.requestFWVersion();
+		} else if (read_config_ && configReady()) {
+			enterOperatingMode();
+		}
+	}
+
+	void VescDriver::subscribeCanCommand(
+		CanController &controller, const std::string &topic, CommandLimit &limit,
+		void (VescInterface::*set_command)(double, int)) {
+		const int can_id = controller.can_id;
+		controller.command_subs.push_back(
+			createCommandSubscription<Float64>(
+				*this, topic, [this, can_id, &limit, set_command](const Float64::SharedPtr command) {
+					sendCommand(limit, set_command, command->data, can_id);
+				}));
+	}
+
+	VescDriver::CanController *VescDriver::findCanController(int controller_id) {
+		for (auto &controller : can_controllers_) {
+			if (controller.can_id == controller_id) {
+				return &controller;
+			}
+		}
+		return nullptr;
 	}
 
 	void VescDriver::timerCallback() {
@@ -133,68 +625,613 @@ namespace vesc_driver {
 
 		/*
 		 * Driver state machine, modes:
-		 *  INITIALIZING - request and wait for vesc version
+		 *  INITIALIZING - handshakeCallback() requests and waits for vesc version (and configuration,
+		 *                 if read_config), commands are kept until operating
 		 *  OPERATING - receiving commands from subscriber topics
 		 */
 		if (driver_mode_ == MODE_INITIALIZING) {
-			// request version number, return packet will update the internal version numbers
-			vesc_.requestFWVersion();
-			if (fw_version_major_ >= 0 && fw_version_minor_ >= 0) {
-				RCLCPP_INFO(
-					get_logger(), "Connected to VESC with firmware version %d.%d",
-					fw_version_major_, fw_version_minor_);
-				driver_mode_ = MODE_OPERATING;
-			}
+			// nothing to poll yet
 		} else if (driver_mode_ == MODE_OPERATING) {
+			if (read_config_) {
+				// late replies and the revalidation of a cached configuration
+				applyConfig();
+			}
 			// poll for vesc state (telemetry)
-			vesc_.requestState();
+			std::lock_guard<std::mutex> lock(telemetry_mutex_);
+			if (telemetry_broadcast_) {
+				// the VESCs send it on their own
+			} else if (!telemetry_pipelined_) {
+				requestTelemetry();
+			} else {
+				// (re)fill the pipeline, one request per tick so that they do not coalesce
+				if (telemetry_outstanding_ > 0 &&
+					std::chrono::steady_clock::now() - telemetry_last_request_ > telemetry_timeout_) {
+					telemetry_outstanding_ = 0;
+				}
+				if (telemetry_outstanding_ < telemetry_max_outstanding_) {
+					requestTelemetry();
+				}
+			}
 		} else {
 			// unknown mode, how did that happen?
 			assert(false && "unknown driver mode");
 		}
 	}
 
-	void VescDriver::vescPacketCallback(const std::shared_ptr<VescPacket const> &packet) {
-		if (packet->name() == "Values") {
-			std::shared_ptr<VescPacketValues const> values =
-				std::dynamic_pointer_cast<VescPacketValues const>(packet);
+	/** Requests one sample, telemetry_mutex_ must be held. */
+	void VescDriver::requestTelemetry() {
+		auto now = std::chrono::steady_clock::now();
+		const bool slow_due = telemetry_selective_ && telemetry_slow_mask_ != 0 &&
+							  now - telemetry_slow_last_request_ >= telemetry_slow_period_;
+		// the VESC on the port, then those on the CAN bus
+		for (size_t i = 0; i <= can_controllers_.size(); i++) {
+			const int can_id = i == 0 ? VescInterface::LOCAL_CONTROLLER : can_controllers_[i - 1].can_id;
+			if (!telemetry_selective_) {
+				vesc_.requestState(can_id);
+			} else {
+				vesc_.requestStateSelective(telemetry_fast_mask_, VescInterface::TX_TELEMETRY, can_id);
+				if (slow_due) {
+					vesc_.requestStateSelective(
+						telemetry_slow_mask_, VescInterface::TX_TELEMETRY_SLOW, can_id);
+				}
+			}
+		}
+		if (slow_due) {
+			telemetry_slow_last_request_ = now;
+		}
+		telemetry_outstanding_++;
+		telemetry_last_request_ = now;
+		telemetry_rtt_pending_ = true;
+	}
+
+	/**
+	 * Called for every reply of the VESC on the port to requestTelemetry(), keeps the pipeline going.
+	 * The replies of the VESCs on the CAN bus do not count, the pipeline is paced by the local one.
+	 */
+	void VescDriver::telemetryReceived(std::chrono::steady_clock::time_point rx_time) {
+		std::lock_guard<std::mutex> lock(telemetry_mutex_);
+		// a round trip sample, unless the reply may belong to an earlier request
+		if (telemetry_rtt_pending_ && telemetry_outstanding_ <= 1) {
+			auto rtt = rx_time - telemetry_last_request_;
+			if (rtt > std::chrono::steady_clock::duration::zero() && rtt < telemetry_timeout_) {
+				// first order low pass, the samples vary with the position in the VESC's main loop
+				int64_t sample = std::chrono::duration_cast<std::chrono::nanoseconds>(rtt).count() / 2;
+				int64_t half_rtt = telemetry_half_rtt_ns_.load(std::memory_order_relaxed);
+				telemetry_half_rtt_ns_.store(
+					half_rtt == 0 ? sample : half_rtt + (sample - half_rtt) / 8, std::memory_order_relaxed);
+			}
+		}
+		telemetry_rtt_pending_ = false;
+		telemetry_outstanding_ = std::max(0, telemetry_outstanding_ - 1);
+		if (telemetry_pipelined_ && driver_mode_ == MODE_OPERATING &&
+			telemetry_outstanding_ < telemetry_max_outstanding_) {
+			requestTelemetry();
+		}
+	}
+
+	void VescDriver::vescValuesCallback(const VescPacketValues &values) {
+		auto state_msg = VescStateStamped();
+		state_msg.header.stamp = receiveStamp(values);
+
+		state_msg.state.voltage_input = values.v_in();
+		state_msg.state.current_motor = values.avg_motor_current();
+		state_msg.state.current_input = values.avg_input_current();
+		state_msg.state.avg_id = values.avg_id();
+		state_msg.state.avg_iq = values.avg_iq();
+		state_msg.state.duty_cycle = values.duty_cycle_now();
+		state_msg.state.speed = values.rpm();
+
+		state_msg.state.charge_drawn = values.amp_hours();
+		state_msg.state.charge_regen = values.amp_hours_charged();
+		state_msg.state.energy_drawn = values.watt_hours();
+		state_msg.state.energy_regen = values.watt_hours_charged();
+		state_msg.state.displacement = values.tachometer();
+		state_msg.state.distance_traveled = values.tachometer_abs();
+		state_msg.state.fault_code = values.fault_code();
+
+		state_msg.state.pid_pos_now = values.pid_pos_now();
+		state_msg.state.controller_id = values.controller_id();
+
+		state_msg.state.ntc_temp_mos1 = values.temp_mos1();
+		state_msg.state.ntc_temp_mos2 = values.temp_mos2();
+		state_msg.state.ntc_temp_mos3 = values.temp_mos3();
+		state_msg.state.avg_vd = values.avg_vd();
+		state_msg.state.avg_vq = values.avg_vq();
+
+		CanController *controller = findCanController(values.controller_id());
+		if (controller) {
+			publishTelemetry(controller->telemetry, state_msg, values.rx_time());
+		} else {
+			publishTelemetry(telemetry_output_, state_msg, values.rx_time());
+			telemetryReceived(values.rx_time());
+		}
+	}
+
+	void VescDriver::vescValuesSelectiveCallback(const VescPacketValuesSelective &values) {
+		typedef VescPacketValuesSelective V;
+		CanController *controller =
+			values.has(V::CONTROLLER_ID) ? findCanController(values.controller_id()) : nullptr;
+		if (!controller && can_local_id_ >= 0 && values.has(V::CONTROLLER_ID) &&
+			values.controller_id() != can_local_id_) {
+			// a status broadcast of a VESC on the bus that is not in can_ids
+			return;
+		}
+		VescStateStamped &cache = controller ? controller->telemetry_state : telemetry_state_;
+		VescState &state = cache.state;
+
+		// update the fields contained in this reply, the others keep their last value
+		if (values.has(V::TEMP_FET)) {
+			state.temp_fet = values.temp_fet();
+		}
+		if (values.has(V::TEMP_MOTOR)) {
+			state.temp_motor = values.temp_motor();
+		}
+		if (values.has(V::AVG_MOTOR_CURRENT)) {
+			state.current_motor = values.avg_motor_current();
+		}
+		if (values.has(V::AVG_INPUT_CURRENT)) {
+			state.current_input = values.avg_input_current();
+		}
+		if (values.has(V::AVG_ID)) {
+			state.avg_id = values.avg_id();
+		}
+		if (values.has(V::AVG_IQ)) {
+			state.avg_iq = values.avg_iq();
+		}
+		if (values.has(V::DUTY_CYCLE_NOW)) {
+			state.duty_cycle = values.duty_cycle_now();
+		}
+		if (values.has(V::RPM)) {
+			state.speed = values.rpm();
+		}
+		if (values.has(V::V_IN)) {
+			state.voltage_input = values.v_in();
+		}
+		if (values.has(V::AMP_HOURS)) {
+			state.charge_drawn = values.amp_hours();
+		}
+		if (values.has(V::AMP_HOURS_CHARGED)) {
+			state.charge_regen = values.amp_hours_charged();
+		}
+		if (values.has(V::WATT_HOURS)) {
+			state.energy_drawn = values.watt_hours();
+		}
+		if (values.has(V::WATT_HOURS_CHARGED)) {
+			state.energy_regen = values.watt_hours_charged();
+		}
+		if (values.has(V::TACHOMETER)) {
+			state.displacement = values.tachometer();
+		}
+		if (values.has(V::TACHOMETER_ABS)) {
+			state.distance_traveled = values.tachometer_abs();
+		}
+		if (values.has(V::FAULT_CODE)) {
+			state.fault_code = values.fault_code();
+		}
+		if (values.has(V::PID_POS_NOW)) {
+			state.pid_pos_now = values.pid_pos_now();
+		}
+		if (values.has(V::CONTROLLER_ID)) {
+			state.controller_id = values.controller_id();
+		}
+		if (values.has(V::TEMP_MOS)) {
+			state.ntc_temp_mos1 = values.temp_mos1();
+			state.ntc_temp_mos2 = values.temp_mos2();
+			state.ntc_temp_mos3 = values.temp_mos3();
+		}
+		if (values.has(V::AVG_VD)) {
+			state.avg_vd = values.avg_vd();
+		}
+		if (values.has(V::AVG_VQ)) {
+			state.avg_vq = values.avg_vq();
+		}
+
+		// publish at the rate of the fast mask, slow-only replies just refresh the cache (the
+		// CONTROLLER_ID both requests carry for the CAN bus does not make a reply fast)
+		const uint32_t fast_fields = telemetry_fast_mask_ & ~V::CONTROLLER_ID;
+		if ((values.mask() & fast_fields) != 0 || fast_fields == 0) {
+			cache.header.stamp = receiveStamp(values);
+			if (controller) {
+				publishTelemetry(controller->telemetry, cache, values.rx_time());
+			} else {
+				publishTelemetry(telemetry_output_, cache, values.rx_time());
+				// only the replies to the fast request were counted by requestTelemetry(), a slow
+				// one carries fields of the slow mask (which excludes the fast fields)
+				if (!telemetry_broadcast_ &&
+					(values.mask() & telemetry_slow_mask_ & ~V::CONTROLLER_ID) == 0) {
+					telemetryReceived(values.rx_time());
+				}
+			}
+		}
+	}
+
+	/**
+	 * ROS time of the arrival of @p packet at the serial port, i.e. now() moved back by the time the
+	 * packet has spent in the driver since then.
+	 */
+	rclcpp::Time VescDriver::receiveStamp(const VescFrame &packet) {
+		auto age = std::chrono::steady_clock::now() - packet.rx_time();
+		if (telemetry_stamp_half_rtt_) {
+			age += std::chrono::nanoseconds(telemetry_half_rtt_ns_.load(std::memory_order_relaxed));
+		}
+		return now() - rclcpp::Duration(std::chrono::duration_cast<std::chrono::nanoseconds>(age));
+	}
+
+	/**
+	 * Publishes a copy of @p msg without further copies on the way: as a unique_ptr, which
+	 * subscriptions in the same process (intra-process comms) take over, or in a message loaned
+	 * from the middleware if it supports that and there are only subscribers in other processes.
+	 */
+	void VescDriver::publishState(
+		const rclcpp::Publisher<VescStateStamped>::SharedPtr &publisher, const VescStateStamped &msg) {
+		VESC_INSTRUMENT(auto start = LatencyHistogram::Clock::now();)
+		if (publisher->can_loan_messages() && publisher->get_intra_process_subscription_count() == 0) {
+			auto loaned = publisher->borrow_loaned_message();
+			loaned.get() = msg;
+			publisher->publish(std::move(loaned));
+		} else {
+			publisher->publish(std::make_unique<VescStateStamped>(msg));
+		}
+		VESC_INSTRUMENT(publish_latency_.record(start, LatencyHistogram::Clock::now());)
+	}
+
+	void VescDriver::createTelemetryOutput(TelemetryOutput &output, const std::string &prefix) {
+		output.state_pub = create_publisher<VescStateStamped>(prefix + "sensors/core", rclcpp::QoS{10});
+		if (core_summary_period_ > std::chrono::steady_clock::duration::zero()) {
+			output.summary_pub = create_publisher<VescStateSummaryStamped>(
+				prefix + "sensors/core_summary", rclcpp::QoS{10});
+			output.window.emplace(core_summary_capacity_);
+		}
+	}
+
+	/**
+	 * Publishes the telemetry sample @p msg, received at @p rx_time, on sensors/core unless it is
+	 * decimated away, and adds it to the summary window, which is published once it spans
+	 * core_summary_period.
+	 */
+	void VescDriver::publishTelemetry(
+		TelemetryOutput &output, const VescStateStamped &msg,
+		std::chrono::steady_clock::time_point rx_time) {
+		if (rx_time >= output.next_state) {
+			publishState(output.state_pub, msg);
+			// keep the rate if a sample arrives slightly early, restart after a gap
+			output.next_state += core_publish_period_;
+			if (output.next_state <= rx_time) {
+				output.next_state = rx_time + core_publish_period_;
+			}
+		}
+
+		if (!output.window) {
+			return;
+		}
+		const VescState &state = msg.state;
+		output.window->add(
+			{rx_time, state.current_motor, state.current_input, state.voltage_input, state.speed,
+			 state.charge_drawn, state.charge_regen, state.energy_drawn, state.energy_regen});
+		if (rx_time - output.window->start() < core_summary_period_) {
+			return;
+		}
+		const VescTelemetrySummary summary = output.window->close();
+		auto summary_msg = std::make_unique<VescStateSummaryStamped>();
+		summary_msg->header.stamp = msg.header.stamp;
+		VescStateSummary &out = summary_msg->summary;
+		out.duration = std::chrono::duration<double>(summary.duration).count();
+		out.sample_count = static_cast<uint32_t>(summary.sample_count);
+		out.current_motor_min = summary.current_motor.min;
+		out.current_motor_max = summary.current_motor.max;
+		out.current_motor_mean = summary.current_motor.mean;
+		out.current_input_min = summary.current_input.min;
+		out.current_input_max = summary.current_input.max;
+		out.current_input_mean = summary.current_input.mean;
+		out.voltage_input_min = summary.voltage_input.min;
+		out.voltage_input_max = summary.voltage_input.max;
+		out.voltage_input_mean = summary.voltage_input.mean;
+		out.speed_min = summary.speed.min;
+		out.speed_max = summary.speed.max;
+		out.speed_mean = summary.speed.mean;
+		out.charge_drawn = summary.charge_drawn;
+		out.charge_regen = summary.charge_regen;
+		out.energy_drawn = summary.energy_drawn;
+		out.energy_regen = summary.energy_regen;
+		output.summary_pub->publish(std::move(summary_msg));
+	}
+
+	void VescDriver::diagnosticsCallback() {
+		using diagnostic_msgs::msg::DiagnosticStatus;
+		using diagnostic_msgs::msg::KeyValue;
+
+		const VescInterface::Statistics stats = vesc_.statistics();
+		const VescInstrumentation &inst = vesc_.instrumentation();
+
+		DiagnosticStatus status;
+		status.name = std::string(get_name()) + ": VESC link";
+		status.hardware_id = port_;
+		auto add = [&status](const std::string &key, const std::string &value) {
+			KeyValue kv;
+			kv.key = key;
+			kv.value = value;
+			status.values.push_back(kv);
+		};
+		auto add_histogram = [&add](const std::string &key, const LatencyHistogram &histogram) {
+			LatencyHistogram::Snapshot h = histogram.snapshot();
+			add(key + " count", std::to_string(h.count));
+			add(key + " mean [us]", std::to_string(h.mean_us));
+			add(key + " p50 [us]", std::to_string(h.quantileUs(0.5)));
+			add(key + " p99 [us]", std::to_string(h.quantileUs(0.99)));
+			add(key + " max [us]", std::to_string(h.max_us));
+		};
+
+		add("rx bytes", std::to_string(stats.rx_bytes));
+		add("rx overrun bytes", std::to_string(stats.rx_overrun_bytes));
+		add("tx frames", std::to_string(stats.tx_frames));
+		add("tx bytes", std::to_string(stats.tx_bytes));
+		add("tx coalesced", std::to_string(stats.tx_coalesced));
+		add("tx dropped", std::to_string(stats.tx_dropped));
+		add("tx queue depth", std::to_string(stats.tx_queue_depth));
+		if (VescInstrumentation::ENABLED) {
+			add("rx frames", std::to_string(inst.rx_frames.load()));
+			add("rx crc errors", std::to_string(inst.crc_errors.load()));
+			add("rx frame errors", std::to_string(inst.frame_errors.load()));
+			add("rx resync bytes", std::to_string(inst.resync_bytes.load()));
+			add_histogram("framer wake up", inst.wake_up);
+			add_histogram("rx to dispatch", inst.rx_to_dispatch);
+			add_histogram("parse", inst.parse);
+			add_histogram("handler", inst.handler);
+			add_histogram("publish", publish_latency_);
+			add_histogram("command to write", inst.command_to_write);
+			add_histogram("write", inst.write);
+		}
+
+		if (sample_sink_) {
+			add(
+				"sample capture rows",
+				std::to_string(sample_sink_->rowsWritten() + plot_sink_->rowsWritten()));
+			add(
+				"sample capture dropped rows",
+				std::to_string(sample_sink_->rowsDropped() + plot_sink_->rowsDropped()));
+			std::string error = sample_sink_->error();
+			if (error.empty()) {
+				error = plot_sink_->error();
+			}
+			if (!error.empty()) {
+				add("sample capture error", error);
+			}
+		}
+
+		// warn while new receive errors show up
+		const uint64_t errors = stats.rx_overrun_bytes + inst.crc_errors.load() + inst.frame_errors.load();
+		if (errors != reported_errors_) {
+			status.level = DiagnosticStatus::WARN;
+			status.message = "Receive errors";
+		} else {
+			status.level = DiagnosticStatus::OK;
+			status.message = vesc_.isConnected() ? "Connected" : "Disconnected";
+		}
+		reported_errors_ = errors;
+
+		DiagnosticArray msg;
+		msg.header.stamp = now();
+		msg.status.push_back(status);
+		diagnostics_pub_->publish(msg);
+	}
+
+	void VescDriver::imuTimerCallback() {
+		if (driver_mode_ == MODE_OPERATING) {
+			vesc_.requestImuData(imu_mask_);
+		}
+	}
 
-			auto state_msg = VescStateStamped();
-			state_msg.header.stamp = now();
+	/**
+	 * Publishes an IMU sample in the units of sensor_msgs/Imu, the parts not contained in it are
+	 * marked as unknown by a covariance of -1.
+	 */
+	void VescDriver::vescImuDataCallback(const VescPacketImuData &imu) {
+		typedef VescPacketImuData I;
+		if (!imu_pub_) {
+			return;
+		}
+		constexpr double STANDARD_GRAVITY = 9.80665;
+		constexpr double DEG_TO_RAD = M_PI / 180.0;
+		const VescImuData &data = imu.data();
 
-			state_msg.state.voltage_input = values->v_in();
-			state_msg.state.current_motor = values->avg_motor_current();
-			state_msg.state.current_input = values->avg_input_current();
-			state_msg.state.avg_id = values->avg_id();
-			state_msg.state.avg_iq = values->avg_iq();
-			state_msg.state.duty_cycle = values->duty_cycle_now();
-			state_msg.state.speed = values->rpm();
+		auto msg = std::make_unique<Imu>();
+		msg->header.stamp = receiveStamp(imu);
+		msg->header.frame_id = imu_frame_id_;
+		if (imu.has(I::QUATERNION)) {
+			msg->orientation.w = data.q0;
+			msg->orientation.x = data.q1;
+			msg->orientation.y = data.q2;
+			msg->orientation.z = data.q3;
+		} else {
+			msg->orientation_covariance[0] = -1.0;
+		}
+		if (imu.has(I::GYRO)) {
+			msg->angular_velocity.x = data.gyro_x * DEG_TO_RAD;
+			msg->angular_velocity.y = data.gyro_y * DEG_TO_RAD;
+			msg->angular_velocity.z = data.gyro_z * DEG_TO_RAD;
+		} else {
+			msg->angular_velocity_covariance[0] = -1.0;
+		}
+		if (imu.has(I::ACC)) {
+			msg->linear_acceleration.x = data.acc_x * STANDARD_GRAVITY;
+			msg->linear_acceleration.y = data.acc_y * STANDARD_GRAVITY;
+			msg->linear_acceleration.z = data.acc_z * STANDARD_GRAVITY;
+		} else {
+			msg->linear_acceleration_covariance[0] = -1.0;
+		}
+		imu_pub_->publish(std::move(msg));
+	}
 
-			state_msg.state.charge_drawn = values->amp_hours();
-			state_msg.state.charge_regen = values->amp_hours_charged();
-			state_msg.state.energy_drawn = values->watt_hours();
-			state_msg.state.energy_regen = values->watt_hours_charged();
-			state_msg.state.displacement = values->tachometer();
-			state_msg.state.distance_traveled = values->tachometer_abs();
-			state_msg.state.fault_code = values->fault_code();
+	void VescDriver::vescFWVersionCallback(const VescPacketFWVersion &fw_version) {
+		{
+			std::lock_guard<std::mutex> lock(config_mutex_);
+			config_key_ = VescConfigCache::key(fw_version);
+		}
+		// major last, it tells the handshake that the version is known
+		fw_version_minor_ = fw_version.fwMinor();
+		fw_version_major_ = fw_version.fwMajor();
+		if (!read_config_) {
+			// no need to wait for the next timer tick
+			enterOperatingMode();
+		}
+	}
 
-			state_msg.state.pid_pos_now = values->pid_pos_now();
-			state_msg.state.controller_id = values->controller_id();
+	void VescDriver::vescPlotInitCallback(const VescPacketPlotInit &plot_init) {
+		plot_count_++;
+		plot_graph_ = 0.0f;
+		plot_sink_->open(
+			sample_capture_prefix_ + "_plot_" + std::to_string(plot_count_) + ".vsmp",
+			{"graph", plot_init.nameX(), plot_init.nameY()});
+	}
 
-			state_msg.state.ntc_temp_mos1 = values->temp_mos1();
-			state_msg.state.ntc_temp_mos2 = values->temp_mos2();
-			state_msg.state.ntc_temp_mos3 = values->temp_mos3();
-			state_msg.state.avg_vd = values->avg_vd();
-			state_msg.state.avg_vq = values->avg_vq();
+	void VescDriver::vescPlotSetGraphCallback(const VescPacketPlotSetGraph &set_graph) {
+		plot_graph_ = static_cast<float>(set_graph.graph());
+	}
 
-			state_pub_->publish(state_msg);
-		} else if (packet->name() == "FWVersion") {
-			std::shared_ptr<VescPacketFWVersion const> fw_version =
-				std::dynamic_pointer_cast<VescPacketFWVersion const>(packet);
-			// todo: might need lock here
-			fw_version_major_ = fw_version->fwMajor();
-			fw_version_minor_ = fw_version->fwMinor();
+	void VescDriver::vescPlotDataCallback(const VescPacketPlotData &plot_data) {
+		if (plot_count_ == 0) {
+			// joined a plot after its COMM_PLOT_INIT
+			plot_count_++;
+			plot_sink_->open(sample_capture_prefix_ + "_plot_1.vsmp", {"graph", "x", "y"});
 		}
+		const float row[3] = {
+			plot_graph_, static_cast<float>(plot_data.x()), static_cast<float>(plot_data.y())};
+		plot_sink_->append(row);
+	}
+
+	void VescDriver::vescSamplePrintCallback(const VescPacketSamplePrint &sample) {
+		const VescSampleData &s = sample.data();
+		const float row[10] = {
+			static_cast<float>(s.curr0), static_cast<float>(s.curr1), static_cast<float>(s.ph1),
+			static_cast<float>(s.ph2), static_cast<float>(s.ph3), static_cast<float>(s.vzero),
+			static_cast<float>(s.curr_fir), static_cast<float>(s.f_sw), static_cast<float>(s.status),
+			static_cast<float>(s.phase)};
+		sample_sink_->append(row);
+	}
+
+	void VescDriver::vescMcConfCallback(const VescPacketMcConf &mcconf) {
+		// applied by the timer, which runs on the same thread as the command callbacks
+		std::lock_guard<std::mutex> lock(config_mutex_);
+		received_mcconf_.emplace(mcconf);
+	}
+
+	void VescDriver::vescAppConfCallback(const VescPacketAppConf &appconf) {
+		std::lock_guard<std::mutex> lock(config_mutex_);
+		received_appconf_.emplace(appconf);
+	}
+
+	/**
+	 * Starts reading the configuration once the firmware version is known, a cached copy seeds the
+	 * command limits right away. True when the driver may start operating: the limits are seeded or
+	 * config_timeout expired without a reply.
+	 */
+	bool VescDriver::configReady() {
+		const auto now = std::chrono::steady_clock::now();
+		if (config_state_ == CONFIG_UNKNOWN) {
+			std::string key;
+			{
+				std::lock_guard<std::mutex> lock(config_mutex_);
+				key = config_key_;
+			}
+			if (config_cache_) {
+				cached_mcconf_ = config_cache_->load(key, COMM_GET_MCCONF);
+				cached_appconf_ = config_cache_->load(key, COMM_GET_APPCONF);
+			}
+			config_state_ = CONFIG_REQUESTED;
+			if (cached_mcconf_) {
+				RCLCPP_INFO(
+					get_logger(), "Using the cached configuration of VESC %s from %s.", key.c_str(),
+					config_cache_->directory().c_str());
+				applyMcConf(static_cast<const VescPacketMcConf &>(*cached_mcconf_));
+				config_state_ = CONFIG_CACHED;
+			}
+			// with a cached copy this is the revalidation, nobody waits for the replies
+			vesc_.send(VescPacketRequestMcConf());
+			vesc_.send(VescPacketRequestAppConf());
+			config_request_time_ = now;
+		}
+
+		applyConfig();
+		if (config_state_ != CONFIG_REQUESTED) {
+			return true;
+		}
+		if (now - config_request_time_ > config_timeout_) {
+			RCLCPP_WARN(
+				get_logger(), "No configuration received from the VESC, using the configured command limits.");
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Applies the configuration packets received since the last call. Packets that differ from the
+	 * cached ones replace them in the cache.
+	 */
+	void VescDriver::applyConfig() {
+		std::optional<VescPacketMcConf> mcconf;
+		std::optional<VescPacketAppConf> appconf;
+		std::string key;
+		{
+			std::lock_guard<std::mutex> lock(config_mutex_);
+			mcconf.swap(received_mcconf_);
+			appconf.swap(received_appconf_);
+			key = config_key_;
+		}
+
+		auto store = [this, &key](const VescPacket &packet) {
+			if (!config_cache_) {
+				return;
+			}
+			try {
+				config_cache_->store(key, packet);
+			} catch (const std::runtime_error &e) {
+				RCLCPP_WARN(get_logger(), "Failed to cache the VESC configuration, %s.", e.what());
+			}
+		};
+
+		if (mcconf) {
+			if (!cached_mcconf_ || cached_mcconf_->frame() != mcconf->frame()) {
+				if (config_state_ == CONFIG_CACHED) {
+					RCLCPP_INFO(get_logger(), "The motor configuration of the VESC changed, updating the cache.");
+				}
+				cached_mcconf_ = std::make_shared<VescPacketMcConf>(*mcconf);
+				store(*cached_mcconf_);
+				applyMcConf(*mcconf);
+			}
+			config_state_ = CONFIG_READ;
+		}
+
+		if (appconf && (!cached_appconf_ || cached_appconf_->frame() != appconf->frame())) {
+			cached_appconf_ = std::make_shared<VescPacketAppConf>(*appconf);
+			store(*cached_appconf_);
+			if (appconf->complete()) {
+				RCLCPP_INFO(
+					get_logger(), "VESC controller id %d, commands time out after %u ms.",
+					appconf->data().controller_id, static_cast<unsigned>(appconf->data().timeout_msec));
+			}
+		}
+	}
+
+	/** Narrows the command limits to the limits of the motor configuration @p mcconf. */
+	void VescDriver::applyMcConf(const VescPacketMcConf &mcconf) {
+		const VescMcConfData &conf = mcconf.data();
+		// only a plausible prefix is used, a firmware with a different layout must not set limits
+		if (!mcconf.complete() || !(conf.current_max > 0.0) || !(conf.current_min < 0.0) ||
+			!(conf.max_erpm > 0.0) || !(conf.min_erpm < 0.0) ||
+			!(conf.max_duty > 0.0 && conf.max_duty <= 1.0)) {
+			RCLCPP_WARN(
+				get_logger(), "Ignoring the motor configuration of the VESC, unexpected layout (firmware %d.%d).",
+				fw_version_major_.load(), fw_version_minor_.load());
+			return;
+		}
+
+		current_limit_.setFeasibleRange(conf.current_min, conf.current_max);
+		brake_limit_.setFeasibleRange(std::optional<double>(), -conf.current_min);
+		speed_limit_.setFeasibleRange(conf.min_erpm, conf.max_erpm);
+		duty_cycle_limit_.setFeasibleRange(-conf.max_duty, conf.max_duty);
+		RCLCPP_INFO(
+			get_logger(), "VESC limits: current %.1f to %.1f A, speed %.0f to %.0f ERPM, duty cycle %.2f.",
+			conf.current_min, conf.current_max, conf.min_erpm, conf.max_erpm, conf.max_duty);
 	}
 
 	void VescDriver::vescErrorCallback(const std::string &error) {
@@ -207,9 +1244,7 @@ namespace vesc_driver {
  *                   on its configuration, e.g. absolute value is between 0.05 and 0.95.
  */
 	void VescDriver::dutyCycleCallback(const Float64::SharedPtr duty_cycle) {
-		if (ensureOperatingMode()) {
-			vesc_.setDutyCycle(duty_cycle_limit_.clip(duty_cycle->data));
-		}
+		sendCommand(duty_cycle_limit_, &VescInterface::setDutyCycle, duty_cycle->data);
 	}
 
 /**
@@ -218,9 +1253,7 @@ namespace vesc_driver {
  *                its configuration.
  */
 	void VescDriver::currentCallback(const Float64::SharedPtr current) {
-		if (ensureOperatingMode()) {
-			vesc_.setCurrent(current_limit_.clip(current->data));
-		}
+		sendCommand(current_limit_, &VescInterface::setCurrent, current->data);
 	}
 
 /**
@@ -229,9 +1262,7 @@ namespace vesc_driver {
  *              depending on its configuration.
  */
 	void VescDriver::brakeCallback(const Float64::SharedPtr brake) {
-		if (ensureOperatingMode()) {
-			vesc_.setBrake(brake_limit_.clip(brake->data));
-		}
+		sendCommand(brake_limit_, &VescInterface::setBrake, brake->data);
 	}
 
 /**
@@ -241,9 +1272,7 @@ namespace vesc_driver {
  *              range depending on its configuration.
  */
 	void VescDriver::speedCallback(const Float64::SharedPtr speed) {
-		if (ensureOperatingMode()) {
-			vesc_.setSpeed(speed_limit_.clip(speed->data));
-		}
+		sendCommand(speed_limit_, &VescInterface::setSpeed, speed->data);
 	}
 
 /**
@@ -251,25 +1280,46 @@ namespace vesc_driver {
  *                 Note that the VESC must be in encoder mode for this command to have an effect.
  */
 	void VescDriver::positionCallback(const Float64::SharedPtr position) {
-		if (ensureOperatingMode()) {
-			// ROS uses radians but VESC seems to use degrees. Convert to degrees.
-			double position_deg = position_limit_.clip(position->data) * 180.0 / M_PI;
-			vesc_.setPosition(position_deg);
-		}
+		// ROS uses radians but VESC seems to use degrees. Convert to degrees.
+		sendCommand(
+			position_limit_, &VescInterface::setPosition, position->data,
+			VescInterface::LOCAL_CONTROLLER, 180.0 / M_PI);
 	}
 
 /**
  * @param servo Commanded VESC servo output position. Valid range is 0 to 1.
  */
 	void VescDriver::servoCallback(const Float64::SharedPtr servo) {
-		if (ensureOperatingMode()) {
-			double servo_clipped(servo_limit_.clip(servo->data));
-			vesc_.setServo(servo_clipped);
-			// publish clipped servo value as a "sensor"
-			auto servo_sensor_msg = Float64();
-			servo_sensor_msg.data = servo_clipped;
-			servo_sensor_pub_->publish(servo_sensor_msg);
+		double servo_clipped(servo_limit_.clip(servo->data));
+		sendCommand(servo_limit_, &VescInterface::setServo, servo_clipped);
+		// publish clipped servo value as a "sensor", from the stack: without intra-process
+		// comms (see servo_sensor_pub_) publishing by reference does not allocate
+		Float64 servo_sensor_msg;
+		servo_sensor_msg.data = servo_clipped;
+		servo_sensor_pub_->publish(servo_sensor_msg);
+	}
+
+/**
+ * @param cmd Commanded speed (m/s) and steering angle (rad), converted to electrical RPM and servo
+ *            position with the same gains as vesc_ackermann::AckermannToVesc, then clipped to the
+ *            speed and servo limits. Both are sent in one write.
+ */
+	void VescDriver::ackermannCmdCallback(const AckermannDriveStamped::ConstSharedPtr cmd) {
+		double erpm = speed_limit_.clip(speed_to_erpm_gain_ * cmd->drive.speed + speed_to_erpm_offset_);
+		double servo = servo_limit_.clip(
+			steering_to_servo_gain_ * cmd->drive.steering_angle + steering_to_servo_offset_);
+		std::unique_lock<std::mutex> lock;
+		if (deferCommands(lock)) {
+			// sent as two frames once operating
+			pending_commands_.motor = PendingCommand{&speed_limit_, &VescInterface::setSpeed, erpm, 1.0};
+			pending_commands_.servo = PendingCommand{&servo_limit_, &VescInterface::setServo, servo, 1.0};
+		} else {
+			vesc_.setSpeedAndServo(erpm, servo);
 		}
+		// publish clipped servo value as a "sensor", see servoCallback()
+		Float64 servo_sensor_msg;
+		servo_sensor_msg.data = servo;
+		servo_sensor_pub_->publish(servo_sensor_msg);
 	}
 
 	VescDriver::CommandLimit::CommandLimit(
@@ -279,6 +1329,7 @@ namespace vesc_driver {
 		const std::optional<double> &max_upper)
 		: node_ptr(node_ptr),
 		  logger(node_ptr->get_logger()),
+		  clock(node_ptr->get_clock()),
 		  name(str) {
 		// check if user's minimum value is outside of the range min_lower to max_upper
 		auto param_min =
@@ -350,20 +1401,41 @@ namespace vesc_driver {
 		}
 
 		RCLCPP_DEBUG_STREAM(logger, oss.str());
+
+		configured_lower = lower;
+		configured_upper = upper;
 	}
 
-	double VescDriver::CommandLimit::clip(double value) {
-		auto clock = rclcpp::Clock(RCL_ROS_TIME);
+	void VescDriver::CommandLimit::setFeasibleRange(
+		const std::optional<double> &feasible_lower, const std::optional<double> &feasible_upper) {
+		auto clamp = [&feasible_lower, &feasible_upper](
+			const std::optional<double> &value, const std::optional<double> &fallback) {
+			if (!value) {
+				return fallback;
+			}
+			double clamped = *value;
+			if (feasible_lower && clamped < *feasible_lower) {
+				clamped = *feasible_lower;
+			}
+			if (feasible_upper && clamped > *feasible_upper) {
+				clamped = *feasible_upper;
+			}
+			return std::optional<double>(clamped);
+		};
+		lower = clamp(configured_lower, feasible_lower);
+		upper = clamp(configured_upper, feasible_upper);
+	}
 
+	double VescDriver::CommandLimit::clip(double value) {
 		if (lower && value < lower) {
 			RCLCPP_INFO_THROTTLE(
-				logger, clock, 10, "%s command value (%f) below minimum limit (%f), clipping.",
+				logger, *clock, 10, "%s command value (%f) below minimum limit (%f), clipping.",
 				name.c_str(), value, *lower);
 			return *lower;
 		}
 		if (upper && value > upper) {
 			RCLCPP_INFO_THROTTLE(
-				logger, clock, 10, "%s command value (%f) above maximum limit (%f), clipping.",
+				logger, *clock, 10, "%s command value (%f) above maximum limit (%f), clipping.",
 				name.c_str(), value, *upper);
 			return *upper;
 		}
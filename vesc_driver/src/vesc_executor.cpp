@@ -0,0 +1,133 @@
+#include "vesc_driver/vesc_executor.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+namespace vesc_driver {
+
+	VescExecutor::VescExecutor(size_t thread_count) {
+		for (size_t i = 0; i < std::max<size_t>(thread_count, 1); i++) {
+			workers_.emplace_back(new Worker());
+		}
+		for (auto &worker : workers_) {
+			worker->thread = std::thread(&VescExecutor::run, this, std::ref(*worker));
+		}
+	}
+
+	VescExecutor::~VescExecutor() {
+		for (auto &worker : workers_) {
+			{
+				std::lock_guard<std::mutex> lock(worker->mutex);
+				worker->run = false;
+			}
+			worker->cv.notify_all();
+			worker->thread.join();
+		}
+	}
+
+	void VescExecutor::attach(Link &link) {
+		// pick the least loaded thread
+		size_t best = 0;
+		size_t best_count = SIZE_MAX;
+		for (size_t i = 0; i < workers_.size(); i++) {
+			std::lock_guard<std::mutex> lock(workers_[i]->mutex);
+			if (workers_[i]->links.size() < best_count) {
+				best = i;
+				best_count = workers_[i]->links.size();
+			}
+		}
+
+		Worker &worker = *workers_[best];
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			link.worker_.store(best);
+			worker.links.push_back(&link);
+			worker.pending = true;
+		}
+		worker.cv.notify_one();
+	}
+
+	void VescExecutor::detach(Link &link) {
+		Worker &worker = *workers_[link.worker_];
+		std::unique_lock<std::mutex> lock(worker.mutex);
+		worker.links.erase(std::remove(worker.links.begin(), worker.links.end(), &link), worker.links.end());
+		// the current pass may still use the link
+		worker.idle_cv.wait(lock, [&worker]() { return !worker.servicing; });
+	}
+
+	void VescExecutor::wakeUp(const Link &link) {
+		Worker &worker = *workers_[link.worker_];
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			worker.pending = true;
+		}
+		worker.cv.notify_one();
+	}
+
+	void VescExecutor::applyThreadConfig(const ThreadConfig &config) {
+		for (auto &worker : workers_) {
+			std::string error;
+			std::unique_lock<std::mutex> lock(worker->mutex);
+			worker->task = [&config, &error]() {
+				try {
+					vesc_driver::applyThreadConfig(config);
+				} catch (const std::runtime_error &e) {
+					error = e.what();
+				}
+			};
+			worker->cv.notify_one();
+			worker->idle_cv.wait(lock, [&worker]() { return !worker->task; });
+			if (!error.empty()) {
+				throw std::runtime_error(error);
+			}
+		}
+	}
+
+	void VescExecutor::run(Worker &worker) {
+		std::vector<Link *> links;
+		Clock::time_point wake_up = Clock::time_point::max();
+		std::unique_lock<std::mutex> lock(worker.mutex);
+
+		while (worker.run) {
+			auto ready = [&worker]() { return worker.pending || worker.task || !worker.run; };
+			if (wake_up == Clock::time_point::max()) {
+				worker.cv.wait(lock, ready);
+			} else {
+				worker.cv.wait_until(lock, wake_up, ready);
+			}
+			if (!worker.run) {
+				break;
+			}
+			if (worker.task) {
+				lock.unlock();
+				worker.task();
+				lock.lock();
+				worker.task = nullptr;
+				worker.idle_cv.notify_all();
+				if (!worker.pending) {
+					continue;
+				}
+			}
+
+			// service the links without holding the mutex, so wakeUp() never waits for a pass
+			worker.pending = false;
+			worker.servicing = true;
+			links = worker.links;
+			lock.unlock();
+
+			Clock::time_point now = Clock::now();
+			wake_up = Clock::time_point::max();
+			for (Link *link : links) {
+				link->service(now, &wake_up);
+			}
+
+			lock.lock();
+			worker.servicing = false;
+			worker.idle_cv.notify_all();
+		}
+	}
+
+}  // namespace vesc_driver
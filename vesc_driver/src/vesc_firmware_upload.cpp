@@ -0,0 +1,245 @@
+#include "vesc_driver/vesc_firmware_upload.hpp"
+#include "vesc_driver/vesc_crc.hpp"
+#include "vesc_driver/vesc_schema.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#ifdef VESC_DRIVER_HAVE_LZO
+#include <lzo/lzo1x.h>
+#endif
+
+namespace vesc_driver {
+
+	VescChunkCompressor lzoCompressor() {
+#ifdef VESC_DRIVER_HAVE_LZO
+		static const bool initialized = lzo_init() == LZO_E_OK;
+		if (!initialized) {
+			return VescChunkCompressor();
+		}
+		auto work = std::make_shared<std::vector<lzo_align_t>>(
+			(LZO1X_1_MEM_COMPRESS + sizeof(lzo_align_t) - 1) / sizeof(lzo_align_t));
+		return [work](const uint8_t *data, size_t size, Buffer *compressed) {
+			// worst case expansion of LZO1X
+			compressed->resize(size + size / 16 + 64 + 3);
+			lzo_uint compressed_size = 0;
+			if (lzo1x_1_compress(data, size, compressed->data(), &compressed_size, work->data()) !=
+				LZO_E_OK) {
+				return false;
+			}
+			compressed->resize(compressed_size);
+			return true;
+		};
+#else
+		return VescChunkCompressor();
+#endif
+	}
+
+	VescFirmwareUpload::VescFirmwareUpload(
+		const Buffer &image, const VescFirmwareUploadOptions &options, SendFunction send)
+		: options_(options), send_(std::move(send)), bytes_sent_(0), acked_bytes_(0),
+		  erase_pending_(false), erase_replied_(false), erase_ok_(false), events_(0) {
+		if (image.empty()) {
+			throw std::invalid_argument("Empty firmware image");
+		}
+		if (options_.can_id < -1 || options_.can_id > 255) {
+			throw std::invalid_argument("CAN id out of range");
+		}
+		if (options_.all_can && options_.can_id >= 0) {
+			throw std::invalid_argument("all_can goes through the VESC on the port, not a CAN id");
+		}
+		if (options_.window == 0) {
+			throw std::invalid_argument("The window must allow at least one write");
+		}
+		const size_t max_chunk_size = VescFrame::VESC_MAX_PAYLOAD_SIZE -
+			VescPacketWriteNewAppData::headerSize(false, options_.can_id);
+		const size_t chunk_size = options_.chunk_size > 0 ? options_.chunk_size : max_chunk_size;
+		if (chunk_size > max_chunk_size) {
+			throw std::invalid_argument(
+				"Chunk size " + std::to_string(chunk_size) + " does not fit in a frame, at most " +
+				std::to_string(max_chunk_size));
+		}
+
+		// the bootloader expects the image preceded by its size and CRC
+		Buffer data(6);
+		schema::storeBigEndian<uint32_t>(data.data(), static_cast<uint32_t>(image.size()));
+		schema::storeBigEndian<uint16_t>(
+			data.data() + 4, VescCrc::calculate(image.data(), image.size()));
+		data.insert(data.end(), image.begin(), image.end());
+		total_ = data.size();
+
+		// all requests are built (and compressed) up front, not while the window is open
+		const size_t max_compressed_size = VescFrame::VESC_MAX_PAYLOAD_SIZE -
+			VescPacketWriteNewAppData::headerSize(true, options_.can_id);
+		Buffer compressed;
+		for (size_t offset = 0; offset < total_; offset += chunk_size) {
+			Chunk chunk;
+			chunk.offset = static_cast<uint32_t>(offset);
+			chunk.size = static_cast<uint32_t>(std::min(chunk_size, total_ - offset));
+			const uint8_t *chunk_data = data.data() + offset;
+			if (options_.compressor && options_.compressor(chunk_data, chunk.size, &compressed) &&
+				compressed.size() + 2 < chunk.size && compressed.size() <= max_compressed_size) {
+				chunk.packet = std::make_unique<VescPacketWriteNewAppData>(
+					chunk.offset, compressed.data(), compressed.size(), chunk.size, options_.all_can,
+					options_.can_id);
+			} else {
+				chunk.packet = std::make_unique<VescPacketWriteNewAppData>(
+					chunk.offset, chunk_data, chunk.size, 0, options_.all_can, options_.can_id);
+			}
+			chunks_.push_back(std::move(chunk));
+		}
+	}
+
+	void VescFirmwareUpload::run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		erase(lock);
+		write(lock);
+		lock.unlock();
+
+		if (options_.jump_to_bootloader) {
+			VescPacketJumpToBootloader jump(options_.all_can, options_.can_id);
+			const Clock::time_point deadline = Clock::now() + options_.write_timeout;
+			while (!send_(jump)) {
+				if (Clock::now() >= deadline) {
+					throw std::runtime_error("Failed to send the request to start the bootloader");
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	void VescFirmwareUpload::erase(std::unique_lock<std::mutex> &lock) {
+		erase_pending_ = true;
+		VescPacketEraseNewApp request(static_cast<uint32_t>(total_), options_.all_can, options_.can_id);
+		const Clock::time_point deadline = Clock::now() + options_.erase_timeout;
+		while (!send_(request)) {
+			if (Clock::now() >= deadline) {
+				erase_pending_ = false;
+				throw std::runtime_error("Failed to send the erase request");
+			}
+			cv_.wait_for(lock, std::chrono::milliseconds(1));
+		}
+		cv_.wait_until(lock, deadline, [this]() { return erase_replied_; });
+		erase_pending_ = false;
+		if (!erase_replied_) {
+			throw std::runtime_error(
+				"No reply to the erase request within " +
+				std::to_string(options_.erase_timeout.count()) + " ms");
+		}
+		if (!erase_ok_) {
+			throw std::runtime_error("The VESC failed to erase the flash for the new firmware");
+		}
+	}
+
+	void VescFirmwareUpload::write(std::unique_lock<std::mutex> &lock) {
+		size_t next = 0;
+		size_t reported = SIZE_MAX;
+		while (true) {
+			if (!error_.empty()) {
+				throw std::runtime_error(error_);
+			}
+			if (acked_bytes_ != reported) {
+				reported = acked_bytes_;
+				reportProgress(lock);
+				continue;
+			}
+			if (in_flight_.empty() && next == chunks_.size()) {
+				break;
+			}
+
+			// open the window, then send the writes without a reply again
+			const Clock::time_point now = Clock::now();
+			bool queue_full = false;
+			while (in_flight_.size() < options_.window && next < chunks_.size()) {
+				if (!sendChunk(chunks_[next], now)) {
+					queue_full = true;
+					break;
+				}
+				in_flight_.push_back(next++);
+			}
+			Clock::time_point wake_up = now + options_.write_timeout;
+			for (size_t index : in_flight_) {
+				Chunk &chunk = chunks_[index];
+				if (now - chunk.sent >= options_.write_timeout && !queue_full) {
+					if (chunk.attempts > options_.write_retries) {
+						throw std::runtime_error(
+							"No reply to the write at offset " + std::to_string(chunk.offset));
+					}
+					queue_full = !sendChunk(chunk, now);
+				}
+				wake_up = std::min(wake_up, chunk.sent + options_.write_timeout);
+			}
+			if (queue_full) {
+				wake_up = std::min(wake_up, now + std::chrono::milliseconds(1));
+			}
+
+			const uint64_t events = events_;
+			cv_.wait_until(lock, wake_up, [this, events]() { return events_ != events; });
+		}
+	}
+
+	bool VescFirmwareUpload::sendChunk(Chunk &chunk, Clock::time_point now) {
+		if (!send_(*chunk.packet)) {
+			return false;
+		}
+		chunk.sent = now;
+		chunk.attempts++;
+		bytes_sent_ += chunk.packet->frame().size();
+		return true;
+	}
+
+	void VescFirmwareUpload::reportProgress(std::unique_lock<std::mutex> &lock) {
+		if (!options_.progress) {
+			return;
+		}
+		const size_t written = acked_bytes_;
+		lock.unlock();
+		options_.progress(written, total_);
+		lock.lock();
+	}
+
+	void VescFirmwareUpload::handlePacket(const VescPacket &packet) {
+		if (auto erased = dynamic_cast<const VescPacketEraseNewAppResult *>(&packet)) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (erase_pending_) {
+				erase_replied_ = true;
+				erase_ok_ = erased->ok();
+			}
+		} else if (auto written = dynamic_cast<const VescPacketWriteNewAppDataResult *>(&packet)) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			// the VESC handles the writes in order, a reply without offset is for the oldest one
+			auto it = in_flight_.begin();
+			if (written->hasOffset()) {
+				it = std::find_if(in_flight_.begin(), in_flight_.end(), [this, written](size_t index) {
+					return chunks_[index].offset == written->offset();
+				});
+			}
+			if (it == in_flight_.end()) {
+				// e.g. a late reply to a write that was sent again
+				return;
+			}
+			Chunk &chunk = chunks_[*it];
+			if (!written->ok()) {
+				error_ = "The VESC failed to write " + std::to_string(chunk.size) + " bytes at offset " +
+					std::to_string(chunk.offset);
+			} else {
+				chunk.acked = true;
+				chunk.packet.reset();
+				acked_bytes_ += chunk.size;
+				in_flight_.erase(it);
+			}
+			events_++;
+		} else {
+			return;
+		}
+		cv_.notify_all();
+	}
+
+	size_t VescFirmwareUpload::bytesSent() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return bytes_sent_;
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,99 @@
+#include "vesc_driver/vesc_frame_pool.hpp"
+
+#include <cassert>
+#include <functional>
+
+namespace vesc_driver {
+
+	FixedBlockPool::FixedBlockPool(size_t block_size, size_t block_count)
+		: block_count_(block_count) {
+		// keep every block suitably aligned for any type
+		const size_t alignment = alignof(std::max_align_t);
+		block_size_ = (block_size + alignment - 1) / alignment * alignment;
+		storage_.reset(new unsigned char[block_size_ * block_count_ + alignment]);
+
+		unsigned char *base = storage_.get();
+		const size_t misalignment = reinterpret_cast<uintptr_t>(base) % alignment;
+		if (misalignment != 0) {
+			base += alignment - misalignment;
+		}
+
+		free_.reserve(block_count_);
+		for (size_t i = block_count_; i > 0; i--) {
+			free_.push_back(base + (i - 1) * block_size_);
+		}
+	}
+
+	void *FixedBlockPool::allocate() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (free_.empty()) {
+			return nullptr;
+		}
+		void *block = free_.back();
+		free_.pop_back();
+		return block;
+	}
+
+	void FixedBlockPool::deallocate(void *block) {
+		assert(owns(block));
+		std::lock_guard<std::mutex> lock(mutex_);
+		// capacity was reserved for all blocks, this never reallocates
+		free_.push_back(block);
+	}
+
+	bool FixedBlockPool::owns(const void *block) const {
+		std::less<const void *> less;
+		const unsigned char *begin = storage_.get();
+		const unsigned char *end = begin + block_size_ * block_count_ + alignof(std::max_align_t);
+		return !less(block, begin) && less(block, end);
+	}
+
+	/*------------------------------------------------------------------------------------------------*/
+
+	VescFramePool &VescFramePool::instance() {
+		static VescFramePool pool;
+		return pool;
+	}
+
+	VescFramePool::VescFramePool()
+		: slots_(SLOT_COUNT) {
+		free_.reserve(SLOT_COUNT);
+		for (auto &slot : slots_) {
+			slot.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+			free_.push_back(&slot);
+		}
+	}
+
+	std::shared_ptr<Buffer> VescFramePool::acquire(size_t size) {
+		assert(size <= static_cast<size_t>(VescFrame::VESC_MAX_FRAME_SIZE));
+
+		Buffer *slot = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!free_.empty()) {
+				slot = free_.back();
+				free_.pop_back();
+			}
+		}
+
+		if (!slot) {
+			// every slot is still referenced by a packet, do not fail, just allocate
+			return std::make_shared<Buffer>(size);
+		}
+
+		// capacity was reserved up front, so resizing does not allocate
+		slot->resize(size);
+		return std::shared_ptr<Buffer>(slot, Recycler{this}, PoolAllocator<Buffer>());
+	}
+
+	size_t VescFramePool::inUse() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return SLOT_COUNT - free_.size();
+	}
+
+	void VescFramePool::release(Buffer *slot) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		free_.push_back(slot);
+	}
+
+}  // namespace vesc_driver
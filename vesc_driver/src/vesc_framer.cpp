@@ -0,0 +1,141 @@
+#include "vesc_driver/vesc_framer.hpp"
+#include "vesc_driver/vesc_packet_factory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+namespace vesc_driver {
+
+	namespace {
+
+		static_assert(
+			VescFrame::VESC_SOF_VAL_SMALL_FRAME == 2 && VescFrame::VESC_SOF_VAL_LARGE_FRAME == 3,
+			"findStartOfFrame() assumes the frame starts 2 and 3");
+
+		/**
+		 * Index of the first start-of-frame byte in @p size bytes at @p data, @p size if there is none.
+		 * 2 and 3 only differ in the lowest bit, so a byte starts a frame if (byte | 1) == 3, which is
+		 * tested for 8 bytes at a time with the usual has-a-zero-byte trick.
+		 */
+		size_t findStartOfFrame(const uint8_t *data, size_t size) {
+			constexpr uint64_t ONES = 0x0101010101010101ULL;
+			constexpr uint64_t HIGH_BITS = 0x8080808080808080ULL;
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				uint64_t word;
+				std::memcpy(&word, data + i, sizeof(word));
+				const uint64_t x = (word | ONES) ^ (3 * ONES);
+				if (((x - ONES) & ~x & HIGH_BITS) != 0) {
+					break;
+				}
+			}
+			for (; i < size; i++) {
+				if ((data[i] | 1) == 3) {
+					return i;
+				}
+			}
+			return size;
+		}
+
+		/** Index of the first start-of-frame byte at or after @p offset in @p buffer, or its size */
+		size_t findStartOfFrame(const BufferView &buffer, size_t offset) {
+			const size_t first = buffer.segmentSize(0);
+			if (offset < first) {
+				const size_t found = findStartOfFrame(buffer.segment(0) + offset, first - offset);
+				if (found < first - offset) {
+					return offset + found;
+				}
+				offset = first;
+			}
+			return offset + findStartOfFrame(buffer.segment(1) + offset - first, buffer.size() - offset);
+		}
+
+	}  // namespace
+
+	VescFramer::VescFramer(
+		PacketHandlerFunction handler, VescInstrumentation *instrumentation,
+		RxTimestampRing *timestamps)
+		: handler_(std::move(handler)), instrumentation_(instrumentation), timestamps_(timestamps) {
+	}
+
+	size_t VescFramer::process(const BufferView &buffer, size_t *bytes_wanted, size_t position) {
+		const size_t size = buffer.size();
+		size_t offset = 0;
+		int bytes_needed = VescFrame::VESC_MIN_FRAME_SIZE;
+
+		// counted locally and added to the shared counters once per call
+		uint64_t skipped = 0;
+		uint64_t crc_errors = 0;
+		uint64_t frame_errors = 0;
+
+		// search buffer for valid packet(s)
+		while (offset < size) {
+			// skip to the next start-of-frame character
+			const size_t start = findStartOfFrame(buffer, offset);
+			skipped += start - offset;
+			offset = start;
+			if (offset >= size) {
+				break;
+			}
+
+			// good start, now attempt to create packet
+			VescPacketFactory::Error error;
+			VESC_INSTRUMENT(auto parse_start = LatencyHistogram::Clock::now();)
+			VescPacketPtr created =
+				VescPacketFactory::createPacket(buffer.subview(offset), &bytes_needed, &error);
+			if (created) {
+				// the frame is complete since its last byte arrived
+				const size_t frame_size = created->frame().size();
+				created->setRxTime(
+					timestamps_ ? timestamps_->at(position + offset + frame_size - 1) :
+					RxTimestampRing::Clock::now());
+				const VescPacketConstPtr packet(std::move(created));
+				VESC_INSTRUMENT(
+					auto parsed = LatencyHistogram::Clock::now();
+					if (instrumentation_) {
+						instrumentation_->parse.record(parse_start, parsed);
+						instrumentation_->rx_frames.fetch_add(1, std::memory_order_relaxed);
+						instrumentation_->rx_to_dispatch.record(packet->rx_time(), parsed);
+					})
+				handler_(packet);
+				VESC_INSTRUMENT(
+					if (instrumentation_) {
+						instrumentation_->handler.record(parsed, LatencyHistogram::Clock::now());
+					})
+				// update state
+				offset += frame_size;
+				// continue to look for another frame in buffer
+				continue;
+			} else if (bytes_needed > 0) {
+				// need more data, break out of while loop
+				break;
+			}
+
+			// a frame start that is not followed by a valid frame, counted before resyncing
+			errors_.frames[error]++;
+			(error == VescPacketFactory::ERROR_INVALID_CHECKSUM ? crc_errors : frame_errors)++;
+			skipped++;
+			offset++;
+		}
+
+		errors_.skipped_bytes += skipped;
+		VESC_INSTRUMENT(
+			if (instrumentation_ && (skipped | crc_errors | frame_errors) != 0) {
+				instrumentation_->resync_bytes.fetch_add(skipped, std::memory_order_relaxed);
+				instrumentation_->crc_errors.fetch_add(crc_errors, std::memory_order_relaxed);
+				instrumentation_->frame_errors.fetch_add(frame_errors, std::memory_order_relaxed);
+			})
+
+		// if offset is at the end of the buffer, more bytes are needed
+		if (offset >= size) {
+			offset = size;
+			bytes_needed = VescFrame::VESC_MIN_FRAME_SIZE;
+		}
+
+		*bytes_wanted = size - offset + std::max(bytes_needed, 1);
+		return offset;
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,63 @@
+#include "vesc_driver/vesc_instrumentation.hpp"
+
+#include <algorithm>
+
+namespace vesc_driver {
+
+	constexpr int LatencyHistogram::BUCKET_COUNT;
+
+	void LatencyHistogram::record(Clock::duration latency) {
+		const uint64_t ns = static_cast<uint64_t>(
+			std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+
+		// bucket i > 0 holds [2^(i-1), 2^i) microseconds
+		uint64_t us = ns / 1000;
+		int bucket = 0;
+		while (us > 0 && bucket < BUCKET_COUNT - 1) {
+			us >>= 1;
+			bucket++;
+		}
+
+		buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t max = max_ns_.load(std::memory_order_relaxed);
+		while (ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+		}
+	}
+
+	LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+		Snapshot s;
+		for (int i = 0; i < BUCKET_COUNT; i++) {
+			s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+		}
+		s.count = count_.load(std::memory_order_relaxed);
+		if (s.count > 0) {
+			s.mean_us = static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) / s.count / 1000.0;
+		}
+		s.max_us = static_cast<double>(max_ns_.load(std::memory_order_relaxed)) / 1000.0;
+		return s;
+	}
+
+	double LatencyHistogram::bucketLimitUs(int index) {
+		return static_cast<double>(uint64_t(1) << index);
+	}
+
+	double LatencyHistogram::Snapshot::quantileUs(double fraction) const {
+		uint64_t total = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++) {
+			total += buckets[i];
+		}
+		const double target = fraction * static_cast<double>(total);
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++) {
+			seen += buckets[i];
+			if (seen > 0 && static_cast<double>(seen) >= target) {
+				// the last bucket is open ended, the maximum is the better bound there
+				return i == BUCKET_COUNT - 1 ? max_us : std::min(bucketLimitUs(i), max_us);
+			}
+		}
+		return 0.0;
+	}
+
+}  // namespace vesc_driver
@@ -1,43 +1,250 @@
 #include "vesc_driver/vesc_interface.hpp"
-#include "vesc_driver/vesc_packet_factory.hpp"
+#include "vesc_driver/datatypes.hpp"
+#include "vesc_driver/ring_buffer.hpp"
+#include "vesc_driver/vesc_capture.hpp"
+#include "vesc_driver/vesc_executor.hpp"
+#include "vesc_driver/vesc_framer.hpp"
+#include "vesc_driver/vesc_instrumentation.hpp"
+#include "vesc_driver/vesc_port.hpp"
+#include "vesc_driver/vesc_tx_scheduler.hpp"
 #include "serial_driver/serial_driver.hpp"
 
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 namespace vesc_driver {
 
-	class VescInterface::Impl {
+	namespace {
+
+		/** The default VescPort, a serial device driven by transport_drivers' SerialDriver */
+		class SerialPort : public VescPort {
+		public:
+			explicit SerialPort(IoContext &io_context)
+				: driver_(io_context) {
+			}
+
+			/** Settings applied by the next open(), 8N1 */
+			void configure(uint32_t baud_rate, drivers::serial_driver::FlowControl flow_control) {
+				namespace sd = drivers::serial_driver;
+				config_ = std::make_unique<sd::SerialPortConfig>(
+					baud_rate, flow_control, sd::Parity::NONE, sd::StopBits::ONE);
+			}
+
+			void open(const std::string &device, const ReceiveHandler &handler) override {
+				driver_.init_port(device, *config_);
+				if (!driver_.port()->is_open()) {
+					driver_.port()->open();
+					driver_.port()->async_receive(
+						[handler](const std::vector<uint8_t> &buffer) {
+							handler(buffer.data(), buffer.size(), Clock::time_point());
+						});
+				}
+			}
+
+			void close() override {
+				if (driver_.port()) {
+					driver_.port()->close();
+				}
+			}
+
+			bool isOpen() const override {
+				auto port = driver_.port();
+				return port && port->is_open();
+			}
+
+			size_t send(const Buffer &data) override {
+				return driver_.port()->send(data);
+			}
+
+		private:
+			drivers::serial_driver::SerialDriver driver_;
+			std::unique_ptr<drivers::serial_driver::SerialPortConfig> config_;
+		};
+
+	}  // namespace
+
+	class VescInterface::Impl : public VescExecutor::Link {
 	public:
 		Impl()
-			: owned_ctx{new IoContext(2)},
-			  serial_driver_{new drivers::serial_driver::SerialDriver(*owned_ctx)} {}
+			: owned_ctx{new IoContext(2)} {
+			init(*owned_ctx);
+		}
 
-		void serial_receive_callback(const std::vector<uint8_t> &buffer);
+		Impl(IoContext &io_context, VescExecutor *executor)
+			: executor_(executor) {
+			init(io_context);
+			if (executor_) {
+				// posted frames are written by the executor thread
+				tx_scheduler_.setWakeUpHandler([this]() { executor_->wakeUp(*this); });
+			}
+		}
+
+		void init(IoContext &io_context) {
+			serial_port_ = new SerialPort(io_context);
+			port_.reset(serial_port_);
+			tx_frame_.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+			tx_remainder_.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+			controller_index_.fill(-1);
+			addController(LOCAL_CONTROLLER);
+		}
+
+		/** Executor mode: runs the framer and writes the due frames. */
+		void service(VescExecutor::Clock::time_point now, VescExecutor::Clock::time_point *wake_up) override;
+
+		/** Returns the number of bytes stored in rx_ring_, see VescPort::ReceiveHandler. */
+		size_t serial_receive_callback(
+			const uint8_t *data, size_t size, VescPort::Clock::time_point rx_time);
 
 		void packet_creation_thread();
 
+		void transmit_thread();
+
 		void on_configure();
 
 		void connect(const std::string &port);
 
-		bool packet_thread_run_;
+		std::atomic<bool> packet_thread_run_{false};
 		std::unique_ptr<std::thread> packet_thread_;
 		PacketHandlerFunction packet_handler_;
+		VescPacketDispatcher dispatcher_;
 		ErrorHandlerFunction error_handler_;
-		std::unique_ptr<drivers::serial_driver::SerialPortConfig> device_config_;
-		std::mutex buffer_mutex_;
+		// only used to put the framer to sleep / wake it up, the data itself is passed lock-free
+		std::mutex rx_mutex_;
+		// signalled by serial_receive_callback once rx_ring_ holds at least rx_bytes_needed_ bytes
+		std::condition_variable rx_cv_;
+		// 0 = event-driven, > 0 = legacy polling of the buffer every poll_period_ms_ milliseconds
+		int poll_period_ms_ = 0;
+		// if set, the framer and the transmit scheduler run on its threads instead of our own
+		VescExecutor *executor_ = nullptr;
+		bool attached_ = false;
+		// scheduling settings of our own threads, see setThreadConfig()
+		ThreadConfig thread_config_;
+		ThreadConfig io_thread_config_;
+		// time (steady clock ticks) the receive callback last woke up the framer, 0 once it ran
+		std::atomic<int64_t> rx_notified_{0};
+		// serial port settings applied by connect()
+		uint32_t baud_rate_ = 115200;
+		FlowControl flow_control_ = FLOW_CONTROL_NONE;
+		Transport transport_ = TRANSPORT_UART;
 		std::string device_name_;
 		std::unique_ptr<IoContext> owned_ctx{};
-		std::unique_ptr<drivers::serial_driver::SerialDriver> serial_driver_;
+		// the serial port, unless replaced through setPort() (serial_port_ is null then)
+		std::unique_ptr<VescPort> port_;
+		SerialPort *serial_port_ = nullptr;
+		// wait for room in rx_ring_ rather than dropping received bytes
+		bool rx_lossless_ = false;
+		// raw capture of the link, opened by connect() if capture_path_ is set
+		std::string capture_path_;
+		std::unique_ptr<VescCaptureWriter> capture_;
+		// receive path: serial_receive_callback (producer) -> rx_ring_ -> packet_creation_thread (consumer)
+		RingBuffer rx_ring_{RX_RING_CAPACITY};
+		// arrival time of the chunks in rx_ring_, the frames get the time their last byte arrived at
+		RxTimestampRing rx_timestamps_{RX_TIMESTAMP_CAPACITY};
+		std::atomic<uint64_t> rx_bytes_{0};
+
+		// transmit path: callers post frames to tx_scheduler_, transmit_thread writes them
+		VescTxScheduler tx_scheduler_{TX_QUEUE_CAPACITY, TX_FW_VERSION};
+		std::unique_ptr<std::thread> tx_thread_;
+		// protects the command frames of the controllers while they are encoded and posted
+		std::mutex tx_mutex_;
+
+		/**
+		 * A VESC addressed through this link, either the one on the serial port or one behind it on
+		 * the CAN bus. Each has its own transmit slots and persistent command frames, which are
+		 * patched in place for every new setpoint.
+		 */
+		struct Controller {
+			explicit Controller(int can_id)
+				: duty_cycle_cmd{COMM_SET_DUTY, 4, 100000.0, can_id},
+				  current_cmd{COMM_SET_CURRENT, 4, 1000.0, can_id},
+				  brake_cmd{COMM_SET_CURRENT_BRAKE, 4, 1000.0, can_id},
+				  speed_cmd{COMM_SET_RPM, 4, 1.0, can_id},
+				  position_cmd{COMM_SET_POS, 4, 1000000.0, can_id},
+				  servo_cmd{COMM_SET_SERVO_POS, 2, 1000.0, can_id},
+				  // the field masks, encoded with encodeRaw()
+				  values_selective_cmd{COMM_GET_VALUES_SELECTIVE, 4, 1.0, can_id},
+				  imu_cmd{COMM_GET_IMU_DATA, 2, 1.0, can_id},
+				  // requests without arguments never change
+				  request_fw_version{COMM_FW_VERSION, 0, 1.0, can_id},
+				  request_values{COMM_GET_VALUES, 0, 1.0, can_id} {
+				drive_frame.reserve(speed_cmd.frame().size() + servo_cmd.frame().size());
+			}
+
+			int slots[TX_KIND_COUNT];
+			VescCommandFrame duty_cycle_cmd;
+			VescCommandFrame current_cmd;
+			VescCommandFrame brake_cmd;
+			VescCommandFrame speed_cmd;
+			VescCommandFrame position_cmd;
+			VescCommandFrame servo_cmd;
+			VescCommandFrame values_selective_cmd;
+			VescCommandFrame imu_cmd;
+			const VescCommandFrame request_fw_version;
+			const VescCommandFrame request_values;
+			Buffer drive_frame;  ///< speed_cmd followed by servo_cmd, see setSpeedAndServo()
+		};
+
+		// controllers_[0] is the VESC on the port, controller_index_ maps CAN id + 1 to controllers_
+		std::vector<std::unique_ptr<Controller>> controllers_;
+		std::array<int, 257> controller_index_;
+		double rate_limits_[TX_KIND_COUNT] = {};
+
+		void addController(int can_id);
+
+		/** @throw std::invalid_argument if @p can_id was not added with addCanController() */
+		Controller &controller(int can_id);
+
+		// only used by transmit_thread: the frame being written and the unwritten tail of a frame
+		// after a partial write
+		Buffer tx_frame_;
+		Buffer tx_remainder_;
+
+		VescInstrumentation instrumentation_;
+
+		// the running uploadFirmware(), which gets all received packets
+		std::mutex upload_mutex_;
+		VescFirmwareUpload *upload_ = nullptr;
+		std::atomic<bool> upload_running_{false};
+
+		// call the typed handler for each packet type and the generic packet handler
+		VescFramer framer_{
+			[this](const VescPacketConstPtr &packet) {
+				dispatcher_.dispatch(*packet);
+				if (packet_handler_) {
+					packet_handler_(packet);
+				}
+				if (upload_running_.load(std::memory_order_relaxed)) {
+					std::lock_guard<std::mutex> lock(upload_mutex_);
+					if (upload_) {
+						upload_->handlePacket(*packet);
+					}
+				}
+			},
+			&instrumentation_, &rx_timestamps_};
+
+		/** Writes tx_frame_, posted to tx_scheduler_ at @p posted. */
+		void write_scheduled(VescTxScheduler::Clock::time_point posted);
+
+		/**
+		 * Writes @p frame to the serial port. The write is synchronous (the bytes are in the kernel's
+		 * buffer on return), so @p frame may be modified again right afterwards. Only called by
+		 * transmit_thread.
+		 */
+		void write(const Buffer &frame);
 
 		~Impl() {
 			if (owned_ctx) {
@@ -46,77 +253,263 @@ namespace vesc_driver {
 		}
 
 	private:
-		std::vector<uint8_t> buffer_;
+		static constexpr size_t RX_RING_CAPACITY = 16 * VescFrame::VESC_MAX_FRAME_SIZE;
+		// a USB link delivers data in bursts at up to several MB/s, leave the framer more headroom
+		static constexpr size_t RX_RING_CAPACITY_USB = 256 * VescFrame::VESC_MAX_FRAME_SIZE;
+		static constexpr size_t TX_QUEUE_CAPACITY = 32;
+		// chunks, several per frame at low baud rates
+		static constexpr size_t RX_TIMESTAMP_CAPACITY = 1024;
+
+		// number of bytes rx_ring_ must hold before it is worth running the framer again
+		std::atomic<size_t> rx_bytes_needed_{VescFrame::VESC_MIN_FRAME_SIZE};
+		// overruns already reported through error_handler_
+		uint64_t rx_overruns_reported_ = 0;
+		// framer errors are reported in batches, at most once per RX_ERROR_REPORT_PERIOD
+		static constexpr std::chrono::seconds RX_ERROR_REPORT_PERIOD{1};
+		VescFramer::Errors rx_errors_reported_;
+		std::chrono::steady_clock::time_point rx_errors_report_time_;
+
+		/** True if rx_ring_ holds enough bytes to complete the pending frame. */
+		bool rx_ready() const {
+			return rx_ring_.size() >= rx_bytes_needed_.load(std::memory_order_relaxed);
+		}
+
+		/** Parses all complete frames in rx_ring_ and calls packet_handler_ for each of them. */
+		void process_rx_ring();
+
+		/** Reports new receive overruns through error_handler_. */
+		void report_rx_overruns();
+
+		/** Reports the frames rejected by the framer since the last report through error_handler_. */
+		void report_rx_errors();
+
+		/** Records the wake-up latency of the framer, if the receive callback woke it up. */
+		void record_wake_up();
+
+		/** Applies thread_config_ to the calling thread, failures go to error_handler_. */
+		void apply_thread_config(const char *thread_name);
 	};
 
-	void VescInterface::Impl::serial_receive_callback(const std::vector<uint8_t> &buffer) {
-		buffer_mutex_.lock(); // wait untill the current buffer read finishes
-		buffer_.reserve(buffer_.size() + buffer.size());
-		buffer_.insert(buffer_.end(), buffer.begin(), buffer.end());
-		buffer_mutex_.unlock();
+	size_t VescInterface::Impl::serial_receive_callback(
+		const uint8_t *data, size_t size, VescPort::Clock::time_point rx_time) {
+		const RxTimestampRing::Clock::time_point now = RxTimestampRing::Clock::now();
+		if (rx_lossless_) {
+			// the port keeps what does not fit
+			size = std::min(size, rx_ring_.capacity() - rx_ring_.size());
+		}
+		if (capture_) {
+			capture_->write(false, data, size);
+		}
+		size_t stored = rx_ring_.push(data, size);
+		if (stored > 0) {
+			rx_timestamps_.push(
+				rx_ring_.writePosition(), rx_time == VescPort::Clock::time_point() ? now : rx_time);
+		}
+		rx_bytes_.fetch_add(size, std::memory_order_relaxed);
+
+		// wake up the framer only once the pending frame (or at least a minimal one) is complete
+		if (executor_) {
+			if (rx_ready()) {
+				VESC_INSTRUMENT(rx_notified_.store(now.time_since_epoch().count(), std::memory_order_relaxed);)
+				executor_->wakeUp(*this);
+			}
+		} else if (poll_period_ms_ <= 0 && rx_ready()) {
+			VESC_INSTRUMENT(rx_notified_.store(now.time_since_epoch().count(), std::memory_order_relaxed);)
+			// taking the mutex guarantees the framer is either before its predicate check or waiting
+			{ std::lock_guard<std::mutex> lock(rx_mutex_); }
+			rx_cv_.notify_one();
+		}
+		return stored;
 	}
 
 	void VescInterface::Impl::packet_creation_thread() {
+		apply_thread_config("framer");
 		while (packet_thread_run_) {
-			buffer_mutex_.lock();
-			int bytes_needed = VescFrame::VESC_MIN_FRAME_SIZE;
-			if (!buffer_.empty()) {
-				// search buffer for valid packet(s)
-				auto iter = buffer_.begin();
-				while (iter != buffer_.end()) {
-					// check if valid start-of-frame character
-					if (VescFrame::VESC_SOF_VAL_SMALL_FRAME == *iter ||
-						VescFrame::VESC_SOF_VAL_LARGE_FRAME == *iter) {
-						// good start, now attempt to create packet
-						std::string error;
-						VescPacketConstPtr packet =
-							VescPacketFactory::createPacket(iter, buffer_.end(), &bytes_needed, &error);
-						if (packet) {
-							// call packet handler
-							packet_handler_(packet);
-							// update state
-							iter = iter + packet->frame().size();
-							// continue to look for another frame in buffer
-							continue;
-						} else if (bytes_needed > 0) {
-							// need more data, break out of while loop
-							break;  // for (iter_sof...
-						}
-					}
+			if (poll_period_ms_ > 0) {
+				// legacy mode, only attempt to read every poll_period_ms_
+				std::this_thread::sleep_for(std::chrono::milliseconds(poll_period_ms_));
+			} else {
+				std::unique_lock<std::mutex> lock(rx_mutex_);
+				rx_cv_.wait(lock, [this]() { return !packet_thread_run_ || rx_ready(); });
+			}
+			if (!packet_thread_run_) {
+				break;
+			}
 
-					iter++;
-				}
+			record_wake_up();
+			process_rx_ring();
+			report_rx_overruns();
+			report_rx_errors();
+		}
+	}
 
-				// if iter is at the end of the buffer, more bytes are needed
-				if (iter == buffer_.end()) {
-					bytes_needed = VescFrame::VESC_MIN_FRAME_SIZE;
+	void VescInterface::Impl::service(
+		VescExecutor::Clock::time_point, VescExecutor::Clock::time_point *wake_up) {
+		if (rx_ready()) {
+			record_wake_up();
+			process_rx_ring();
+			report_rx_overruns();
+			report_rx_errors();
+		}
+		VescTxScheduler::Clock::time_point posted;
+		while (tx_scheduler_.tryPop(tx_frame_, wake_up, &posted)) {
+			write_scheduled(posted);
+		}
+	}
+
+	void VescInterface::Impl::report_rx_overruns() {
+		uint64_t overruns = rx_ring_.overrunBytes();
+		if (overruns != rx_overruns_reported_ && error_handler_) {
+			std::stringstream ss;
+			ss << "Receive buffer overrun, " << overruns - rx_overruns_reported_ << " bytes dropped.";
+			error_handler_(ss.str());
+		}
+		rx_overruns_reported_ = overruns;
+	}
+
+	void VescInterface::Impl::report_rx_errors() {
+		const VescFramer::Errors &errors = framer_.errors();
+		if (errors.skipped_bytes == rx_errors_reported_.skipped_bytes &&
+			errors.frames == rx_errors_reported_.frames) {
+			return;
+		}
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - rx_errors_report_time_ < RX_ERROR_REPORT_PERIOD) {
+			return;
+		}
+		if (error_handler_) {
+			std::stringstream ss;
+			ss << "Receive errors, " << errors.skipped_bytes - rx_errors_reported_.skipped_bytes
+			   << " bytes skipped";
+			for (int i = 0; i < VescPacketFactory::ERROR_COUNT; i++) {
+				if (errors.frames[i] != rx_errors_reported_.frames[i]) {
+					ss << ", " << errors.frames[i] - rx_errors_reported_.frames[i] << " x "
+					   << VescPacketFactory::errorString(static_cast<VescPacketFactory::Error>(i));
 				}
+			}
+			ss << ".";
+			error_handler_(ss.str());
+		}
+		rx_errors_reported_ = errors;
+		rx_errors_report_time_ = now;
+	}
+
+	void VescInterface::Impl::record_wake_up() {
+		VESC_INSTRUMENT(
+			int64_t notified = rx_notified_.exchange(0, std::memory_order_relaxed);
+			if (notified != 0) {
+				instrumentation_.wake_up.record(
+					LatencyHistogram::Clock::time_point(LatencyHistogram::Clock::duration(notified)),
+					LatencyHistogram::Clock::now());
+			})
+	}
 
-				// erase "used" buffer
-				buffer_.erase(buffer_.begin(), iter);
+	void VescInterface::Impl::apply_thread_config(const char *thread_name) {
+		try {
+			applyThreadConfig(thread_config_);
+		} catch (const std::runtime_error &e) {
+			if (error_handler_) {
+				error_handler_(std::string("Failed to configure the ") + thread_name + " thread, " + e.what());
 			}
+		}
+	}
+
+	void VescInterface::Impl::process_rx_ring() {
+		// no lock is held here, rx_ring_ is only consumed by this thread
+		size_t bytes_wanted;
+		rx_ring_.pop(framer_.process(rx_ring_.peek(), &bytes_wanted, rx_ring_.readPosition()));
 
-			buffer_mutex_.unlock();
-			// Only attempt to read every 10 ms
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		// sleep until the partial frame at the front of the ring can be completed
+		rx_bytes_needed_.store(bytes_wanted, std::memory_order_relaxed);
+	}
+
+	void VescInterface::Impl::addController(int can_id) {
+		if (can_id < LOCAL_CONTROLLER || can_id > 255) {
+			throw std::invalid_argument("CAN id out of range");
+		}
+		if (controller_index_[can_id + 1] >= 0) {
+			return;
+		}
+		std::unique_ptr<Controller> c(new Controller(can_id));
+		// slot priorities follow the order of TxKind (the same kind of all controllers take turns),
+		// the generic queue sits below the servo
+		for (int kind = 0; kind < TX_KIND_COUNT; kind++) {
+			c->slots[kind] = tx_scheduler_.addSlot(kind < TX_FW_VERSION ? kind : kind + 1);
+			tx_scheduler_.setRateLimit(c->slots[kind], rate_limits_[kind]);
 		}
+		controller_index_[can_id + 1] = static_cast<int>(controllers_.size());
+		controllers_.push_back(std::move(c));
 	}
 
-	void VescInterface::Impl::connect(const std::string &port) {
-		uint32_t baud_rate = 115200;
-		// using FlowControl::HARDWARE on macOS causes an exception:
-		//   set_option: Operation not supported on socket failed.
-		auto fc = drivers::serial_driver::FlowControl::NONE;
-		auto pt = drivers::serial_driver::Parity::NONE;
-		auto sb = drivers::serial_driver::StopBits::ONE;
-		device_config_ = std::make_unique<drivers::serial_driver::SerialPortConfig>(baud_rate, fc, pt, sb);
-		serial_driver_->init_port(port, *device_config_);
-		if (!serial_driver_->port()->is_open()) {
-			serial_driver_->port()->open();
-			serial_driver_->port()->async_receive(
-				std::bind(&VescInterface::Impl::serial_receive_callback, this, std::placeholders::_1));
+	VescInterface::Impl::Controller &VescInterface::Impl::controller(int can_id) {
+		int index = can_id >= LOCAL_CONTROLLER && can_id <= 255 ? controller_index_[can_id + 1] : -1;
+		if (index < 0) {
+			throw std::invalid_argument("Unknown CAN id, see VescInterface::addCanController()");
 		}
+		return *controllers_[index];
+	}
+
+	void VescInterface::Impl::transmit_thread() {
+		apply_thread_config("transmit");
+		VescTxScheduler::Clock::time_point posted;
+		while (tx_scheduler_.pop(tx_frame_, &posted)) {
+			write_scheduled(posted);
+		}
+	}
 
+	void VescInterface::Impl::write_scheduled(VescTxScheduler::Clock::time_point posted) {
+		VESC_INSTRUMENT(auto start = VescTxScheduler::Clock::now();)
+		write(tx_frame_);
+		VESC_INSTRUMENT(
+			auto end = VescTxScheduler::Clock::now();
+			instrumentation_.write.record(start, end);
+			instrumentation_.command_to_write.record(posted, end);)
+		(void)posted;
+	}
+
+	void VescInterface::Impl::write(const Buffer &frame) {
+		size_t written = port_->send(frame);
+		while (written < frame.size() && written > 0) {
+			// capacity is reserved for the largest frame, so this does not allocate
+			tx_remainder_.assign(frame.begin() + written, frame.end());
+			size_t more = port_->send(tx_remainder_);
+			written = more > 0 ? written + more : 0;
+		}
+		if (capture_ && written > 0) {
+			capture_->write(true, frame.data(), written);
+		}
+		if (written != frame.size() && error_handler_) {
+			error_handler_("Failed to write a frame to the serial port.");
+		}
+	}
+
+	void VescInterface::Impl::connect(const std::string &port) {
+		namespace sd = drivers::serial_driver;
+
+		if (serial_port_) {
+			// using FlowControl::HARDWARE on macOS causes an exception:
+			//   set_option: Operation not supported on socket failed.
+			auto fc = sd::FlowControl::NONE;
+			if (transport_ == TRANSPORT_UART && flow_control_ == FLOW_CONTROL_HARDWARE) {
+				fc = sd::FlowControl::HARDWARE;
+			} else if (transport_ == TRANSPORT_UART && flow_control_ == FLOW_CONTROL_SOFTWARE) {
+				fc = sd::FlowControl::SOFTWARE;
+			}
+			serial_port_->configure(baud_rate_, fc);
+		}
+		rx_ring_.reset(transport_ == TRANSPORT_USB_CDC ? RX_RING_CAPACITY_USB : RX_RING_CAPACITY);
+		rx_timestamps_.reset();
+		rx_bytes_needed_.store(VescFrame::VESC_MIN_FRAME_SIZE, std::memory_order_relaxed);
+		rx_lossless_ = port_->lossless();
+		// 8N1: ten bits on the wire per byte, a USB link is not limited by the baud rate
+		tx_scheduler_.setLinkRate(transport_ == TRANSPORT_UART ? baud_rate_ / 10.0 : 0.0);
+		capture_.reset(capture_path_.empty() ? nullptr : new VescCaptureWriter(capture_path_));
+		if (!port_->isOpen()) {
+			port_->open(
+				port, std::bind(
+					&VescInterface::Impl::serial_receive_callback, this,
+					std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+		}
 	}
 
 	VescInterface::VescInterface(
@@ -132,6 +525,16 @@ namespace vesc_driver {
 		}
 	}
 
+	VescInterface::VescInterface(
+		drivers::common::IoContext &io_context,
+		VescExecutor *executor,
+		const PacketHandlerFunction &packet_handler,
+		const ErrorHandlerFunction &error_handler)
+		: impl_(new Impl(io_context, executor)) {
+		setPacketHandler(packet_handler);
+		setErrorHandler(error_handler);
+	}
+
 	VescInterface::~VescInterface() {
 		disconnect();
 	}
@@ -146,6 +549,57 @@ namespace vesc_driver {
 		impl_->error_handler_ = handler;
 	}
 
+	VescPacketDispatcher &VescInterface::dispatcher() {
+		return impl_->dispatcher_;
+	}
+
+	void VescInterface::setPollingPeriod(int period_ms) {
+		impl_->poll_period_ms_ = period_ms;
+	}
+
+	void VescInterface::setBaudRate(uint32_t baud_rate) {
+		impl_->baud_rate_ = baud_rate;
+	}
+
+	void VescInterface::setFlowControl(FlowControl flow_control) {
+		impl_->flow_control_ = flow_control;
+	}
+
+	void VescInterface::setTransport(Transport transport) {
+		impl_->transport_ = transport;
+	}
+
+	void VescInterface::setRateLimit(TxKind kind, double max_rate_hz) {
+		impl_->rate_limits_[kind] = max_rate_hz;
+		for (const auto &c : impl_->controllers_) {
+			impl_->tx_scheduler_.setRateLimit(c->slots[kind], max_rate_hz);
+		}
+	}
+
+	void VescInterface::addCanController(int can_id) {
+		if (can_id < 0) {
+			throw std::invalid_argument("CAN id out of range");
+		}
+		impl_->addController(can_id);
+	}
+
+	void VescInterface::setPort(std::unique_ptr<VescPort> port) {
+		if (isConnected()) {
+			throw SerialException("Replacing the port while connected");
+		}
+		impl_->port_ = std::move(port);
+		impl_->serial_port_ = nullptr;
+	}
+
+	void VescInterface::setCaptureFile(const std::string &path) {
+		impl_->capture_path_ = path;
+	}
+
+	void VescInterface::setThreadConfig(const ThreadConfig &framer, const ThreadConfig &io) {
+		impl_->thread_config_ = framer;
+		impl_->io_thread_config_ = io;
+	}
+
 	void VescInterface::connect(const std::string &port) {
 		// todo - mutex?
 
@@ -153,6 +607,17 @@ namespace vesc_driver {
 			throw SerialException("Already connected to serial port.");
 		}
 
+		// the I/O threads of our own IoContext are idle until the port is opened
+		if (impl_->owned_ctx) {
+			try {
+				applyThreadConfig(*impl_->owned_ctx, impl_->io_thread_config_);
+			} catch (const std::runtime_error &e) {
+				if (impl_->error_handler_) {
+					impl_->error_handler_(std::string("Failed to configure the I/O threads, ") + e.what());
+				}
+			}
+		}
+
 		// connect to serial port
 		try {
 			impl_->connect(port);
@@ -162,11 +627,25 @@ namespace vesc_driver {
 			throw SerialException(ss.str().c_str());
 		}
 
+		if (impl_->executor_) {
+			// the executor runs the framer and writes the scheduled frames
+			impl_->tx_scheduler_.start();
+			impl_->executor_->attach(*impl_);
+			impl_->attached_ = true;
+			return;
+		}
+
 		// start up a monitoring thread
 		impl_->packet_thread_run_ = true;
 		impl_->packet_thread_ = std::unique_ptr<std::thread>(
 			new std::thread(
 				&VescInterface::Impl::packet_creation_thread, impl_.get()));
+
+		// and the thread writing the scheduled frames
+		impl_->tx_scheduler_.start();
+		impl_->tx_thread_ = std::unique_ptr<std::thread>(
+			new std::thread(
+				&VescInterface::Impl::transmit_thread, impl_.get()));
 	}
 
 	void VescInterface::disconnect() {
@@ -175,57 +654,158 @@ namespace vesc_driver {
 		// It is possible that isConnected() returns true even if VescInterface::connect throws SerialException.
 		// For example, when the port is successfully opened but setting of the options fails.
 		// In that case impl_->packet_thread_ will be uninitialized, i.e. nullptr.
-		if (impl_->packet_thread_) {
+		if (impl_->attached_) {
+			impl_->executor_->detach(*impl_);
+			impl_->attached_ = false;
+			impl_->tx_scheduler_.stop();
+			impl_->port_->close();
+			impl_->capture_.reset();
+		} else if (impl_->packet_thread_) {
 			// bring down read thread
-			impl_->packet_thread_run_ = false;
+			{
+				std::lock_guard<std::mutex> lock(impl_->rx_mutex_);
+				impl_->packet_thread_run_ = false;
+			}
+			impl_->rx_cv_.notify_all();
 			impl_->packet_thread_->join();
-			impl_->serial_driver_->port()->close();
+			impl_->packet_thread_.reset();
+			// bring down write thread, frames still pending stay queued for the next connect()
+			impl_->tx_scheduler_.stop();
+			impl_->tx_thread_->join();
+			impl_->tx_thread_.reset();
+			impl_->port_->close();
+			impl_->capture_.reset();
 		}
 	}
 
+	const VescInstrumentation &VescInterface::instrumentation() const {
+		return impl_->instrumentation_;
+	}
+
+	VescInterface::Statistics VescInterface::statistics() const {
+		Statistics stats;
+		stats.rx_bytes = impl_->rx_bytes_.load(std::memory_order_relaxed);
+		stats.rx_overrun_bytes = impl_->rx_ring_.overrunBytes();
+		stats.rx_overrun_count = impl_->rx_ring_.overrunCount();
+		VescTxScheduler::Statistics tx = impl_->tx_scheduler_.statistics();
+		stats.tx_frames = tx.frames;
+		stats.tx_bytes = tx.bytes;
+		stats.tx_coalesced = tx.coalesced;
+		stats.tx_dropped = tx.dropped;
+		stats.tx_queue_depth = tx.queue_depth;
+		return stats;
+	}
+
 	bool VescInterface::isConnected() const {
-		auto port = impl_->serial_driver_->port();
-		if (port) {
-			return port->is_open();
-		} else {
-			return false;
-		}
+		return impl_->port_->isOpen();
 	}
 
 	void VescInterface::send(const VescPacket &packet) {
-		impl_->serial_driver_->port()->async_send(packet.frame());
+		if (!impl_->tx_scheduler_.enqueue(packet.frame()) && impl_->error_handler_) {
+			impl_->error_handler_("Transmit queue full, packet dropped.");
+		}
+	}
+
+	void VescInterface::requestFWVersion(int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		impl_->tx_scheduler_.post(c.slots[TX_FW_VERSION], c.request_fw_version.frame());
 	}
 
-	void VescInterface::requestFWVersion() {
-		send(VescPacketRequestFWVersion());
+	void VescInterface::requestState(int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		impl_->tx_scheduler_.post(c.slots[TX_TELEMETRY], c.request_values.frame());
 	}
 
-	void VescInterface::requestState() {
-		send(VescPacketRequestValues());
+	void VescInterface::requestStateSelective(uint32_t mask, TxKind kind, int can_id) {
+		assert(mask <= VescPacketValuesSelective::ALL_FIELDS);
+		assert(kind == TX_TELEMETRY || kind == TX_TELEMETRY_SLOW);
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[kind], c.values_selective_cmd.encodeRaw(mask));
 	}
 
-	void VescInterface::setDutyCycle(double duty_cycle) {
-		send(VescPacketSetDuty(duty_cycle));
+	void VescInterface::requestImuData(uint32_t mask, int can_id) {
+		assert(mask <= VescPacketImuData::ALL_FIELDS);
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_IMU], c.imu_cmd.encodeRaw(mask));
 	}
 
-	void VescInterface::setCurrent(double current) {
-		send(VescPacketSetCurrent(current));
+	void VescInterface::setDutyCycle(double duty_cycle, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.duty_cycle_cmd.encode(duty_cycle));
 	}
 
-	void VescInterface::setBrake(double brake) {
-		send(VescPacketSetCurrentBrake(brake));
+	void VescInterface::setCurrent(double current, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.current_cmd.encode(current));
 	}
 
-	void VescInterface::setSpeed(double speed) {
-		send(VescPacketSetRPM(speed));
+	void VescInterface::setBrake(double brake, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.brake_cmd.encode(brake));
 	}
 
-	void VescInterface::setPosition(double position) {
-		send(VescPacketSetPos(position));
+	void VescInterface::setSpeed(double speed, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.speed_cmd.encode(speed));
 	}
 
-	void VescInterface::setServo(double servo) {
-		send(VescPacketSetServoPos(servo));
+	void VescInterface::setPosition(double position, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.position_cmd.encode(position));
+	}
+
+	void VescInterface::setServo(double servo, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		impl_->tx_scheduler_.post(c.slots[TX_SERVO], c.servo_cmd.encode(servo));
+	}
+
+	void VescInterface::setSpeedAndServo(double speed, double servo, int can_id) {
+		Impl::Controller &c = impl_->controller(can_id);
+		std::lock_guard<std::mutex> lock(impl_->tx_mutex_);
+		// capacity was reserved for both frames, so this does not allocate
+		const Buffer &speed_frame = c.speed_cmd.encode(speed);
+		c.drive_frame.assign(speed_frame.begin(), speed_frame.end());
+		const Buffer &servo_frame = c.servo_cmd.encode(servo);
+		c.drive_frame.insert(c.drive_frame.end(), servo_frame.begin(), servo_frame.end());
+		// discard first: a stale servo command must not be written after the pair
+		impl_->tx_scheduler_.discard(c.slots[TX_SERVO]);
+		impl_->tx_scheduler_.post(c.slots[TX_MOTOR], c.drive_frame);
+	}
+
+	void VescInterface::uploadFirmware(const Buffer &image, const VescFirmwareUploadOptions &options) {
+		// throws for an unknown CAN id
+		impl_->controller(options.can_id);
+		VescFirmwareUpload upload(image, options, [this](const VescPacket &packet) {
+			return impl_->tx_scheduler_.enqueue(packet.frame());
+		});
+
+		{
+			std::lock_guard<std::mutex> lock(impl_->upload_mutex_);
+			if (impl_->upload_) {
+				throw std::runtime_error("Another firmware upload is running");
+			}
+			impl_->upload_ = &upload;
+			impl_->upload_running_ = true;
+		}
+		// the framer must not see the upload any more once it is gone, also after a failure
+		struct Detach {
+			Impl &impl;
+
+			~Detach() {
+				std::lock_guard<std::mutex> lock(impl.upload_mutex_);
+				impl.upload_running_ = false;
+				impl.upload_ = nullptr;
+			}
+		} detach{*impl_};
+		upload.run();
 	}
 
 }  // namespace vesc_driver
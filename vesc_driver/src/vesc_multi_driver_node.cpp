@@ -0,0 +1,85 @@
+#include "vesc_driver/vesc_driver.hpp"
+#include "vesc_driver/vesc_executor.hpp"
+#include "vesc_driver/vesc_thread.hpp"
+#include "serial_driver/serial_driver.hpp"
+
+#include <rclcpp/rclcpp.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Runs one VescDriver per serial port in a single process. All drivers share one IoContext and one
+ * VescExecutor, so the number of threads does not depend on the number of ports.
+ *
+ * Parameters of the vesc_multi_driver node:
+ *   ports            - serial port of each driver
+ *   namespaces       - namespace of each driver, defaults to vesc_<index>
+ *   io_threads       - threads of the shared IoContext (default 1)
+ *   executor_threads - threads running the frame parsers and transmit schedulers (default 1)
+ *   io_thread_policy, io_thread_priority, io_thread_cpus,
+ *   executor_thread_policy, executor_thread_priority, executor_thread_cpus
+ *                    - real-time settings of these threads, see VescDriver::declareThreadConfig()
+ *   lock_memory      - lock the process memory (default false)
+ *
+ * The drivers are created with their port as parameter override, all other parameters (e.g. from
+ * vesc_config.yaml) apply to each of them.
+ */
+int main(int argc, char **argv) {
+	rclcpp::init(argc, argv);
+
+	auto config = std::make_shared<rclcpp::Node>("vesc_multi_driver");
+	auto ports = config->declare_parameter<std::vector<std::string>>(
+		"ports", std::vector<std::string>());
+	auto namespaces = config->declare_parameter<std::vector<std::string>>(
+		"namespaces", std::vector<std::string>());
+	int io_threads = std::max(1, config->declare_parameter<int>("io_threads", 1));
+	int executor_threads = std::max(1, config->declare_parameter<int>("executor_threads", 1));
+	bool lock_memory = config->declare_parameter<bool>("lock_memory", false);
+	vesc_driver::ThreadConfig io_thread = vesc_driver::VescDriver::declareThreadConfig(*config, "io_thread");
+	vesc_driver::ThreadConfig executor_thread =
+		vesc_driver::VescDriver::declareThreadConfig(*config, "executor_thread");
+	io_thread.lock_memory = lock_memory;
+	executor_thread.lock_memory = lock_memory;
+	if (ports.empty()) {
+		RCLCPP_FATAL(config->get_logger(), "No serial ports given, set the 'ports' parameter.");
+		rclcpp::shutdown();
+		return 1;
+	}
+
+	IoContext io_context(static_cast<size_t>(io_threads));
+	vesc_driver::VescExecutor vesc_executor(static_cast<size_t>(executor_threads));
+	try {
+		vesc_driver::applyThreadConfig(io_context, io_thread);
+	} catch (const std::runtime_error &e) {
+		RCLCPP_ERROR(config->get_logger(), "Failed to configure the I/O threads, %s.", e.what());
+	}
+	try {
+		vesc_executor.applyThreadConfig(executor_thread);
+	} catch (const std::runtime_error &e) {
+		RCLCPP_ERROR(config->get_logger(), "Failed to configure the executor threads, %s.", e.what());
+	}
+
+	rclcpp::executors::SingleThreadedExecutor executor;
+	executor.add_node(config);
+
+	std::vector<std::shared_ptr<vesc_driver::VescDriver>> drivers;
+	for (size_t i = 0; i < ports.size(); i++) {
+		std::string ns = i < namespaces.size() ? namespaces[i] : "vesc_" + std::to_string(i);
+		rclcpp::NodeOptions options;
+		options.arguments({"--ros-args", "-r", "__ns:=/" + ns});
+		options.parameter_overrides({rclcpp::Parameter("port", ports[i])});
+		drivers.push_back(std::make_shared<vesc_driver::VescDriver>(options, io_context, &vesc_executor));
+		executor.add_node(drivers.back());
+	}
+
+	executor.spin();
+
+	// the drivers disconnect before the shared executor and IoContext go away
+	drivers.clear();
+	rclcpp::shutdown();
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include "vesc_driver/vesc_packet.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <iterator>
 #include <memory>
@@ -7,7 +8,10 @@
 #include <cmath>
 
 #include "vesc_driver/datatypes.hpp"
+#include "vesc_driver/vesc_crc.hpp"
+#include "vesc_driver/vesc_frame_pool.hpp"
 #include "vesc_driver/vesc_packet_factory.hpp"
+#include "vesc_driver/vesc_schema.hpp"
 
 
 namespace vesc_driver {
@@ -36,29 +40,29 @@ namespace vesc_driver {
 		*(frame_->end() - 1) = 3;
 	}
 
-	VescFrame::VescFrame(const BufferRangeConst &frame, const BufferRangeConst &payload) {
+	VescFrame::VescFrame(const BufferView &frame, size_t payload_offset, size_t payload_size) {
 		/* VescPacketFactory::createPacket() should make sure that the input is valid, but run a few cheap
 		   checks anyway */
-		assert(std::distance(frame.first, frame.second) >= VESC_MIN_FRAME_SIZE);
-		assert(std::distance(frame.first, frame.second) <= VESC_MAX_FRAME_SIZE);
-		assert(std::distance(payload.first, payload.second) <= VESC_MAX_PAYLOAD_SIZE);
-		assert(
-			std::distance(frame.first, payload.first) > 0 &&
-			std::distance(payload.second, frame.second) > 0);
-
-		frame_.reset(new Buffer(frame.first, frame.second));
-		payload_.first = frame_->begin() + std::distance(frame.first, payload.first);
-		payload_.second = frame_->begin() + std::distance(frame.first, payload.second);
+		assert(frame.size() >= VESC_MIN_FRAME_SIZE);
+		assert(frame.size() <= VESC_MAX_FRAME_SIZE);
+		assert(payload_size <= VESC_MAX_PAYLOAD_SIZE);
+		assert(payload_offset > 0 && payload_offset + payload_size < frame.size());
+
+		// the only copy on the receive path: out of the receive ring into a pooled frame buffer
+		frame_ = VescFramePool::instance().acquire(frame.size());
+		frame.copy(frame_->data());
+		payload_.first = frame_->begin() + payload_offset;
+		payload_.second = payload_.first + payload_size;
 	}
 
-	VescPacket::VescPacket(const std::string &name, int payload_size, int payload_id)
+	VescPacket::VescPacket(const char *name, int payload_size, int payload_id)
 		: VescFrame(payload_size), name_(name) {
 		assert(payload_id >= 0 && payload_id < 256);
 		assert(std::distance(payload_.first, payload_.second) > 0);
 		*payload_.first = payload_id;
 	}
 
-	VescPacket::VescPacket(const std::string &name, std::shared_ptr<VescFrame> raw)
+	VescPacket::VescPacket(const char *name, std::shared_ptr<VescFrame> raw)
 		: VescFrame(*raw), name_(name) {
 	}
 
@@ -112,240 +116,322 @@ namespace vesc_driver {
 
 	VescPacketRequestFWVersion::VescPacketRequestFWVersion()
 		: VescPacket("RequestFWVersion", 1, COMM_FW_VERSION) {
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
 /*------------------------------------------------------------------------------------------------*/
 
-	VescPacketValues::VescPacketValues(std::shared_ptr<VescFrame> raw)
-		: VescPacket("Values", raw) {
+	namespace {
+		typedef VescMcConfData M;
+		typedef VescAppConfData A;
+		typedef schema::Float32Auto F;
+
+		/** Leading fields of the payload of COMM_GET_MCCONF (confgenerator_serialize_mcconf) */
+		using McConfSchema = Schema<
+			SchemaField<&M::signature, uint32_t, 1>,
+			SchemaField<&M::pwm_mode, uint8_t, 5>,
+			SchemaField<&M::comm_mode, uint8_t, 6>,
+			SchemaField<&M::motor_type, uint8_t, 7>,
+			SchemaField<&M::sensor_mode, uint8_t, 8>,
+			SchemaField<&M::current_max, F, 9>,
+			SchemaField<&M::current_min, F, 13>,
+			SchemaField<&M::in_current_max, F, 17>,
+			SchemaField<&M::in_current_min, F, 21>,
+			SchemaField<&M::abs_current_max, F, 25>,
+			SchemaField<&M::min_erpm, F, 29>,
+			SchemaField<&M::max_erpm, F, 33>,
+			SchemaField<&M::erpm_start, F, 37>,
+			SchemaField<&M::max_erpm_fbrake, F, 41>,
+			SchemaField<&M::max_erpm_fbrake_cc, F, 45>,
+			SchemaField<&M::min_vin, F, 49>,
+			SchemaField<&M::max_vin, F, 53>,
+			SchemaField<&M::battery_cut_start, F, 57>,
+			SchemaField<&M::battery_cut_end, F, 61>,
+			SchemaField<&M::slow_abs_current, uint8_t, 65>,
+			SchemaField<&M::temp_fet_start, F, 66>,
+			SchemaField<&M::temp_fet_end, F, 70>,
+			SchemaField<&M::temp_motor_start, F, 74>,
+			SchemaField<&M::temp_motor_end, F, 78>,
+			SchemaField<&M::temp_accel_dec, F, 82>,
+			SchemaField<&M::min_duty, F, 86>,
+			SchemaField<&M::max_duty, F, 90>,
+			SchemaField<&M::watt_max, F, 94>,
+			SchemaField<&M::watt_min, F, 98>>;
+
+		static_assert(McConfSchema::SIZE == 102, "COMM_GET_MCCONF limits prefix size");
+
+		/** Leading fields of the payload of COMM_GET_APPCONF (confgenerator_serialize_appconf) */
+		using AppConfSchema = Schema<
+			SchemaField<&A::signature, uint32_t, 1>,
+			SchemaField<&A::controller_id, uint8_t, 5>,
+			SchemaField<&A::timeout_msec, uint32_t, 6>,
+			SchemaField<&A::timeout_brake_current, F, 10>,
+			SchemaField<&A::send_can_status, uint8_t, 14>,
+			SchemaField<&A::send_can_status_rate_hz, uint16_t, 15>,
+			SchemaField<&A::can_baud_rate, uint8_t, 17>>;
+
+		static_assert(AppConfSchema::SIZE == 18, "COMM_GET_APPCONF prefix size");
+	}  // namespace
+
+	VescPacketMcConf::VescPacketMcConf(std::shared_ptr<VescFrame> raw)
+		: VescPacket("McConf", raw) {
+		const size_t payload_size = std::distance(payload_.first, payload_.second);
+		complete_ = payload_size >= McConfSchema::SIZE;
+		McConfSchema::decode(&(*payload_.first), payload_size, data_);
+	}
+
+	REGISTER_PACKET_TYPE(COMM_GET_MCCONF, VescPacketMcConf)
+
+	VescPacketRequestMcConf::VescPacketRequestMcConf()
+		: VescPacket("RequestMcConf", 1, COMM_GET_MCCONF) {
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
-	double VescPacketValues::temp_fet() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 1)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 2)))
-		);
-		return static_cast<double>(v) / 10.0;
+	VescPacketAppConf::VescPacketAppConf(std::shared_ptr<VescFrame> raw)
+		: VescPacket("AppConf", raw) {
+		const size_t payload_size = std::distance(payload_.first, payload_.second);
+		complete_ = payload_size >= AppConfSchema::SIZE;
+		AppConfSchema::decode(&(*payload_.first), payload_size, data_);
 	}
 
-	double VescPacketValues::temp_motor() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 3)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 4)))
-		);
-		return static_cast<double>(v) / 10.0;
+	REGISTER_PACKET_TYPE(COMM_GET_APPCONF, VescPacketAppConf)
+
+	VescPacketRequestAppConf::VescPacketRequestAppConf()
+		: VescPacket("RequestAppConf", 1, COMM_GET_APPCONF) {
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
+/*------------------------------------------------------------------------------------------------*/
+
+	namespace {
+		typedef VescValuesData V;
+		typedef VescPacketValuesSelective S;
+
+		/**
+		 * Payload of COMM_GET_VALUES. The reply to COMM_GET_VALUES_SELECTIVE carries the same fields
+		 * in the same order, but only those selected by the field mask (the last template argument).
+		 */
+		using ValuesSchema = Schema<
+			SchemaField<&V::temp_fet, int16_t, 1, 10, S::TEMP_FET>,
+			SchemaField<&V::temp_motor, int16_t, 3, 10, S::TEMP_MOTOR>,
+			SchemaField<&V::avg_motor_current, int32_t, 5, 100, S::AVG_MOTOR_CURRENT>,
+			SchemaField<&V::avg_input_current, int32_t, 9, 100, S::AVG_INPUT_CURRENT>,
+			SchemaField<&V::avg_id, int32_t, 13, 100, S::AVG_ID>,
+			SchemaField<&V::avg_iq, int32_t, 17, 100, S::AVG_IQ>,
+			SchemaField<&V::duty_cycle_now, int16_t, 21, 1000, S::DUTY_CYCLE_NOW>,
+			SchemaField<&V::rpm, int32_t, 23, 1, S::RPM>,
+			SchemaField<&V::v_in, int16_t, 27, 10, S::V_IN>,
+			SchemaField<&V::amp_hours, int32_t, 29, 10000, S::AMP_HOURS>,
+			SchemaField<&V::amp_hours_charged, int32_t, 33, 10000, S::AMP_HOURS_CHARGED>,
+			SchemaField<&V::watt_hours, int32_t, 37, 10000, S::WATT_HOURS>,
+			SchemaField<&V::watt_hours_charged, int32_t, 41, 10000, S::WATT_HOURS_CHARGED>,
+			SchemaField<&V::tachometer, int32_t, 45, 1, S::TACHOMETER>,
+			SchemaField<&V::tachometer_abs, int32_t, 49, 1, S::TACHOMETER_ABS>,
+			SchemaField<&V::fault_code, uint8_t, 53, 1, S::FAULT_CODE>,
+			SchemaField<&V::pid_pos_now, int32_t, 54, 1000000, S::PID_POS_NOW>,
+			SchemaField<&V::controller_id, uint8_t, 58, 1, S::CONTROLLER_ID>,
+			SchemaField<&V::temp_mos1, int16_t, 59, 10, S::TEMP_MOS>,
+			SchemaField<&V::temp_mos2, int16_t, 61, 10, S::TEMP_MOS>,
+			SchemaField<&V::temp_mos3, int16_t, 63, 10, S::TEMP_MOS>,
+			SchemaField<&V::avg_vd, int32_t, 65, 1000, S::AVG_VD>,
+			SchemaField<&V::avg_vq, int32_t, 69, 1000, S::AVG_VQ>>;
+
+		static_assert(ValuesSchema::SIZE == 73, "COMM_GET_VALUES payload size");
+
+		/** Value of the VescPacketSet* commands */
+		struct CommandValue {
+			double value;
+		};
+
+		template<typename Raw, int64_t Scale>
+		using CommandSchema = Schema<SchemaField<&CommandValue::value, Raw, 1, Scale>>;
+	}  // namespace
 
-	double VescPacketValues::avg_motor_current() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 5)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 6)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 7)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 8)))
-		);
-		return static_cast<double>(v) / 100.0;
+	VescPacketValues::VescPacketValues(std::shared_ptr<VescFrame> raw)
+		: VescPacket("Values", raw) {
+		ValuesSchema::decode(
+			&(*payload_.first), std::distance(payload_.first, payload_.second), data_);
 	}
 
+	REGISTER_PACKET_TYPE(COMM_GET_VALUES, VescPacketValues)
 
-	double VescPacketValues::avg_input_current() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 9)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 10)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 11)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 12)))
-		);
-		return static_cast<double>(v) / 100.0;
-	}
-
-
-	double VescPacketValues::avg_id() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 13)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 14)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 15)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 16)))
-		);
-		return static_cast<double>(v) / 100.0;
-	}
-
-	double VescPacketValues::avg_iq() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 17)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 18)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 19)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 20)))
-		);
-		return static_cast<double>(v) / 100.0;
+	VescPacketRequestValues::VescPacketRequestValues()
+		: VescPacket("RequestValues", 1, COMM_GET_VALUES) {
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
+/*------------------------------------------------------------------------------------------------*/
 
-	double VescPacketValues::duty_cycle_now() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 21)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 22)))
-		);
-		return static_cast<double>(v) / 1000.0;
+	VescPacketValuesSelective::VescPacketValuesSelective(std::shared_ptr<VescFrame> raw)
+		: VescPacket("ValuesSelective", raw), mask_(0) {
+		const size_t payload_size = std::distance(payload_.first, payload_.second);
+		if (payload_size < 5) {
+			return;
+		}
+		const uint8_t *payload = &(*payload_.first);
+		uint32_t requested = schema::loadBigEndian<uint32_t>(payload + 1);
+
+		// a field only counts as present if the payload really contains it
+		mask_ = ValuesSchema::decodeSelected(payload, payload_size, 5, requested, data_);
+		if (!has(TEMP_MOS)) {
+			// the group may have been cut after its first temperature
+			data_.temp_mos1 = data_.temp_mos2 = data_.temp_mos3 = 0.0;
+		}
 	}
 
-	double VescPacketValues::rpm() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 23)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 24)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 25)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 26)))
-		);
-		return static_cast<double>(v) / 1.0;
-	}
+	REGISTER_PACKET_TYPE(COMM_GET_VALUES_SELECTIVE, VescPacketValuesSelective)
 
-	double VescPacketValues::v_in() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 27)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 28)))
-		);
-		return static_cast<double>(v) / 10.0;
-	}
+	VescPacketRequestValuesSelective::VescPacketRequestValuesSelective(uint32_t mask)
+		: VescPacket("RequestValuesSelective", 5, COMM_GET_VALUES_SELECTIVE) {
+		schema::storeBigEndian<uint32_t>(&(*(payload_.first + 1)), mask);
 
-	double VescPacketValues::amp_hours() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 29)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 30)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 31)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 32)))
-		);
-		return static_cast<double>(v) / 1e4;
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
-	double VescPacketValues::amp_hours_charged() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 33)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 34)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 35)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 36)))
-		);
-		return static_cast<double>(v) / 1e4;
-	}
+/*------------------------------------------------------------------------------------------------*/
 
-	double VescPacketValues::watt_hours() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 37)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 38)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 39)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 40)))
-		);
-		return static_cast<double>(v) / 1e4;
+	namespace {
+		typedef VescImuData I;
+		typedef VescPacketImuData Imu;
+
+		/**
+		 * Payload of the reply to COMM_GET_IMU_DATA with all fields, each is a float32_auto. Like
+		 * COMM_GET_VALUES_SELECTIVE the reply only contains the fields selected by its mask.
+		 */
+		using ImuSchema = Schema<
+			SchemaField<&I::roll, F, 3, 1, Imu::ROLL>,
+			SchemaField<&I::pitch, F, 7, 1, Imu::PITCH>,
+			SchemaField<&I::yaw, F, 11, 1, Imu::YAW>,
+			SchemaField<&I::acc_x, F, 15, 1, Imu::ACC_X>,
+			SchemaField<&I::acc_y, F, 19, 1, Imu::ACC_Y>,
+			SchemaField<&I::acc_z, F, 23, 1, Imu::ACC_Z>,
+			SchemaField<&I::gyro_x, F, 27, 1, Imu::GYRO_X>,
+			SchemaField<&I::gyro_y, F, 31, 1, Imu::GYRO_Y>,
+			SchemaField<&I::gyro_z, F, 35, 1, Imu::GYRO_Z>,
+			SchemaField<&I::mag_x, F, 39, 1, Imu::MAG_X>,
+			SchemaField<&I::mag_y, F, 43, 1, Imu::MAG_Y>,
+			SchemaField<&I::mag_z, F, 47, 1, Imu::MAG_Z>,
+			SchemaField<&I::q0, F, 51, 1, Imu::Q0>,
+			SchemaField<&I::q1, F, 55, 1, Imu::Q1>,
+			SchemaField<&I::q2, F, 59, 1, Imu::Q2>,
+			SchemaField<&I::q3, F, 63, 1, Imu::Q3>>;
+
+		static_assert(ImuSchema::SIZE == 67, "COMM_GET_IMU_DATA payload size");
+	}  // namespace
+
+	VescPacketImuData::VescPacketImuData(std::shared_ptr<VescFrame> raw)
+		: VescPacket("ImuData", raw), mask_(0) {
+		const size_t payload_size = std::distance(payload_.first, payload_.second);
+		if (payload_size < 3) {
+			return;
+		}
+		const uint8_t *payload = &(*payload_.first);
+		uint32_t requested = schema::loadBigEndian<uint16_t>(payload + 1);
+		mask_ = ImuSchema::decodeSelected(payload, payload_size, 3, requested, data_);
 	}
 
-	double VescPacketValues::watt_hours_charged() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 41)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 42)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 43)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 44)))
-		);
-		return static_cast<double>(v) / 1e4;
-	}
+	REGISTER_PACKET_TYPE(COMM_GET_IMU_DATA, VescPacketImuData)
 
-	int32_t VescPacketValues::tachometer() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 45)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 46)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 47)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 48)))
-		);
-		return static_cast<int32_t>(v);
-	}
+	VescPacketRequestImuData::VescPacketRequestImuData(uint32_t mask)
+		: VescPacket("RequestImuData", 3, COMM_GET_IMU_DATA) {
+		schema::storeBigEndian<uint16_t>(
+			&(*(payload_.first + 1)), static_cast<uint16_t>(mask & VescPacketImuData::ALL_FIELDS));
 
-	int32_t VescPacketValues::tachometer_abs() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 49)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 50)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 51)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 52)))
-		);
-		return static_cast<int32_t>(v);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
 
-	int VescPacketValues::fault_code() const {
-		return static_cast<int32_t>(*(payload_.first + 53));
-	}
+/*------------------------------------------------------------------------------------------------*/
 
+	namespace {
+		typedef VescPacketPlotData::Point P;
+		typedef VescSampleData D;
+
+		/** Payload of COMM_PLOT_DATA */
+		using PlotDataSchema = Schema<
+			SchemaField<&P::x, schema::Float32Auto, 1>,
+			SchemaField<&P::y, schema::Float32Auto, 5>>;
+
+		/** Payload of COMM_SAMPLE_PRINT */
+		using SamplePrintSchema = Schema<
+			SchemaField<&D::curr0, schema::Float32Auto, 1>,
+			SchemaField<&D::curr1, schema::Float32Auto, 5>,
+			SchemaField<&D::ph1, schema::Float32Auto, 9>,
+			SchemaField<&D::ph2, schema::Float32Auto, 13>,
+			SchemaField<&D::ph3, schema::Float32Auto, 17>,
+			SchemaField<&D::vzero, schema::Float32Auto, 21>,
+			SchemaField<&D::curr_fir, schema::Float32Auto, 25>,
+			SchemaField<&D::f_sw, schema::Float32Auto, 29>,
+			SchemaField<&D::status, uint8_t, 33>,
+			SchemaField<&D::phase, uint8_t, 34>>;
+
+		static_assert(SamplePrintSchema::SIZE == 35, "COMM_SAMPLE_PRINT payload size");
+
+		/** Reads the zero terminated string at @p *it (or up to @p end) and moves @p *it past it. */
+		std::string readString(Buffer::const_iterator *it, Buffer::const_iterator end) {
+			Buffer::const_iterator terminator = std::find(*it, end, 0);
+			std::string str(*it, terminator);
+			*it = terminator == end ? end : terminator + 1;
+			return str;
+		}
+	}  // namespace
 
-	double VescPacketValues::pid_pos_now() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 54)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 55)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 56)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 57)))
-		);
-		return static_cast<double>(v) / 1e6;
+	VescPacketPlotInit::VescPacketPlotInit(std::shared_ptr<VescFrame> raw)
+		: VescPacket("PlotInit", raw) {
+		Buffer::const_iterator it = payload_.first + 1;
+		name_x_ = readString(&it, payload_.second);
+		name_y_ = readString(&it, payload_.second);
 	}
 
-	int32_t VescPacketValues::controller_id() const {
-		int32_t v = static_cast<int32_t>((static_cast<uint32_t>(*(payload_.first + 58))));
+	REGISTER_PACKET_TYPE(COMM_PLOT_INIT, VescPacketPlotInit)
 
-		return static_cast<int32_t>(v);
+	VescPacketPlotAddGraph::VescPacketPlotAddGraph(std::shared_ptr<VescFrame> raw)
+		: VescPacket("PlotAddGraph", raw) {
+		Buffer::const_iterator it = payload_.first + 1;
+		graph_name_ = readString(&it, payload_.second);
 	}
 
-	double VescPacketValues::temp_mos1() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 59)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 60)))
-		);
-		return static_cast<double>(v) / 10.0;
-	}
+	REGISTER_PACKET_TYPE(COMM_PLOT_ADD_GRAPH, VescPacketPlotAddGraph)
 
-	double VescPacketValues::temp_mos2() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 61)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 62)))
-		);
-		return static_cast<double>(v) / 10.0;
+	VescPacketPlotSetGraph::VescPacketPlotSetGraph(std::shared_ptr<VescFrame> raw)
+		: VescPacket("PlotSetGraph", raw) {
+		graph_ = std::distance(payload_.first, payload_.second) > 1 ? *(payload_.first + 1) : 0;
 	}
 
-	double VescPacketValues::temp_mos3() const {
-		int16_t v = static_cast<int16_t>(
-			(static_cast<uint16_t>(*(payload_.first + 63)) << 8) +
-			(static_cast<uint16_t>(*(payload_.first + 64)))
-		);
-		return static_cast<double>(v) / 10.0;
-	}
+	REGISTER_PACKET_TYPE(COMM_PLOT_SET_GRAPH, VescPacketPlotSetGraph)
 
-	double VescPacketValues::avg_vd() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 65)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 66)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 67)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 68)))
-		);
-		return static_cast<double>(v) / 1e3;
+	VescPacketPlotData::VescPacketPlotData(std::shared_ptr<VescFrame> raw)
+		: VescPacket("PlotData", raw) {
+		PlotDataSchema::decode(
+			&(*payload_.first), std::distance(payload_.first, payload_.second), point_);
 	}
 
+	REGISTER_PACKET_TYPE(COMM_PLOT_DATA, VescPacketPlotData)
 
-	double VescPacketValues::avg_vq() const {
-		int32_t v = static_cast<int32_t>(
-			(static_cast<uint32_t>(*(payload_.first + 69)) << 24) +
-			(static_cast<uint32_t>(*(payload_.first + 70)) << 16) +
-			(static_cast<uint32_t>(*(payload_.first + 71)) << 8) +
-			(static_cast<uint32_t>(*(payload_.first + 72)))
-		);
-		return static_cast<double>(v) / 1e3;
+	VescPacketSamplePrint::VescPacketSamplePrint(std::shared_ptr<VescFrame> raw)
+		: VescPacket("SamplePrint", raw) {
+		SamplePrintSchema::decode(
+			&(*payload_.first), std::distance(payload_.first, payload_.second), data_);
 	}
 
-
-	REGISTER_PACKET_TYPE(COMM_GET_VALUES, VescPacketValues)
-
-	VescPacketRequestValues::VescPacketRequestValues()
-		: VescPacket("RequestValues", 1, COMM_GET_VALUES) {
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
-		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
-		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
-	}
+	REGISTER_PACKET_TYPE(COMM_SAMPLE_PRINT, VescPacketSamplePrint)
 
 /*------------------------------------------------------------------------------------------------*/
 
@@ -354,15 +440,10 @@ namespace vesc_driver {
 		: VescPacket("SetDuty", 5, COMM_SET_DUTY) {
 		/** @todo range check duty */
 
-		int32_t v = static_cast<int32_t>(duty * 100000.0);
+		CommandSchema<int32_t, 100000>::encode(CommandValue{duty}, &(*payload_.first));
 
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 24) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 16) & 0xFF);
-		*(payload_.first + 3) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 4) = static_cast<uint8_t>(static_cast<uint32_t>(v) & 0xFF);
-
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
@@ -371,15 +452,10 @@ namespace vesc_driver {
 
 	VescPacketSetCurrent::VescPacketSetCurrent(double current)
 		: VescPacket("SetCurrent", 5, COMM_SET_CURRENT) {
-		int32_t v = static_cast<int32_t>(current * 1000.0);
-
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 24) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 16) & 0xFF);
-		*(payload_.first + 3) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 4) = static_cast<uint8_t>(static_cast<uint32_t>(v) & 0xFF);
+		CommandSchema<int32_t, 1000>::encode(CommandValue{current}, &(*payload_.first));
 
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
@@ -388,15 +464,10 @@ namespace vesc_driver {
 
 	VescPacketSetCurrentBrake::VescPacketSetCurrentBrake(double current_brake)
 		: VescPacket("SetCurrentBrake", 5, COMM_SET_CURRENT_BRAKE) {
-		int32_t v = static_cast<int32_t>(current_brake * 1000.0);
-
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 24) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 16) & 0xFF);
-		*(payload_.first + 3) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 4) = static_cast<uint8_t>(static_cast<uint32_t>(v) & 0xFF);
+		CommandSchema<int32_t, 1000>::encode(CommandValue{current_brake}, &(*payload_.first));
 
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
@@ -405,15 +476,10 @@ namespace vesc_driver {
 
 	VescPacketSetRPM::VescPacketSetRPM(double rpm)
 		: VescPacket("SetRPM", 5, COMM_SET_RPM) {
-		int32_t v = static_cast<int32_t>(rpm);
+		CommandSchema<int32_t, 1>::encode(CommandValue{rpm}, &(*payload_.first));
 
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 24) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 16) & 0xFF);
-		*(payload_.first + 3) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 4) = static_cast<uint8_t>(static_cast<uint32_t>(v) & 0xFF);
-
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
@@ -424,15 +490,10 @@ namespace vesc_driver {
 		: VescPacket("SetPos", 5, COMM_SET_POS) {
 		/** @todo range check pos */
 
-		int32_t v = static_cast<int32_t>(pos * 1000000.0);
-
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 24) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 16) & 0xFF);
-		*(payload_.first + 3) = static_cast<uint8_t>((static_cast<uint32_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 4) = static_cast<uint8_t>(static_cast<uint32_t>(v) & 0xFF);
+		CommandSchema<int32_t, 1000000>::encode(CommandValue{pos}, &(*payload_.first));
 
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
 	}
@@ -443,15 +504,168 @@ namespace vesc_driver {
 		: VescPacket("SetServoPos", 3, COMM_SET_SERVO_POS) {
 		/** @todo range check pos */
 
-		int16_t v = static_cast<int16_t>(servo_pos * 1000.0);
+		CommandSchema<int16_t, 1000>::encode(CommandValue{servo_pos}, &(*payload_.first));
+
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
+	}
+
+/*------------------------------------------------------------------------------------------------*/
+
+	namespace {
+
+		/**
+		 * Writes the COMM_FORWARD_CAN prefix (if @p can_id >= 0) and @p payload_id to @p payload.
+		 *
+		 * @return Iterator to the first byte after the payload id.
+		 */
+		Buffer::iterator writeUploadHeader(Buffer::iterator payload, int payload_id, int can_id) {
+			assert(can_id < 256);
+			if (can_id >= 0) {
+				*payload++ = COMM_FORWARD_CAN;
+				*payload++ = static_cast<uint8_t>(can_id);
+			}
+			*payload++ = static_cast<uint8_t>(payload_id);
+			return payload;
+		}
+
+		int uploadPayloadId(int can_id, int payload_id) {
+			return can_id >= 0 ? COMM_FORWARD_CAN : payload_id;
+		}
+
+	}  // namespace
+
+	VescPacketEraseNewApp::VescPacketEraseNewApp(uint32_t size, bool all_can, int can_id)
+		: VescPacket(
+			  "EraseNewApp", (can_id >= 0 ? 2 : 0) + 5,
+			  uploadPayloadId(can_id, all_can ? COMM_ERASE_NEW_APP_ALL_CAN : COMM_ERASE_NEW_APP)) {
+		Buffer::iterator it = writeUploadHeader(
+			payload_.first, all_can ? COMM_ERASE_NEW_APP_ALL_CAN : COMM_ERASE_NEW_APP, can_id);
+		schema::storeBigEndian<uint32_t>(&(*it), size);
+
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
+	}
+
+	VescPacketEraseNewAppResult::VescPacketEraseNewAppResult(std::shared_ptr<VescFrame> raw)
+		: VescPacket("EraseNewAppResult", raw) {
+		ok_ = std::distance(payload_.first, payload_.second) >= 2 && *(payload_.first + 1) != 0;
+	}
+
+	REGISTER_PACKET_TYPE(COMM_ERASE_NEW_APP, VescPacketEraseNewAppResult)
+	// the reply of the _ALL_CAN variant has its own id, but the same layout
+	static PacketFactoryTemplate<VescPacketEraseNewAppResult> global_EraseNewAppAllCanResultFactory(
+		COMM_ERASE_NEW_APP_ALL_CAN);
+
+	VescPacketWriteNewAppData::VescPacketWriteNewAppData(
+		uint32_t offset, const uint8_t *data, size_t size, size_t decompressed_size, bool all_can,
+		int can_id)
+		: VescPacket(
+			  "WriteNewAppData", headerSize(decompressed_size > 0, can_id) + static_cast<int>(size),
+			  uploadPayloadId(can_id, COMM_WRITE_NEW_APP_DATA)) {
+		int payload_id;
+		if (decompressed_size > 0) {
+			payload_id = all_can ? COMM_WRITE_NEW_APP_DATA_ALL_CAN_LZO : COMM_WRITE_NEW_APP_DATA_LZO;
+		} else {
+			payload_id = all_can ? COMM_WRITE_NEW_APP_DATA_ALL_CAN : COMM_WRITE_NEW_APP_DATA;
+		}
+		Buffer::iterator it = writeUploadHeader(payload_.first, payload_id, can_id);
+		schema::storeBigEndian<uint32_t>(&(*it), offset);
+		it += 4;
+		if (decompressed_size > 0) {
+			assert(decompressed_size <= UINT16_MAX);
+			schema::storeBigEndian<uint16_t>(&(*it), static_cast<uint16_t>(decompressed_size));
+			it += 2;
+		}
+		std::copy(data, data + size, it);
+
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
+	}
+
+	VescPacketWriteNewAppDataResult::VescPacketWriteNewAppDataResult(std::shared_ptr<VescFrame> raw)
+		: VescPacket("WriteNewAppDataResult", raw), offset_(0) {
+		const size_t payload_size = std::distance(payload_.first, payload_.second);
+		ok_ = payload_size >= 2 && *(payload_.first + 1) != 0;
+		has_offset_ = payload_size >= 6;
+		if (has_offset_) {
+			offset_ = schema::loadBigEndian<uint32_t>(&(*(payload_.first + 2)));
+		}
+	}
+
+	REGISTER_PACKET_TYPE(COMM_WRITE_NEW_APP_DATA, VescPacketWriteNewAppDataResult)
+	static PacketFactoryTemplate<VescPacketWriteNewAppDataResult>
+	global_WriteNewAppDataAllCanResultFactory(COMM_WRITE_NEW_APP_DATA_ALL_CAN);
+	static PacketFactoryTemplate<VescPacketWriteNewAppDataResult>
+	global_WriteNewAppDataLzoResultFactory(COMM_WRITE_NEW_APP_DATA_LZO);
+	static PacketFactoryTemplate<VescPacketWriteNewAppDataResult>
+	global_WriteNewAppDataAllCanLzoResultFactory(COMM_WRITE_NEW_APP_DATA_ALL_CAN_LZO);
+
+	VescPacketJumpToBootloader::VescPacketJumpToBootloader(bool all_can, int can_id)
+		: VescPacket(
+			  "JumpToBootloader", (can_id >= 0 ? 2 : 0) + 1,
+			  uploadPayloadId(
+				  can_id, all_can ? COMM_JUMP_TO_BOOTLOADER_ALL_CAN : COMM_JUMP_TO_BOOTLOADER)) {
+		writeUploadHeader(
+			payload_.first, all_can ? COMM_JUMP_TO_BOOTLOADER_ALL_CAN : COMM_JUMP_TO_BOOTLOADER, can_id);
+
+		uint16_t crc = VescCrc::calculate(
+			&(*payload_.first), std::distance(payload_.first, payload_.second));
+		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
+		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
+	}
+
+/*------------------------------------------------------------------------------------------------*/
+
+	VescCommandFrame::VescCommandFrame(int payload_id, int value_size, double scale, int can_id)
+		: VescFrame((can_id >= 0 ? 3 : 1) + value_size), value_offset_(can_id >= 0 ? 3 : 1),
+		  value_size_(value_size), scale_(scale) {
+		assert(payload_id >= 0 && payload_id < 256);
+		assert(can_id < 256);
+		assert(value_size == 0 || value_size == 2 || value_size == 4);
+		if (can_id >= 0) {
+			*payload_.first = COMM_FORWARD_CAN;
+			*(payload_.first + 1) = static_cast<uint8_t>(can_id);
+		}
+		*(payload_.first + value_offset_ - 1) = payload_id;
+		id_crc_ = VescCrc::calculate(&(*payload_.first), value_offset_);
+		encode(0.0);
+	}
+
+	const Buffer &VescCommandFrame::encode(double value) {
+		Buffer::iterator it = payload_.first + value_offset_;
+		if (value_size_ == 4) {
+			schema::storeBigEndian<int32_t>(&(*it), static_cast<int32_t>(value * scale_));
+		} else if (value_size_ == 2) {
+			schema::storeBigEndian<int16_t>(&(*it), static_cast<int16_t>(value * scale_));
+		}
+		return updateCrc();
+	}
 
-		*(payload_.first + 1) = static_cast<uint8_t>((static_cast<uint16_t>(v) >> 8) & 0xFF);
-		*(payload_.first + 2) = static_cast<uint8_t>(static_cast<uint16_t>(v) & 0xFF);
+	const Buffer &VescCommandFrame::encodeRaw(uint32_t value) {
+		assert(value_size_ == 4 || value <= 0xFFFF);
+		Buffer::iterator it = payload_.first + value_offset_;
+		if (value_size_ == 4) {
+			schema::storeBigEndian<uint32_t>(&(*it), value);
+		} else if (value_size_ == 2) {
+			schema::storeBigEndian<uint16_t>(&(*it), static_cast<uint16_t>(value));
+		}
+		return updateCrc();
+	}
 
-		uint16_t crc = CRC::Calculate(
-			&(*payload_.first), std::distance(payload_.first, payload_.second), VescFrame::CRC_TYPE);
+	const Buffer &VescCommandFrame::updateCrc() {
+		// continue the CRC from the constant bytes in front of the value
+		uint16_t crc = VescCrc::calculate(&(*(payload_.first + value_offset_)), value_size_, id_crc_);
 		*(frame_->end() - 3) = static_cast<uint8_t>(crc >> 8);
 		*(frame_->end() - 2) = static_cast<uint8_t>(crc & 0xFF);
+
+		return *frame_;
 	}
 
 }  // namespace vesc_driver
@@ -1,3 +1,4 @@
+#include "vesc_driver/vesc_crc.hpp"
 #include "vesc_driver/vesc_packet.hpp"
 #include "vesc_driver/vesc_packet_factory.hpp"
 
@@ -20,12 +21,35 @@ namespace vesc_driver {
 		(*p_map)[payload_id] = fn;
 	}
 
+	const char *VescPacketFactory::errorString(Error error) {
+		switch (error) {
+		case ERROR_NONE:
+			return "";
+		case ERROR_INCOMPLETE_FRAME:
+			return "Buffer does not contain a complete frame";
+		case ERROR_NO_START_OF_FRAME:
+			return "Buffer must begin with start-of-frame character";
+		case ERROR_INVALID_LENGTH:
+			return "Invalid payload length";
+		case ERROR_NO_PAYLOAD:
+			return "Frame does not have a payload";
+		case ERROR_UNKNOWN_PAYLOAD:
+			return "Unknown payload type";
+		case ERROR_INVALID_END_OF_FRAME:
+			return "Invalid end-of-frame character";
+		case ERROR_INVALID_CHECKSUM:
+			return "Invalid checksum";
+		default:
+			return "Unknown error";
+		}
+	}
+
 	/** Helper function for when createPacket can not create a packet */
-	VescPacketPtr createFailed(
-		int *p_num_bytes_needed, std::string *p_what,
-		const std::string &what, int num_bytes_needed = 0) {
+	static VescPacketPtr createFailed(
+		int *p_num_bytes_needed, VescPacketFactory::Error *p_error,
+		VescPacketFactory::Error error, int num_bytes_needed = 0) {
 		if (p_num_bytes_needed != NULL) { *p_num_bytes_needed = num_bytes_needed; }
-		if (p_what != NULL) { *p_what = what; }
+		if (p_error != NULL) { *p_error = error; }
 		return VescPacketPtr();
 	}
 
@@ -33,86 +57,106 @@ namespace vesc_driver {
 		const Buffer::const_iterator &begin,
 		const Buffer::const_iterator &end,
 		int *num_bytes_needed, std::string *what) {
+		const size_t size = std::distance(begin, end);
+		return createPacket(BufferView(size > 0 ? &(*begin) : nullptr, size), num_bytes_needed, what);
+	}
+
+	VescPacketPtr VescPacketFactory::createPacket(
+		const BufferView &buffer,
+		int *num_bytes_needed, std::string *what) {
+		Error error;
+		VescPacketPtr packet = createPacket(buffer, num_bytes_needed, &error);
+		if (what != NULL) { *what = errorString(error); }
+		return packet;
+	}
+
+	/** CRC of @p size bytes of @p view starting at @p offset, the bytes may wrap around */
+	static uint16_t calculateCrc(const BufferView &view, size_t offset, size_t size) {
+		BufferView data(view.subview(offset, size));
+		uint16_t crc = VescCrc::calculate(data.segment(0), data.segmentSize(0));
+		return VescCrc::calculate(data.segment(1), data.segmentSize(1), crc);
+	}
+
+	VescPacketPtr VescPacketFactory::createPacket(
+		const BufferView &buffer,
+		int *num_bytes_needed, Error *error) {
 		// initialize output variables
 		if (num_bytes_needed != NULL) { *num_bytes_needed = 0; }
-		if (what != NULL) { what->clear(); }
+		if (error != NULL) { *error = ERROR_NONE; }
 
 		// need at least VESC_MIN_FRAME_SIZE bytes in buffer
-		int buffer_size(std::distance(begin, end));
+		int buffer_size(buffer.size());
 		if (buffer_size < VescFrame::VESC_MIN_FRAME_SIZE) {
 			return createFailed(
-				num_bytes_needed, what, "Buffer does not contain a complete frame",
+				num_bytes_needed, error, ERROR_INCOMPLETE_FRAME,
 				VescFrame::VESC_MIN_FRAME_SIZE - buffer_size);
 		}
 
 		// buffer must begin with a start-of-frame
-		if (VescFrame::VESC_SOF_VAL_SMALL_FRAME != *begin &&
-			VescFrame::VESC_SOF_VAL_LARGE_FRAME != *begin) {
-			return createFailed(num_bytes_needed, what, "Buffer must begin with start-of-frame character");
+		if (VescFrame::VESC_SOF_VAL_SMALL_FRAME != buffer[0] &&
+			VescFrame::VESC_SOF_VAL_LARGE_FRAME != buffer[0]) {
+			return createFailed(num_bytes_needed, error, ERROR_NO_START_OF_FRAME);
 		}
 
-		// get a view of the payload
-		BufferRangeConst view_payload;
-		if (VescFrame::VESC_SOF_VAL_SMALL_FRAME == *begin) {
+		// get the position and size of the payload
+		int payload_offset;
+		int payload_size;
+		if (VescFrame::VESC_SOF_VAL_SMALL_FRAME == buffer[0]) {
 			// payload size field is one byte
-			view_payload.first = begin + 2;
-			view_payload.second = view_payload.first + *(begin + 1);
+			payload_offset = 2;
+			payload_size = buffer[1];
 		} else {
-			assert(VescFrame::VESC_SOF_VAL_LARGE_FRAME == *begin);
+			assert(VescFrame::VESC_SOF_VAL_LARGE_FRAME == buffer[0]);
 			// payload size field is two bytes
-			view_payload.first = begin + 3;
-			view_payload.second = view_payload.first + (*(begin + 1) << 8) + *(begin + 2);
+			payload_offset = 3;
+			payload_size = (buffer[1] << 8) + buffer[2];
 		}
 
 		// check length
-		if (std::distance(view_payload.first, view_payload.second) > VescFrame::VESC_MAX_PAYLOAD_SIZE) {
-			return createFailed(num_bytes_needed, what, "Invalid payload length");
+		if (payload_size > VescFrame::VESC_MAX_PAYLOAD_SIZE) {
+			return createFailed(num_bytes_needed, error, ERROR_INVALID_LENGTH);
+		}
+		if (payload_size == 0) {
+			return createFailed(num_bytes_needed, error, ERROR_NO_PAYLOAD);
 		}
 
-		// get iterators to crc field, end-of-frame field, and a view of the whole frame
-		Buffer::const_iterator iter_crc(view_payload.second);
-		Buffer::const_iterator iter_eof(iter_crc + 2);
-		BufferRangeConst view_frame(begin, iter_eof + 1);
+		// the payload id is within the minimal frame, reject unknown ones before waiting for the rest
+		FactoryMap *p_map(getMap());
+		FactoryMap::const_iterator search(p_map->find(buffer[payload_offset]));
+		if (search == p_map->end()) {
+			return createFailed(num_bytes_needed, error, ERROR_UNKNOWN_PAYLOAD);
+		}
+
+		// get offsets of the crc field, end-of-frame field, and the size of the whole frame
+		int crc_offset = payload_offset + payload_size;
+		int eof_offset = crc_offset + 2;
+		int frame_size = eof_offset + 1;
 
 		// do we have enough data in the buffer to complete the frame?
-		int frame_size = std::distance(view_frame.first, view_frame.second);
 		if (buffer_size < frame_size) {
 			return createFailed(
-				num_bytes_needed, what, "Buffer does not contain a complete frame",
-				frame_size - buffer_size);
+				num_bytes_needed, error, ERROR_INCOMPLETE_FRAME, frame_size - buffer_size);
 		}
 
 		// is the end-of-frame character valid?
-		if (VescFrame::VESC_EOF_VAL != *iter_eof) {
-			return createFailed(num_bytes_needed, what, "Invalid end-of-frame character");
+		if (VescFrame::VESC_EOF_VAL != buffer[eof_offset]) {
+			return createFailed(num_bytes_needed, error, ERROR_INVALID_END_OF_FRAME);
 		}
 
 		// is the crc valid?
-		uint16_t crc = (static_cast<uint16_t>(*iter_crc) << 8) + *(iter_crc + 1);
-		if (crc != CRC::Calculate(
-			&(*view_payload.first), std::distance(view_payload.first, view_payload.second),
-			VescFrame::CRC_TYPE)) {
-			return createFailed(num_bytes_needed, what, "Invalid checksum");
+		uint16_t crc = (static_cast<uint16_t>(buffer[crc_offset]) << 8) + buffer[crc_offset + 1];
+		if (crc != calculateCrc(buffer, payload_offset, payload_size)) {
+			return createFailed(num_bytes_needed, error, ERROR_INVALID_CHECKSUM);
 		}
 
-		// frame looks good, construct the raw frame
-		std::shared_ptr<VescFrame> raw_frame(new VescFrame(view_frame, view_payload));
-
-		// if the packet has a payload, construct the corresponding subclass
-		if (std::distance(view_payload.first, view_payload.second) > 0) {
-			// get constructor function from payload id
-			FactoryMap *p_map(getMap());
-			FactoryMap::const_iterator search(p_map->find(*view_payload.first));
-			if (search != p_map->end()) {
-				return search->second(raw_frame);
-			} else {
-				// no subclass constructor for this packet
-				return createFailed(num_bytes_needed, what, "Unknown payload type.");
-			}
-		} else {
-			// no payload
-			return createFailed(num_bytes_needed, what, "Frame does not have a payload");
-		}
+		// frame looks good, construct the raw frame (its data lives in a pooled buffer)
+		VescFrame frame(buffer.subview(0, frame_size), payload_offset, payload_size);
+		// packets copy the raw frame (sharing the pooled buffer) during construction, so it can be
+		// handed to them through a non-owning pointer instead of allocating a control block for it
+		std::shared_ptr<VescFrame> raw_frame(std::shared_ptr<VescFrame>(), &frame);
+
+		// construct the subclass registered for the payload id
+		return search->second(raw_frame);
 	}
 
 }  // namespace vesc_driver
@@ -0,0 +1,92 @@
+#include "vesc_driver/vesc_replay_port.hpp"
+
+#include <chrono>
+#include <utility>
+
+namespace vesc_driver {
+
+	VescReplayPort::VescReplayPort(double speed, std::function<void()> end_handler)
+		: speed_(speed), end_handler_(std::move(end_handler)) {
+	}
+
+	VescReplayPort::~VescReplayPort() {
+		close();
+	}
+
+	void VescReplayPort::open(const std::string &device, const ReceiveHandler &handler) {
+		close();
+		reader_.reset(new VescCaptureReader(device));
+		run_ = true;
+		thread_ = std::thread(&VescReplayPort::replay, this, handler);
+	}
+
+	void VescReplayPort::close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			run_ = false;
+		}
+		cv_.notify_all();
+		if (thread_.joinable()) {
+			thread_.join();
+		}
+		reader_.reset();
+	}
+
+	bool VescReplayPort::isOpen() const {
+		return reader_ != nullptr;
+	}
+
+	size_t VescReplayPort::send(const Buffer &data) {
+		return data.size();
+	}
+
+	void VescReplayPort::replay(ReceiveHandler handler) {
+		typedef std::chrono::steady_clock Clock;
+		// time of the first chunk in the capture and when it is replayed
+		bool started = false;
+		int64_t capture_start = 0;
+		Clock::time_point replay_start;
+
+		VescCaptureReader::Record record;
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (run_ && reader_->next(&record)) {
+			if (record.tx) {
+				continue;
+			}
+			if (!started) {
+				started = true;
+				capture_start = record.time_ns;
+				replay_start = Clock::now();
+			}
+			if (speed_ > 0.0) {
+				auto due = replay_start + std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double, std::nano>((record.time_ns - capture_start) / speed_));
+				if (cv_.wait_until(lock, due, [this]() { return !run_; })) {
+					break;
+				}
+			}
+
+			// the handler is called without the lock, close() only has to wait for it to return
+			lock.unlock();
+			size_t offset = handler(record.data, record.size, Clock::time_point());
+			while (offset < record.size) {
+				// the receiver is full, wait for it to catch up
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+				lock.lock();
+				bool run = run_;
+				lock.unlock();
+				if (!run) {
+					break;
+				}
+				offset += handler(record.data + offset, record.size - offset, Clock::time_point());
+			}
+			lock.lock();
+		}
+		bool finished = run_;
+		lock.unlock();
+		if (finished && end_handler_) {
+			end_handler_();
+		}
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,198 @@
+#include "vesc_driver/vesc_sample_sink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace vesc_driver {
+
+	constexpr char VescSampleFile::MAGIC[8];
+
+	namespace {
+
+		void putLe(uint8_t *dst, uint64_t value, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				dst[i] = static_cast<uint8_t>(value >> (8 * i));
+			}
+		}
+
+		std::string sinkError(const char *what, const std::string &path) {
+			return std::string(what) + " " + path + ": " + std::strerror(errno);
+		}
+
+	}  // namespace
+
+	VescSampleSink::VescSampleSink(size_t column_count, size_t chunk_rows, size_t chunk_count)
+		: column_count_(column_count), chunk_rows_(chunk_rows), chunks_(chunk_count), current_(nullptr),
+		  stopping_(false), file_(nullptr), rows_written_(0), rows_dropped_(0) {
+		// all the memory the producer ever touches, allocated up front
+		for (Chunk &chunk : chunks_) {
+			chunk.values.resize(column_count_ * chunk_rows_);
+			free_.push_back(&chunk);
+		}
+		ops_.reserve(chunk_count + 8);
+		writer_ = std::thread(&VescSampleSink::writerThread, this);
+	}
+
+	VescSampleSink::~VescSampleSink() {
+		submitCurrent();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_one();
+		writer_.join();
+	}
+
+	void VescSampleSink::open(const std::string &path, const std::vector<std::string> &columns) {
+		submitCurrent();
+		Op op;
+		op.path = path;
+		op.columns = columns;
+		op.columns.resize(column_count_);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			ops_.push_back(std::move(op));
+		}
+		cv_.notify_one();
+	}
+
+	void VescSampleSink::append(const float *row) {
+		if (!current_) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (free_.empty()) {
+				rows_dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			current_ = free_.back();
+			free_.pop_back();
+		}
+		float *values = current_->values.data() + current_->rows;
+		for (size_t c = 0; c < column_count_; c++) {
+			values[c * chunk_rows_] = row[c];
+		}
+		if (++current_->rows == chunk_rows_) {
+			submitCurrent();
+		}
+	}
+
+	std::string VescSampleSink::error() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return error_;
+	}
+
+	/** Hands the chunk being filled (if not empty) over to the writer and takes a free one. */
+	void VescSampleSink::submitCurrent() {
+		if (!current_ || current_->rows == 0) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Op op;
+			op.chunk = current_;
+			ops_.push_back(std::move(op));
+			current_ = nullptr;
+			if (!free_.empty()) {
+				current_ = free_.back();
+				free_.pop_back();
+			}
+		}
+		cv_.notify_one();
+	}
+
+	void VescSampleSink::writerThread() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			cv_.wait(lock, [this]() { return stopping_ || !ops_.empty(); });
+			if (ops_.empty()) {
+				break;
+			}
+			Op op = std::move(ops_.front());
+			ops_.erase(ops_.begin());
+			lock.unlock();
+
+			if (op.chunk) {
+				writeChunk(*op.chunk);
+				op.chunk->rows = 0;
+			} else {
+				openFile(op);
+			}
+
+			lock.lock();
+			if (op.chunk) {
+				free_.push_back(op.chunk);
+			}
+		}
+		lock.unlock();
+		closeFile();
+	}
+
+	void VescSampleSink::openFile(const Op &op) {
+		closeFile();
+		file_ = std::fopen(op.path.c_str(), "wb");
+		if (!file_) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			error_ = sinkError("Failed to create sample file", op.path);
+			return;
+		}
+		path_ = op.path;
+		std::setvbuf(file_, nullptr, _IOFBF, 1 << 16);
+
+		std::vector<uint8_t> header(VescSampleFile::MAGIC, VescSampleFile::MAGIC + 8);
+		header.resize(12);
+		putLe(header.data() + 8, column_count_, 4);
+		for (const std::string &name : op.columns) {
+			const size_t size = std::min(name.size(), static_cast<size_t>(UINT16_MAX));
+			uint8_t length[2];
+			putLe(length, size, 2);
+			header.insert(header.end(), length, length + 2);
+			header.insert(header.end(), name.begin(), name.begin() + size);
+		}
+		if (std::fwrite(header.data(), 1, header.size(), file_) != header.size()) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			error_ = sinkError("Failed to write sample file", path_);
+			closeFile();
+		}
+	}
+
+	void VescSampleSink::writeChunk(Chunk &chunk) {
+		if (!file_) {
+			rows_dropped_.fetch_add(chunk.rows, std::memory_order_relaxed);
+			return;
+		}
+		uint8_t header[4];
+		putLe(header, chunk.rows, 4);
+		bool written = std::fwrite(header, 1, sizeof(header), file_) == sizeof(header);
+		for (size_t c = 0; c < column_count_ && written; c++) {
+			float *values = chunk.values.data() + c * chunk_rows_;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			for (size_t r = 0; r < chunk.rows; r++) {
+				uint32_t bits;
+				std::memcpy(&bits, &values[r], sizeof(bits));
+				bits = __builtin_bswap32(bits);
+				std::memcpy(&values[r], &bits, sizeof(bits));
+			}
+#endif
+			written = std::fwrite(values, sizeof(float), chunk.rows, file_) == chunk.rows;
+		}
+		if (!written) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				error_ = sinkError("Failed to write sample file", path_);
+			}
+			rows_dropped_.fetch_add(chunk.rows, std::memory_order_relaxed);
+			closeFile();
+			return;
+		}
+		rows_written_.fetch_add(chunk.rows, std::memory_order_relaxed);
+	}
+
+	void VescSampleSink::closeFile() {
+		if (file_) {
+			std::fclose(file_);
+			file_ = nullptr;
+		}
+	}
+
+}  // namespace vesc_driver
@@ -0,0 +1,86 @@
+#include "vesc_driver/vesc_telemetry_window.hpp"
+
+#include <algorithm>
+
+namespace vesc_driver {
+
+	namespace {
+
+		/** Accumulates one VescTelemetrySummary::Range */
+		struct RangeAccumulator {
+			double min, max, sum;
+
+			explicit RangeAccumulator(double value) : min(value), max(value), sum(0.0) {
+			}
+
+			void add(double value) {
+				min = std::min(min, value);
+				max = std::max(max, value);
+				sum += value;
+			}
+
+			VescTelemetrySummary::Range range(size_t count) const {
+				return {min, max, sum / count};
+			}
+		};
+
+		double counterIncrease(double value, double previous) {
+			return value >= previous ? value - previous : value;
+		}
+
+	}  // namespace
+
+	VescTelemetryWindow::VescTelemetryWindow(size_t capacity)
+		: ring_(std::max<size_t>(capacity, 1)), head_(0), size_(0), first_(), has_previous_(false),
+		  previous_() {
+	}
+
+	void VescTelemetryWindow::add(const VescTelemetrySample &sample) {
+		if (size_ == 0) {
+			first_ = sample;
+		}
+		if (size_ < ring_.size()) {
+			ring_[(head_ + size_) % ring_.size()] = sample;
+			size_++;
+		} else {
+			ring_[head_] = sample;
+			head_ = (head_ + 1) % ring_.size();
+		}
+	}
+
+	VescTelemetrySummary VescTelemetryWindow::close() {
+		const VescTelemetrySample &first = ring_[head_];
+		const VescTelemetrySample &last = ring_[(head_ + size_ - 1) % ring_.size()];
+		RangeAccumulator current_motor(first.current_motor);
+		RangeAccumulator current_input(first.current_input);
+		RangeAccumulator voltage_input(first.voltage_input);
+		RangeAccumulator speed(first.speed);
+		for (size_t i = 0; i < size_; i++) {
+			const VescTelemetrySample &sample = ring_[(head_ + i) % ring_.size()];
+			current_motor.add(sample.current_motor);
+			current_input.add(sample.current_input);
+			voltage_input.add(sample.voltage_input);
+			speed.add(sample.speed);
+		}
+
+		const VescTelemetrySample &reference = has_previous_ ? previous_ : first_;
+		VescTelemetrySummary summary;
+		summary.duration = last.rx_time - first_.rx_time;
+		summary.sample_count = size_;
+		summary.current_motor = current_motor.range(size_);
+		summary.current_input = current_input.range(size_);
+		summary.voltage_input = voltage_input.range(size_);
+		summary.speed = speed.range(size_);
+		summary.charge_drawn = counterIncrease(last.charge_drawn, reference.charge_drawn);
+		summary.charge_regen = counterIncrease(last.charge_regen, reference.charge_regen);
+		summary.energy_drawn = counterIncrease(last.energy_drawn, reference.energy_drawn);
+		summary.energy_regen = counterIncrease(last.energy_regen, reference.energy_regen);
+
+		previous_ = last;
+		has_previous_ = true;
+		head_ = 0;
+		size_ = 0;
+		return summary;
+	}
+
+}  // namespace vesc_driver
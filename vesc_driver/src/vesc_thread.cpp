@@ -0,0 +1,154 @@
+#include "vesc_driver/vesc_thread.hpp"
+#include "serial_driver/serial_driver.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+namespace vesc_driver {
+
+	namespace {
+
+		// stack the thread is expected to need, touched once so that it does not page fault later
+		constexpr size_t STACK_PREFAULT_SIZE = 256 * 1024;
+
+		std::runtime_error threadError(const char *what, int error) {
+			return std::runtime_error(std::string(what) + ": " + std::strerror(error));
+		}
+
+#ifdef __linux__
+		__attribute__((noinline)) void prefaultStack() {
+			unsigned char stack[STACK_PREFAULT_SIZE];
+			std::memset(stack, 0, sizeof(stack));
+			// keeps the compiler from dropping the writes
+			asm volatile("" : : "r"(stack) : "memory");
+		}
+#endif
+
+	}  // namespace
+
+	bool parseThreadPolicy(const std::string &name, ThreadConfig::Policy *policy) {
+		if (name == "other") {
+			*policy = ThreadConfig::POLICY_DEFAULT;
+		} else if (name == "fifo") {
+			*policy = ThreadConfig::POLICY_FIFO;
+		} else if (name == "rr") {
+			*policy = ThreadConfig::POLICY_RR;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	void applyThreadConfig(const ThreadConfig &config) {
+		if (config.isDefault()) {
+			return;
+		}
+#ifdef __linux__
+		if (config.lock_memory) {
+			// current and future pages, e.g. the rings allocated by the next connect()
+			if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+				throw threadError("Failed to lock memory", errno);
+			}
+			prefaultStack();
+		}
+
+		if (!config.cpus.empty()) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			for (int cpu : config.cpus) {
+				if (cpu < 0 || cpu >= CPU_SETSIZE) {
+					throw std::runtime_error("Invalid CPU " + std::to_string(cpu));
+				}
+				CPU_SET(cpu, &cpus);
+			}
+			int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+			if (error != 0) {
+				throw threadError("Failed to set the CPU affinity", error);
+			}
+		}
+
+		if (config.policy != ThreadConfig::POLICY_DEFAULT) {
+			int policy = config.policy == ThreadConfig::POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+			if (config.priority < sched_get_priority_min(policy) ||
+				config.priority > sched_get_priority_max(policy)) {
+				throw std::runtime_error("Invalid real-time priority " + std::to_string(config.priority));
+			}
+			sched_param param{};
+			param.sched_priority = config.priority;
+			int error = pthread_setschedparam(pthread_self(), policy, &param);
+			if (error != 0) {
+				throw threadError("Failed to set the real-time scheduling policy", error);
+			}
+		}
+#else
+		throw std::runtime_error("Thread settings are only supported on Linux");
+#endif
+	}
+
+	void applyThreadConfig(
+		drivers::common::IoContext &io_context, const ThreadConfig &config,
+		std::chrono::milliseconds timeout) {
+		if (config.isDefault()) {
+			return;
+		}
+
+		// each task waits for the others, so every thread picks up exactly one of them
+		struct State {
+			std::mutex mutex;
+			std::condition_variable cv;
+			size_t arrived = 0;
+			size_t done = 0;
+			std::string error;
+		};
+		auto state = std::make_shared<State>();
+		const size_t thread_count = io_context.serviceThreadCount();
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+		for (size_t i = 0; i < thread_count; i++) {
+			io_context.post([state, thread_count, config, deadline]() {
+				std::unique_lock<std::mutex> lock(state->mutex);
+				state->arrived++;
+				state->cv.notify_all();
+				if (!state->cv.wait_until(
+						lock, deadline, [&state, thread_count]() { return state->arrived >= thread_count; })) {
+					return;
+				}
+				lock.unlock();
+				std::string error;
+				try {
+					applyThreadConfig(config);
+				} catch (const std::runtime_error &e) {
+					error = e.what();
+				}
+				lock.lock();
+				if (state->error.empty()) {
+					state->error = error;
+				}
+				state->done++;
+				state->cv.notify_all();
+			});
+		}
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		if (!state->cv.wait_until(
+				lock, deadline, [&state, thread_count]() { return state->done >= thread_count; })) {
+			throw std::runtime_error("Timed out waiting for the I/O threads");
+		}
+		if (!state->error.empty()) {
+			throw std::runtime_error(state->error);
+		}
+	}
+
+}  // namespace vesc_driver
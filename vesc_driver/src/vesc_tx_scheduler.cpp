@@ -0,0 +1,230 @@
+#include "vesc_driver/vesc_tx_scheduler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+namespace vesc_driver {
+
+	constexpr std::chrono::microseconds VescTxScheduler::LINK_LEAD;
+
+	VescTxScheduler::VescTxScheduler(size_t fifo_capacity, int fifo_priority)
+		: stopped_(false),
+		  fifo_(fifo_capacity),
+		  fifo_posted_(fifo_capacity),
+		  fifo_head_(0),
+		  fifo_size_(0),
+		  next_slot_(0),
+		  fifo_priority_(fifo_priority),
+		  link_seconds_per_byte_(0.0) {
+		for (auto &frame : fifo_) {
+			frame.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+		}
+	}
+
+	int VescTxScheduler::addSlot(int priority) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		Slot slot;
+		slot.priority = priority;
+		slot.pending = false;
+		slot.min_interval = Clock::duration::zero();
+		slot.frame.reserve(VescFrame::VESC_MAX_FRAME_SIZE);
+		slots_.push_back(std::move(slot));
+		return static_cast<int>(slots_.size() - 1);
+	}
+
+	void VescTxScheduler::setRateLimit(int slot, double max_rate_hz) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		slots_.at(slot).min_interval = max_rate_hz > 0.0 ?
+			std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / max_rate_hz)) :
+			Clock::duration::zero();
+	}
+
+	void VescTxScheduler::setLinkRate(double bytes_per_second) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		link_seconds_per_byte_ = bytes_per_second > 0.0 ? 1.0 / bytes_per_second : 0.0;
+	}
+
+	void VescTxScheduler::post(int slot, const Buffer &frame) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Slot &s = slots_[slot];
+			if (s.pending) {
+				stats_.coalesced++;
+			}
+			// capacity was reserved for the largest frame, so this does not allocate
+			s.frame.assign(frame.begin(), frame.end());
+			s.pending = true;
+			s.posted = Clock::now();
+		}
+		cv_.notify_one();
+		if (wake_up_handler_) {
+			wake_up_handler_();
+		}
+	}
+
+	void VescTxScheduler::discard(int slot) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		Slot &s = slots_[slot];
+		if (s.pending) {
+			stats_.coalesced++;
+			s.pending = false;
+		}
+	}
+
+	bool VescTxScheduler::enqueue(const Buffer &frame) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (fifo_size_ == fifo_.size()) {
+				stats_.dropped++;
+				return false;
+			}
+			const size_t tail = (fifo_head_ + fifo_size_) % fifo_.size();
+			fifo_[tail].assign(frame.begin(), frame.end());
+			fifo_posted_[tail] = Clock::now();
+			fifo_size_++;
+		}
+		cv_.notify_one();
+		if (wake_up_handler_) {
+			wake_up_handler_();
+		}
+		return true;
+	}
+
+	bool VescTxScheduler::selectNext(
+		Clock::time_point now, size_t *selected, Clock::time_point *wake_up) const {
+		bool found = false;
+		int best_priority = 0;
+		*wake_up = Clock::time_point::max();
+
+		if (fifo_size_ > 0) {
+			found = true;
+			best_priority = fifo_priority_;
+			*selected = SIZE_MAX;
+		}
+
+		// start after the slot sent last, so equal priority slots take turns (round-robin)
+		for (size_t n = 0; n < slots_.size(); n++) {
+			const size_t i = (next_slot_ + n) % slots_.size();
+			const Slot &s = slots_[i];
+			if (!s.pending) {
+				continue;
+			}
+			// rate capped slots keep their (latest) frame until they are allowed to send again
+			Clock::time_point eligible = s.last_sent + s.min_interval;
+			if (s.min_interval != Clock::duration::zero() && eligible > now) {
+				*wake_up = std::min(*wake_up, eligible);
+				continue;
+			}
+			if (!found || s.priority < best_priority) {
+				found = true;
+				best_priority = s.priority;
+				*selected = i;
+			}
+		}
+
+		return found;
+	}
+
+	bool VescTxScheduler::take(
+		Clock::time_point now, Buffer &frame, Clock::time_point *wake_up, Clock::time_point *posted) {
+		size_t selected;
+		if (!selectNext(now, &selected, wake_up)) {
+			return false;
+		}
+
+		// do not run ahead of the link, the frame would only wait in the OS buffers
+		if (link_seconds_per_byte_ > 0.0 && link_busy_until_ - LINK_LEAD > now) {
+			*wake_up = link_busy_until_ - LINK_LEAD;
+			return false;
+		}
+
+		if (selected == SIZE_MAX) {
+			Buffer &head = fifo_[fifo_head_];
+			frame.assign(head.begin(), head.end());
+			if (posted) {
+				*posted = fifo_posted_[fifo_head_];
+			}
+			fifo_head_ = (fifo_head_ + 1) % fifo_.size();
+			fifo_size_--;
+		} else {
+			Slot &s = slots_[selected];
+			frame.assign(s.frame.begin(), s.frame.end());
+			if (posted) {
+				*posted = s.posted;
+			}
+			s.pending = false;
+			s.last_sent = now;
+			next_slot_ = selected + 1;
+		}
+
+		stats_.frames++;
+		stats_.bytes += frame.size();
+		if (link_seconds_per_byte_ > 0.0) {
+			link_busy_until_ = std::max(link_busy_until_, now) +
+				std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double>(frame.size() * link_seconds_per_byte_));
+		}
+		return true;
+	}
+
+	bool VescTxScheduler::pop(Buffer &frame, Clock::time_point *posted) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (!stopped_) {
+			Clock::time_point wake_up;
+			if (take(Clock::now(), frame, &wake_up, posted)) {
+				return true;
+			}
+			if (wake_up == Clock::time_point::max()) {
+				cv_.wait(lock);
+			} else {
+				cv_.wait_until(lock, wake_up);
+			}
+		}
+		return false;
+	}
+
+	bool VescTxScheduler::tryPop(Buffer &frame, Clock::time_point *wake_up, Clock::time_point *posted) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		Clock::time_point next;
+		if (!stopped_ && take(Clock::now(), frame, &next, posted)) {
+			return true;
+		}
+		if (!stopped_) {
+			*wake_up = std::min(*wake_up, next);
+		}
+		return false;
+	}
+
+	void VescTxScheduler::setWakeUpHandler(std::function<void()> handler) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		wake_up_handler_ = std::move(handler);
+	}
+
+	void VescTxScheduler::stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopped_ = true;
+		}
+		cv_.notify_all();
+	}
+
+	void VescTxScheduler::start() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopped_ = false;
+	}
+
+	VescTxScheduler::Statistics VescTxScheduler::statistics() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		Statistics stats = stats_;
+		stats.queue_depth = fifo_size_;
+		for (const auto &s : slots_) {
+			if (s.pending) {
+				stats.queue_depth++;
+			}
+		}
+		return stats;
+	}
+
+}  // namespace vesc_driver
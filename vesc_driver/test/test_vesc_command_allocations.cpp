@@ -0,0 +1,249 @@
+/**
+ * The command path of the driver, from taking a message to queueing its frame in VescInterface,
+ * must not allocate once warmed up: an allocation there is a latency spike in the control loop.
+ * The global operator new counts the allocations of the test thread while a command is handled
+ * the way the executor does it (create_message(), handle_message(), return_message()).
+ */
+
+#include "vesc_driver/vesc_capture.hpp"
+#include "vesc_driver/vesc_driver.hpp"
+#include "vesc_test_frames.hpp"
+
+#include <ackermann_msgs/msg/ackermann_drive_stamped.hpp>
+#include <gtest/gtest.h>
+#include <rclcpp/rclcpp.hpp>
+#include <std_msgs/msg/float64.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace vesc_driver;
+using namespace vesc_driver::test;
+using ackermann_msgs::msg::AckermannDriveStamped;
+using std_msgs::msg::Float64;
+
+namespace {
+
+	// trivially initialized, so that operator new can use them on any thread at any time
+	thread_local bool counting = false;
+	thread_local size_t allocations = 0;
+
+	void *allocate(size_t size) {
+		if (counting) {
+			allocations++;
+		}
+		void *p = std::malloc(size > 0 ? size : 1);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+	void *allocateAligned(size_t size, std::align_val_t alignment) {
+		if (counting) {
+			allocations++;
+		}
+		const size_t align = static_cast<size_t>(alignment);
+		// aligned_alloc() takes multiples of the alignment only
+		void *p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+}  // namespace
+
+// the array and nothrow forms call these
+void *operator new(size_t size) {
+	return allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+	return allocateAligned(size, alignment);
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+namespace {
+
+	/** Allocations of this thread while @p f runs */
+	size_t countAllocations(const std::function<void()> &f) {
+		allocations = 0;
+		counting = true;
+		f();
+		counting = false;
+		return allocations;
+	}
+
+	rclcpp::SubscriptionBase::SharedPtr findSubscription(
+		rclcpp::Node &node, const std::string &topic) {
+		for (const auto &weak_group : node.get_node_base_interface()->get_callback_groups()) {
+			auto group = weak_group.lock();
+			if (!group) {
+				continue;
+			}
+			auto subscription = group->find_subscription_ptrs_if(
+				[&topic](const rclcpp::SubscriptionBase::SharedPtr &s) {
+					return topic == s->get_topic_name();
+				});
+			if (subscription) {
+				return subscription;
+			}
+		}
+		return nullptr;
+	}
+
+	/** Hands a message filled in by @p fill to @p subscription like the executor does */
+	template<typename MessageT, typename FillFunction>
+	void deliver(rclcpp::SubscriptionBase &subscription, FillFunction fill) {
+		std::shared_ptr<void> message = subscription.create_message();
+		fill(*static_cast<MessageT *>(message.get()));
+		subscription.handle_message(message, rclcpp::MessageInfo());
+		subscription.return_message(message);
+	}
+
+	class CommandAllocationTest : public ::testing::Test {
+	protected:
+		void SetUp() override {
+			// a VESC that only answers the firmware version request, so that the driver operates
+			path_ = ::testing::TempDir() + "test_vesc_command_allocations.vcap";
+			{
+				VescCaptureWriter writer(path_);
+				Buffer fw_version = fwVersionReply();
+				writer.write(false, fw_version.data(), fw_version.size());
+			}
+
+			// intra-process comms enabled like in launch/vesc_composed.launch.py
+			rclcpp::NodeOptions options;
+			options.use_intra_process_comms(true);
+			options.parameter_overrides({
+				{"port", path_},
+				{"replay", true},
+				{"replay_speed", 0.0},
+				{"ackermann_cmd", true},
+				{"can_ids", std::vector<int64_t>{5}},
+				{"diagnostics_period", 0.0},
+				{"duty_cycle_min", -0.5},
+				{"duty_cycle_max", 0.5},
+				{"current_min", -50.0},
+				{"current_max", 50.0},
+				{"brake_min", 0.0},
+				{"brake_max", 200000.0},
+				{"speed_min", -23250.0},
+				{"speed_max", 23250.0},
+				{"position_min", -1.0e6},
+				{"position_max", 1.0e6},
+				{"servo_min", 0.15},
+				{"servo_max", 0.85}});
+			driver_ = std::make_shared<VescDriver>(options);
+
+			// the handshake completes on the replayed reply, before that the commands are only kept
+			// in the pending slots and the path to VescInterface is not measured
+			rclcpp::executors::SingleThreadedExecutor executor;
+			executor.add_node(driver_);
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (!driver_->isOperating() && std::chrono::steady_clock::now() < deadline) {
+				executor.spin_some(std::chrono::milliseconds(10));
+			}
+			ASSERT_TRUE(driver_->isOperating()) << "no handshake with the replayed VESC";
+		}
+
+		void TearDown() override {
+			driver_.reset();
+			std::remove(path_.c_str());
+		}
+
+		/**
+		 * Delivers the commands in @p values on @p topic, warming up with a first round (which also
+		 * logs the clipping of out of range values), and returns the allocations of the others.
+		 */
+		size_t commandAllocations(const std::string &topic, const std::vector<double> &values) {
+			auto subscription = findSubscription(*driver_, topic);
+			EXPECT_TRUE(subscription) << topic;
+			if (!subscription) {
+				return 0;
+			}
+			auto send_all = [&subscription, &values]() {
+				for (double value : values) {
+					deliver<Float64>(*subscription, [value](Float64 &msg) { msg.data = value; });
+				}
+			};
+			send_all();
+			return countAllocations([&send_all]() {
+				for (int i = 0; i < 100; i++) {
+					send_all();
+				}
+			});
+		}
+
+		std::string path_;
+		std::shared_ptr<VescDriver> driver_;
+	};
+
+	TEST_F(CommandAllocationTest, MotorCommands) {
+		for (const std::string prefix : {"/commands/motor/", "/can_5/commands/motor/"}) {
+			EXPECT_EQ(0u, commandAllocations(prefix + "duty_cycle", {-1.0, 0.1, 1.0}));
+			EXPECT_EQ(0u, commandAllocations(prefix + "current", {-100.0, 1.0, 100.0}));
+			EXPECT_EQ(0u, commandAllocations(prefix + "brake", {-1.0, 10.0, 3.0e5}));
+			EXPECT_EQ(0u, commandAllocations(prefix + "speed", {-3.0e4, 500.0, 3.0e4}));
+			EXPECT_EQ(0u, commandAllocations(prefix + "position", {-2.0e6, 1.0, 2.0e6}));
+		}
+	}
+
+	TEST_F(CommandAllocationTest, ServoCommands) {
+		// publishes sensors/servo_position_command as well
+		EXPECT_EQ(0u, commandAllocations("/commands/servo/position", {0.0, 0.5, 1.0}));
+		EXPECT_EQ(0u, commandAllocations("/can_5/commands/servo/position", {0.0, 0.5, 1.0}));
+	}
+
+	TEST_F(CommandAllocationTest, AckermannCommands) {
+		auto subscription = findSubscription(*driver_, "/ackermann_cmd");
+		ASSERT_TRUE(subscription);
+		auto send_all = [&subscription]() {
+			for (double speed : {-10.0, 1.0, 10.0}) {
+				deliver<AckermannDriveStamped>(*subscription, [speed](AckermannDriveStamped &msg) {
+					msg.drive.speed = static_cast<float>(speed);
+					msg.drive.steering_angle = static_cast<float>(speed / 20.0);
+				});
+			}
+		};
+		send_all();
+		EXPECT_EQ(0u, countAllocations([&send_all]() {
+			for (int i = 0; i < 100; i++) {
+				send_all();
+			}
+		}));
+	}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest(&argc, argv);
+	rclcpp::init(argc, argv);
+	int result = RUN_ALL_TESTS();
+	rclcpp::shutdown();
+	return result;
+}
@@ -0,0 +1,161 @@
+/**
+ * Replays a capture of a VESC that answers the firmware version request and streams
+ * COMM_GET_VALUES replies, through VescInterface and through the driver node.
+ */
+
+#include "vesc_driver/vesc_capture.hpp"
+#include "vesc_driver/vesc_driver.hpp"
+#include "vesc_driver/vesc_interface.hpp"
+#include "vesc_driver/vesc_replay_port.hpp"
+#include "vesc_test_frames.hpp"
+
+#include <gtest/gtest.h>
+#include <rclcpp/rclcpp.hpp>
+#include <vesc_msgs/msg/vesc_state_stamped.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace vesc_driver;
+using namespace vesc_driver::test;
+using vesc_msgs::msg::VescStateStamped;
+
+namespace {
+
+	constexpr int VALUES_COUNT = 25;
+	constexpr int32_t FIRST_RPM = 1000;
+
+	class ReplayTest : public ::testing::Test {
+	protected:
+		void SetUp() override {
+			path_ = ::testing::TempDir() + "test_vesc_replay_" +
+				::testing::UnitTest::GetInstance()->current_test_info()->name() + ".vcap";
+		}
+
+		void TearDown() override {
+			std::remove(path_.c_str());
+		}
+
+		/**
+		 * Records the firmware version reply followed by VALUES_COUNT values replies, @p interval
+		 * apart. The last reply is split in two chunks, like a serial port may deliver it.
+		 */
+		void writeCapture(std::chrono::milliseconds interval) {
+			VescCaptureWriter writer(path_);
+			Buffer fw_version = fwVersionReply();
+			writer.write(false, fw_version.data(), fw_version.size());
+			for (int i = 0; i < VALUES_COUNT; i++) {
+				std::this_thread::sleep_for(interval);
+				Buffer values = valuesReply(FIRST_RPM + i);
+				if (i + 1 < VALUES_COUNT) {
+					writer.write(false, values.data(), values.size());
+				} else {
+					writer.write(false, values.data(), 10);
+					writer.write(false, values.data() + 10, values.size() - 10);
+				}
+			}
+		}
+
+		std::string path_;
+	};
+
+	TEST_F(ReplayTest, InterfaceDecodesEveryFrame) {
+		writeCapture(std::chrono::milliseconds(0));
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool finished = false;
+		std::vector<double> rpms;
+		std::vector<std::string> errors;
+		int fw_major = -1;
+
+		VescInterface vesc(
+			std::string(), VescInterface::PacketHandlerFunction(), [&](const std::string &error) {
+				std::lock_guard<std::mutex> lock(mutex);
+				errors.push_back(error);
+			});
+		vesc.setPort(std::make_unique<VescReplayPort>(0.0, [&]() {
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+			cv.notify_all();
+		}));
+		vesc.subscribe<VescPacketFWVersion>([&](const VescPacketFWVersion &fw_version) {
+			std::lock_guard<std::mutex> lock(mutex);
+			fw_major = fw_version.fwMajor();
+		});
+		vesc.subscribe<VescPacketValues>([&](const VescPacketValues &values) {
+			std::lock_guard<std::mutex> lock(mutex);
+			rpms.push_back(values.rpm());
+			EXPECT_DOUBLE_EQ(12.0, values.v_in());
+			cv.notify_all();
+		});
+		vesc.connect(path_);
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			// the replay ends when the bytes are handed over, the framer decodes them after that
+			ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&]() {
+				return finished && rpms.size() == static_cast<size_t>(VALUES_COUNT);
+			}));
+		}
+		vesc.disconnect();
+
+		EXPECT_EQ(5, fw_major);
+		for (int i = 0; i < VALUES_COUNT; i++) {
+			EXPECT_DOUBLE_EQ(FIRST_RPM + i, rpms[i]);
+		}
+		EXPECT_TRUE(errors.empty()) << errors.front();
+	}
+
+	TEST_F(ReplayTest, DriverPublishesReplayedTelemetry) {
+		writeCapture(std::chrono::milliseconds(20));
+
+		// subscribed before the driver starts the replay, from its constructor
+		auto listener = std::make_shared<rclcpp::Node>("replay_listener");
+		std::vector<double> speeds;
+		auto sub = listener->create_subscription<VescStateStamped>(
+			"sensors/core", rclcpp::QoS{VALUES_COUNT}, [&speeds](const VescStateStamped::SharedPtr msg) {
+				speeds.push_back(msg->state.speed);
+			});
+
+		rclcpp::NodeOptions options;
+		options.parameter_overrides({
+			{"port", path_},
+			{"replay", true},
+			{"replay_speed", 1.0},
+			{"diagnostics_period", 0.0}});
+		auto driver = std::make_shared<VescDriver>(options);
+
+		rclcpp::executors::SingleThreadedExecutor executor;
+		executor.add_node(listener);
+		executor.add_node(driver);
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while ((speeds.empty() || speeds.back() != FIRST_RPM + VALUES_COUNT - 1) &&
+			std::chrono::steady_clock::now() < deadline) {
+			executor.spin_some(std::chrono::milliseconds(10));
+		}
+
+		// the first samples may go out before the subscription is matched, none after that
+		ASSERT_FALSE(speeds.empty());
+		EXPECT_EQ(FIRST_RPM + VALUES_COUNT - 1, speeds.back());
+		for (size_t i = 1; i < speeds.size(); i++) {
+			EXPECT_EQ(speeds[i - 1] + 1, speeds[i]);
+		}
+	}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+	::testing::InitGoogleTest(&argc, argv);
+	rclcpp::init(argc, argv);
+	int result = RUN_ALL_TESTS();
+	rclcpp::shutdown();
+	return result;
+}
@@ -0,0 +1,46 @@
+#ifndef VESC_DRIVER__TEST__VESC_TEST_FRAMES_HPP_
+#define VESC_DRIVER__TEST__VESC_TEST_FRAMES_HPP_
+
+#include "vesc_driver/datatypes.hpp"
+#include "vesc_driver/vesc_crc.hpp"
+#include "vesc_driver/vesc_packet.hpp"
+#include "vesc_driver/vesc_schema.hpp"
+
+#include <cstdint>
+
+namespace vesc_driver {
+	namespace test {
+
+		/** @p payload as the VESC sends it: SOF, length, payload, CRC, EOF */
+		inline Buffer frame(const Buffer &payload) {
+			Buffer frame;
+			frame.push_back(static_cast<uint8_t>(VescFrame::VESC_SOF_VAL_SMALL_FRAME));
+			frame.push_back(static_cast<uint8_t>(payload.size()));
+			frame.insert(frame.end(), payload.begin(), payload.end());
+			const uint16_t crc = VescCrc::calculate(payload.data(), payload.size());
+			frame.push_back(static_cast<uint8_t>(crc >> 8));
+			frame.push_back(static_cast<uint8_t>(crc & 0xFF));
+			frame.push_back(static_cast<uint8_t>(VescFrame::VESC_EOF_VAL));
+			return frame;
+		}
+
+		/** COMM_FW_VERSION reply of firmware 5.2 on hardware "test" */
+		inline Buffer fwVersionReply() {
+			Buffer payload = {COMM_FW_VERSION, 5, 2, 't', 'e', 's', 't', 0};
+			payload.resize(payload.size() + 12 + 3);  // UUID, pairing and test version
+			return frame(payload);
+		}
+
+		/** COMM_GET_VALUES reply with @p rpm and an input voltage of 12 V, all else 0 */
+		inline Buffer valuesReply(int32_t rpm) {
+			Buffer payload(73);
+			payload[0] = COMM_GET_VALUES;
+			schema::storeBigEndian<int32_t>(payload.data() + 23, rpm);
+			schema::storeBigEndian<int16_t>(payload.data() + 27, 120);
+			return frame(payload);
+		}
+
+	}  // namespace test
+}  // namespace vesc_driver
+
+#endif  // VESC_DRIVER__TEST__VESC_TEST_FRAMES_HPP_